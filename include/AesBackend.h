@@ -0,0 +1,138 @@
+/*
+ Copyright (C) 2020 chester4444@wolke7.net
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _AESBACKEND_H_
+#define _AESBACKEND_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+// AES-128 CTR decryption backends, selected by a build flag:
+//   AES_BACKEND_TABLE  software AES with a T-table (default)
+//   AES_BACKEND_HW     ESP32 hardware AES peripheral
+//   AES_BACKEND_SMALL  rweather/Crypto AESSmall128, least RAM per meter
+#if !defined(AES_BACKEND_TABLE) && !defined(AES_BACKEND_HW) && !defined(AES_BACKEND_SMALL)
+  #define AES_BACKEND_TABLE
+#endif
+
+#if defined(AES_BACKEND_HW) && !defined(ESP32)
+  #error "AES_BACKEND_HW needs the ESP32 AES peripheral"
+#endif
+
+#if defined(AES_BACKEND_HW)
+  #if __has_include("aes/esp_aes.h")
+    #include "aes/esp_aes.h"
+  #else
+    #include "hwcrypto/aes.h"
+  #endif
+#elif defined(AES_BACKEND_SMALL)
+  #include <AES.h>
+#endif
+
+#define AES_BLOCK_SIZE  16
+
+// AES-128 CTR mode, the counter is the whole 16 byte block (big endian)
+// input and output may be the same buffer
+template <class Cipher>
+void aesCtrCrypt(Cipher &cipher, const uint8_t *iv, const uint8_t *input, uint8_t *output, size_t len)
+{
+  uint8_t counter[AES_BLOCK_SIZE];
+  uint8_t keyStream[AES_BLOCK_SIZE];
+
+  memcpy(counter, iv, AES_BLOCK_SIZE);
+
+  while (len > 0)
+  {
+    cipher.encryptBlock(keyStream, counter);
+
+    size_t chunk = (len < AES_BLOCK_SIZE) ? len : AES_BLOCK_SIZE;
+    for (size_t i = 0; i < chunk; i++)
+    {
+      output[i] = input[i] ^ keyStream[i];
+    }
+    input += chunk;
+    output += chunk;
+    len -= chunk;
+
+    // increment the counter
+    for (int i = AES_BLOCK_SIZE - 1; i >= 0; i--)
+    {
+      if (++counter[i] != 0) break;
+    }
+  }
+}
+
+#if defined(AES_BACKEND_TABLE)
+// software AES-128 with an expanded key and a single T-table
+class Aes128
+{
+  private:
+    uint32_t roundKeys[44];
+
+  public:
+    // expand a 16 byte key
+    void setKey(const uint8_t *key);
+
+    // encrypt one 16 byte block
+    void encryptBlock(uint8_t *output, const uint8_t *input) const;
+
+    // decrypt len bytes in CTR mode
+    void ctrCrypt(const uint8_t *iv, const uint8_t *input, uint8_t *output, size_t len)
+    {
+      aesCtrCrypt(*this, iv, input, output, len);
+    }
+};
+
+#elif defined(AES_BACKEND_HW)
+// ESP32 AES peripheral, shared by both cores through the IDF driver
+class Aes128
+{
+  private:
+    esp_aes_context context;
+
+  public:
+    // load a 16 byte key, the hardware does the expansion
+    void setKey(const uint8_t *key);
+
+    // encrypt one 16 byte block
+    void encryptBlock(uint8_t *output, const uint8_t *input);
+
+    // decrypt len bytes in CTR mode, one peripheral transaction
+    void ctrCrypt(const uint8_t *iv, const uint8_t *input, uint8_t *output, size_t len);
+};
+
+#elif defined(AES_BACKEND_SMALL)
+// rweather/Crypto AESSmall128, expands the key on the fly for every block
+class Aes128
+{
+  private:
+    AESSmall128 aes;
+
+  public:
+    // store a 16 byte key
+    void setKey(const uint8_t *key) { aes.setKey(key, 16); }
+
+    // encrypt one 16 byte block
+    void encryptBlock(uint8_t *output, const uint8_t *input) { aes.encryptBlock(output, input); }
+
+    // decrypt len bytes in CTR mode
+    void ctrCrypt(const uint8_t *iv, const uint8_t *input, uint8_t *output, size_t len)
+    {
+      aesCtrCrypt(*this, iv, input, output, len);
+    }
+};
+#endif
+
+#endif // _AESBACKEND_H_
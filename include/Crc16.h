@@ -0,0 +1,57 @@
+/*
+ Copyright (C) 2020 chester4444@wolke7.net
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _CRC16_H_
+#define _CRC16_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+// the sliced crc needs 1.5 kB more tables, only host builds get it
+// unless -D CRC16_SLICE4 is set
+#if !defined(ARDUINO) && !defined(CRC16_SLICE4)
+  #define CRC16_SLICE4
+#endif
+
+// CRC16 EN13757 (polynomial 0x3D65) used by wmbus, table driven
+// can be continued chunk by chunk while a frame streams in
+class Crc16
+{
+  public:
+    static const uint16_t INIT = 0x0000;
+
+    // continue a crc over len bytes, one table lookup per byte
+    static uint16_t update(uint16_t crc, const uint8_t *data, size_t len);
+
+#if defined(CRC16_SLICE4)
+    // same result as update(), 4 bytes per step with four tables,
+    // for bulk decoding where the extra 1.5 kB of tables don't matter
+    static uint16_t updateSlice4(uint16_t crc, const uint8_t *data, size_t len);
+#endif
+
+    // value as transmitted
+    static uint16_t finish(uint16_t crc) { return ~crc; }
+
+    // crc of a complete buffer
+    static uint16_t compute(const uint8_t *data, size_t len)
+    {
+#if defined(CRC16_SLICE4)
+      return finish(updateSlice4(INIT, data, len));
+#else
+      return finish(update(INIT, data, len));
+#endif
+    }
+};
+
+#endif // _CRC16_H_
@@ -0,0 +1,106 @@
+/*
+ Copyright (C) 2020 chester4444@wolke7.net
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _DATARECORDS_H_
+#define _DATARECORDS_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+// max. number of data records kept from one frame
+#define MAX_DATA_RECORDS 16
+
+// what a record measures, decoded from its VIF/VIFE
+enum RecordType
+{
+  RecordUnknown = 0,
+  RecordEnergy,              // Wh
+  RecordVolume,              // m3
+  RecordMass,                // kg
+  RecordPower,               // W
+  RecordVolumeFlow,          // m3/h
+  RecordFlowTemperature,     // C
+  RecordReturnTemperature,   // C
+  RecordTemperatureDiff,     // K
+  RecordExternalTemperature, // C
+  RecordPressure,            // bar
+  RecordDate,
+  RecordDateTime,
+  RecordInfoCodes,           // manufacturer specific error/status flags
+};
+
+// function field of the DIF
+enum RecordFunction
+{
+  FunctionInstantaneous = 0,
+  FunctionMaximum = 1,
+  FunctionMinimum = 2,
+  FunctionError = 3,
+};
+
+// one DIF/VIF data record, the value is raw * 10^exponent in the unit of the type
+struct DataRecord
+{
+  uint8_t dif;           // data field coding of the value
+  uint8_t type;          // RecordType
+  uint8_t function;      // RecordFunction
+  uint8_t storage;       // storage number, 0 = current value
+  uint8_t tariff;
+  int8_t exponent;
+  uint8_t headerOffset;  // position of the DIF
+  uint8_t headerLength;  // DIF, DIFEs, VIF and VIFEs
+  uint8_t dataOffset;    // position of the value
+  uint8_t dataLength;
+  uint8_t packedOffset;  // position of the value with all headers left out
+  int64_t value;
+
+  // value converted to 10^exp units, e.g. exp -3 gives liters for a volume
+  int32_t scaled(int8_t exp) const;
+};
+
+// walks the DIF/DIFE/VIF/VIFE data records of a decrypted application layer,
+// no heap, records beyond MAX_DATA_RECORDS are parsed but dropped
+class DataRecords
+{
+  public:
+    DataRecord records[MAX_DATA_RECORDS];
+    uint8_t count = 0;
+
+    // crc16 over all DIF/VIF headers, the format signature of compact frames
+    uint16_t signature = 0;
+
+    // length of all values with the headers left out
+    uint8_t packedLength = 0;
+
+    // parse len bytes of data records, false if the data is malformed
+    bool parse(const uint8_t *data, uint8_t len);
+
+    // first record with matching type, function and storage number, NULL if none
+    const DataRecord *find(RecordType type, RecordFunction function = FunctionInstantaneous,
+                           uint8_t storage = 0) const;
+
+    // first record of a type, whatever function or storage number
+    const DataRecord *first(RecordType type) const;
+
+    // length of the value for a DIF, 0xff for variable length
+    static uint8_t dataLengthOf(uint8_t dif);
+
+    // decode the value of a record from data, false for invalid bcd
+    static bool readValue(DataRecord &record, const uint8_t *data);
+
+  private:
+    static void decodeVif(DataRecord &record, uint8_t vif, uint8_t vife);
+};
+
+#endif // _DATARECORDS_H_
@@ -0,0 +1,84 @@
+/*
+ Copyright (C) 2020 chester4444@wolke7.net
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _FORMATCACHE_H_
+#define _FORMATCACHE_H_
+
+#include <stdint.h>
+#include "DataRecords.h"
+
+// record layouts kept for compact frames; a layout is shared by all meters
+// with the same firmware, so a few entries serve hundreds of meters
+#ifndef FORMAT_CACHE_SIZE
+#define FORMAT_CACHE_SIZE 8
+#endif
+
+// where a record sits in a compact frame
+struct RecordLayout
+{
+  uint8_t dif;
+  uint8_t type;
+  uint8_t function;
+  uint8_t storage;
+  int8_t exponent;
+  uint8_t offset;     // position of the value, headers left out
+  uint8_t length;
+};
+
+// the layout of one format signature
+struct FormatEntry
+{
+  uint16_t signature;
+  uint8_t count;        // number of records, 0 = unused entry
+  uint8_t length;       // length of all values
+  uint32_t lastUsed;    // for lru eviction
+  RecordLayout layout[MAX_DATA_RECORDS];
+};
+
+// record layouts learned from long frames, keyed by format signature,
+// used to decode compact frames in a single pass over an offset table
+class FormatCache
+{
+  public:
+    struct Statistics
+    {
+      uint32_t hits;        // compact frames decoded
+      uint32_t misses;      // compact frames with an unknown signature
+      uint32_t evictions;   // layouts dropped to make room
+    };
+
+  private:
+    FormatEntry entries[FORMAT_CACHE_SIZE];
+    uint32_t clock = 0;
+    Statistics statistics = {};
+
+    FormatEntry *lookup(uint16_t signature);
+    FormatEntry *place(uint16_t signature);
+
+  public:
+    FormatCache(void);
+
+    // remember the layout of a parsed long frame, replaces the least recently used
+    void learn(const DataRecords &records);
+
+    // add the layouts another cache has learned
+    void learn(const FormatCache &other);
+
+    // decode the values of a compact frame, false if the signature is unknown
+    bool unpack(uint16_t signature, const uint8_t *data, uint8_t len, DataRecords &records);
+
+    const Statistics & getStatistics(void) const { return statistics; }
+};
+
+#endif // _FORMATCACHE_H_
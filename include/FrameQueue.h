@@ -0,0 +1,81 @@
+/*
+ Copyright (C) 2020 chester4444@wolke7.net
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _FRAMEQUEUE_H_
+#define _FRAMEQUEUE_H_
+
+#include <Arduino.h>
+#include <atomic>
+#include "WMbusFrame.h"
+
+// a wmbus frame as captured by the radio, not yet checked or decrypted
+struct RawFrame
+{
+  uint32_t timestamp;                       // millis() when the frame was complete
+  int8_t rssi;                              // signal strength in dBm
+  uint8_t lqi;                              // link quality indicator
+  int8_t freqOffset;                        // FREQEST, 1.59 kHz steps
+  uint8_t length;                           // payload length
+  uint8_t payload[WMBusFrame::MAX_LENGTH];  // frame data after the lfield, without link layer crcs
+};
+
+// lock-free queue of raw frames for a single producer (radio)
+// and a single consumer (decoder), SIZE must be a power of two
+template <uint8_t SIZE>
+class FrameQueue
+{
+  private:
+    RawFrame frames[SIZE];
+    std::atomic<uint8_t> head;   // next slot to fill, only written by the producer
+    std::atomic<uint8_t> tail;   // next slot to read, only written by the consumer
+
+  public:
+    FrameQueue() : head(0), tail(0) {}
+
+    // number of queued frames
+    uint8_t depth(void) const
+    {
+      return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+    }
+
+    // producer: free slot to fill, NULL if the queue is full
+    RawFrame *claim(void)
+    {
+      uint8_t h = head.load(std::memory_order_relaxed);
+      if ((uint8_t)(h - tail.load(std::memory_order_acquire)) >= SIZE) return NULL;
+      return &frames[h & (SIZE - 1)];
+    }
+
+    // producer: hand the claimed slot over to the consumer
+    void push(void)
+    {
+      head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // consumer: oldest queued frame, NULL if the queue is empty
+    RawFrame *front(void)
+    {
+      uint8_t t = tail.load(std::memory_order_relaxed);
+      if (t == head.load(std::memory_order_acquire)) return NULL;
+      return &frames[t & (SIZE - 1)];
+    }
+
+    // consumer: release the frame returned by front()
+    void pop(void)
+    {
+      tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+};
+
+#endif // _FRAMEQUEUE_H_
@@ -0,0 +1,63 @@
+/*
+ Copyright (C) 2020 chester4444@wolke7.net
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _JSONWRITER_H_
+#define _JSONWRITER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+// longest text of formatFixed(): sign, 10 digits, point and terminator
+#define FIXED_TEXT_LENGTH 13
+
+// writes a flat json object into a caller owned buffer, no heap and no
+// printf; if the buffer is too small the result is marked as not ok
+class JsonWriter
+{
+  private:
+    char *buffer;
+    size_t size;
+    size_t length = 0;
+    bool first = true;
+    bool overflow = false;
+
+    void append(const char *text);
+    void append(char c);
+    void key(const char *name);
+
+  public:
+    JsonWriter(char *buffer, size_t size);
+
+    void beginObject(void);
+    void endObject(void);
+
+    // "name": number, the number text is written as is
+    void addNumber(const char *name, const char *number);
+
+    // "name": "value", without escaping
+    void addString(const char *name, const char *value);
+
+    // the terminated json text
+    const char *c_str(void) const { return buffer; }
+    size_t getLength(void) const { return length; }
+
+    // false, if the buffer was too small
+    bool ok(void) const { return !overflow; }
+
+    // value / 10^decimals as text, out needs FIXED_TEXT_LENGTH bytes,
+    // returns the text length
+    static size_t formatFixed(char *out, int32_t value, uint8_t decimals);
+};
+
+#endif // _JSONWRITER_H_
@@ -0,0 +1,42 @@
+/*
+ Copyright (C) 2020 chester4444@wolke7.net
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _MANCHESTER_H_
+#define _MANCHESTER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+// manchester code of wmbus mode S (EN 13757-4), every bit is sent as two
+// chips, 01 for a one and 10 for a zero; streaming like ThreeOfSix, so the
+// fifo can be decoded chunk by chunk while a frame arrives
+class Manchester
+{
+  private:
+    uint8_t nibble = 0;     // data bits of an odd coded byte
+    bool half = false;
+
+  public:
+    // start a new frame
+    void reset(void) { nibble = 0; half = false; }
+
+    // decode len coded bytes to out, which may be the same buffer as in,
+    // returns the number of data bytes or -1 for an invalid chip pair
+    int16_t decode(const uint8_t *in, size_t len, uint8_t *out);
+
+    // bytes on air for len data bytes
+    static uint16_t encodedLength(uint16_t len) { return len * 2; }
+};
+
+#endif // _MANCHESTER_H_
@@ -0,0 +1,69 @@
+/*
+ Copyright (C) 2020 chester4444@wolke7.net
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _METER_H_
+#define _METER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "MeterProfiles.h"
+
+// topics of a meter: MQTT_TOPIC_ROOT<serial>/sensor/mydata(json) and MQTT_TOPIC_ROOT<serial>/link
+#define MQTT_TOPIC_ROOT   "watermeter/"
+#define MQTT_TOPIC_LENGTH 40
+
+// weight of a new frame in the link averages is 1/2^LINK_AVERAGE_SHIFT
+#define LINK_AVERAGE_SHIFT 3
+
+// signal and reception of a meter, to tell a weak meter from a lost one;
+// the averages are fixed point, x16
+struct LinkStats
+{
+  int16_t rssi;             // dBm
+  int16_t lqi;              // lower is better
+  int16_t freqOffset;       // FREQEST, 26 MHz / 2^14 = 1.59 kHz steps
+  uint8_t accessNo;         // access number of the last frame
+  uint32_t received;        // frames decoded
+  uint32_t missed;          // frames sent but not received, from gaps in the access number
+
+  // add a valid frame, duplicates are ignored
+  void update(int8_t rssi, uint8_t lqi, int8_t freqOffset, uint8_t accessNo);
+
+  // received frames in percent of the frames sent since the first one
+  uint8_t receptionRate(void) const;
+};
+
+// everything we know about a meter, kept small for gateways with hundreds
+// of them: topics are built when needed, expanded keys (CIPHER_CACHE_SIZE)
+// and held compact frames are kept by the decoder
+struct Meter
+{
+  uint32_t id;              // serial number, as printed on the meter
+  char name[9];             // serial as hex string, used in the MQTT topics
+  const uint8_t *key;       // AES-128 key, 16 bytes
+  uint8_t lastAccessNo;     // access number of the last valid frame
+  uint32_t lastSeen;        // millis() of the last valid frame
+  const MeterProfile *profile; // kind of meter, NULL until its first frame
+  int32_t values[MAX_PROFILE_FIELDS]; // last published values, as described by the profile
+  uint32_t lastPublished;   // millis() of the last publish
+  uint32_t sent;            // readings published, or stored for later
+  uint32_t suppressed;      // readings not published by the publish policy
+  LinkStats link;           // signal quality and reception rate
+};
+
+// MQTT_TOPIC_ROOT<serial>/<leaf>, e.g. leaf "sensor/mydata", into a buffer
+// of MQTT_TOPIC_LENGTH, no allocation
+void meterTopic(char *topic, size_t size, const Meter &meter, const char *leaf);
+
+#endif // _METER_H_
@@ -0,0 +1,125 @@
+/*
+ Copyright (C) 2020 chester4444@wolke7.net
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _METERPROFILES_H_
+#define _METERPROFILES_H_
+
+#include <stdint.h>
+#include "DataRecords.h"
+
+#define MAX_PROFILE_FIELDS  6
+#define ANY_FUNCTION        0xFF
+#define ANY_STORAGE         0xFF
+
+// when the values of a meter are published: on change, but not more often
+// than the min. interval, and unchanged values again as a heartbeat;
+// PUBLISH_ON_CHANGE 0 gives heartbeats only, PUBLISH_HEARTBEAT_MIN 0 none
+#ifndef PUBLISH_ON_CHANGE
+#define PUBLISH_ON_CHANGE       1
+#endif
+#ifndef PUBLISH_MIN_INTERVAL_S
+#define PUBLISH_MIN_INTERVAL_S  60
+#endif
+#ifndef PUBLISH_HEARTBEAT_MIN
+#define PUBLISH_HEARTBEAT_MIN   15
+#endif
+
+struct Meter;
+
+// one published value: which record, how it is scaled and named
+struct ProfileField
+{
+  uint8_t type;         // RecordType
+  uint8_t function;     // RecordFunction or ANY_FUNCTION
+  uint8_t storage;      // storage number or ANY_STORAGE
+  int8_t exponent;      // the value is kept as an integer of 10^exponent units
+  uint8_t decimals;     // decimals of the published value
+  const char *key;      // json key
+  const char *unit;     // for the serial log
+};
+
+// the profile of a meter, resolved once from its first frame
+struct MeterProfile
+{
+  uint8_t id;           // index in the profile list, kept with stored readings
+  const char *name;
+  uint8_t fields;
+  const ProfileField *field;
+
+  // check and publish the records of a frame, store the values in the meter
+  bool (*publish)(Meter *meter, const DataRecords &records);
+};
+
+// compile time descriptors, the first field goes to the plain value topic
+
+// Kamstrup Multical21 cold/warm water meter, keys of the original firmware
+struct Multical21Profile
+{
+  static constexpr uint8_t FIELDS = 4;
+  static constexpr ProfileField FIELD[FIELDS] =
+  {
+    { RecordVolume, FunctionInstantaneous, 0, -3, 3, "CurrentValue", "m3" },
+    { RecordVolume, FunctionInstantaneous, 1, -3, 3, "MonthStartValue", "m3" },
+    { RecordFlowTemperature, ANY_FUNCTION, ANY_STORAGE, 0, 0, "WaterTemp", "C" },
+    { RecordExternalTemperature, ANY_FUNCTION, ANY_STORAGE, 0, 0, "RoomTemp", "C" },
+  };
+};
+
+// Kamstrup flowIQ water meters, like the Multical21 plus the peak flow
+struct FlowIQProfile
+{
+  static constexpr uint8_t FIELDS = 5;
+  static constexpr ProfileField FIELD[FIELDS] =
+  {
+    { RecordVolume, FunctionInstantaneous, 0, -3, 3, "CurrentValue", "m3" },
+    { RecordVolume, FunctionInstantaneous, 1, -3, 3, "MonthStartValue", "m3" },
+    { RecordFlowTemperature, ANY_FUNCTION, ANY_STORAGE, 0, 0, "WaterTemp", "C" },
+    { RecordExternalTemperature, ANY_FUNCTION, ANY_STORAGE, 0, 0, "RoomTemp", "C" },
+    { RecordVolumeFlow, FunctionMaximum, ANY_STORAGE, -3, 3, "MaxFlow", "m3/h" },
+  };
+};
+
+// Kamstrup Multical 302/403 heat meters
+struct MulticalHeatProfile
+{
+  static constexpr uint8_t FIELDS = 6;
+  static constexpr ProfileField FIELD[FIELDS] =
+  {
+    { RecordEnergy, FunctionInstantaneous, 0, 3, 0, "Energy", "kWh" },
+    { RecordVolume, FunctionInstantaneous, 0, -2, 2, "Volume", "m3" },
+    { RecordEnergy, FunctionInstantaneous, 1, 3, 0, "MonthStartEnergy", "kWh" },
+    { RecordFlowTemperature, FunctionInstantaneous, ANY_STORAGE, -2, 2, "FlowTemp", "C" },
+    { RecordReturnTemperature, FunctionInstantaneous, ANY_STORAGE, -2, 2, "ReturnTemp", "C" },
+    { RecordPower, FunctionInstantaneous, ANY_STORAGE, 2, 1, "Power", "kW" },
+  };
+};
+
+// record of a field, NULL if the frame doesn't have it
+const DataRecord *findField(const DataRecords &records, const ProfileField &field);
+
+// decode and publish path of a profile, firmware only (ProfilePublish.cpp)
+template <class P>
+bool publishProfile(Meter *meter, const DataRecords &records);
+
+// profile of a meter by the link layer header (manufacturer, version, type)
+const MeterProfile *findProfile(const uint8_t *payload);
+
+// profile by its id, NULL if unknown
+const MeterProfile *profileById(uint8_t id);
+
+// publish readings stored while offline, as many as fit in one message;
+// returns false if there is nothing left to send
+bool forwardStoredReadings(void);
+
+#endif // _METERPROFILES_H_
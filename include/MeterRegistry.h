@@ -0,0 +1,68 @@
+/*
+ Copyright (C) 2020 chester4444@wolke7.net
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _METERREGISTRY_H_
+#define _METERREGISTRY_H_
+
+#include <Arduino.h>
+#include "Meter.h"
+#if defined(NATIVE_TEST)
+  // host tests, test/fakes
+  #include "fake_credentials.h"
+#else
+  #include "credentials.h"
+#endif
+
+#if !defined(NUM_METERS)
+  // credentials.h of a single meter setup (meterId, key)
+  #define NUM_METERS 1
+  #define SINGLE_METER_CREDENTIALS
+#endif
+
+// expanded keys, 176 bytes each with the table backend: one per meter, so
+// each key is expanded once, up to CIPHER_CACHE_MAX; a larger gateway keeps
+// the meters heard last and expands the others' keys again
+#ifndef CIPHER_CACHE_MAX
+  #if defined(ESP8266)
+    #define CIPHER_CACHE_MAX 8
+  #else
+    #define CIPHER_CACHE_MAX 128
+  #endif
+#endif
+#ifndef CIPHER_CACHE_SIZE
+  #define CIPHER_CACHE_SIZE (NUM_METERS < CIPHER_CACHE_MAX ? NUM_METERS : CIPHER_CACHE_MAX)
+#endif
+
+// fixed size table of all meters from credentials.h, sorted by id
+class MeterRegistry
+{
+  private:
+    Meter meters[NUM_METERS];
+    uint16_t count = 0;
+
+  public:
+    // load the meters from credentials.h
+    void begin(void);
+
+    // binary search for a meter, NULL if it is not ours
+    Meter *find(uint32_t id);
+
+    // number of meters
+    uint16_t size(void) const { return count; }
+
+    // meter by index, in id order
+    Meter &operator[](uint16_t i) { return meters[i]; }
+};
+
+#endif // _METERREGISTRY_H_
@@ -0,0 +1,140 @@
+/*
+ Copyright (C) 2020 chester4444@wolke7.net
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _MQTTTRANSPORT_H_
+#define _MQTTTRANSPORT_H_
+
+#include <Arduino.h>
+#include <atomic>
+#include <AsyncMqttClient.h>
+
+#define MQTT_QUEUE_SIZE        8       // outgoing messages, power of two
+#define MQTT_ACK_QUEUE_SIZE    16      // acks from the network task, power of two
+#define MQTT_TOPIC_MAX         48
+#define MQTT_PAYLOAD_MAX       400     // a backlog batch of a few readings
+#define MQTT_INFLIGHT_WINDOW   4       // messages sent but not yet acked
+#define MQTT_SENDS_PER_SERVICE 1       // publishes handed to the client per service()
+#define MQTT_BACKOFF_MIN_MS    1000    // reconnect delay, doubled after every failure
+#define MQTT_BACKOFF_MAX_MS    60000
+#define MQTT_CONNECT_TIMEOUT_MS 10000  // give up on a connect without any answer
+
+// a queued outgoing message
+struct MqttMessage
+{
+  char topic[MQTT_TOPIC_MAX];
+  char payload[MQTT_PAYLOAD_MAX];
+  uint16_t length;
+  uint8_t qos;
+  bool retain;
+  bool dup;             // sent before, but the connection was lost before the ack
+  bool done;            // qos 0 sent or qos 1 acked, the slot is freed in order
+  uint16_t packetId;    // 0 while not sent
+};
+
+// mqtt on top of AsyncMqttClient: publishes go to a queue, service() sends
+// them with a window of unacked qos 1 messages and reconnects with
+// exponential backoff, nothing here waits for an answer of the broker;
+// the client's publish() does block while it builds the packet and hands
+// it to the tcp task, so service() makes at most MQTT_SENDS_PER_SERVICE
+// of them, the radio runs in between;
+// the queue is static, but AsyncMqttClient 0.9 allocates a packet and a
+// copy of the payload for every publish it sends, so the heap still sees
+// one allocation per message sent, none per message refused or queued
+class MqttTransport
+{
+  public:
+    typedef void (*ConnectHandler)(void);
+    typedef void (*MessageHandler)(const char *topic, const char *payload, size_t len);
+
+    struct Statistics
+    {
+      uint32_t queued;        // messages accepted by publish()
+      uint32_t drops;         // messages refused, queue full or too long
+      uint32_t sent;          // publishes handed to the tcp stack, including resends
+      uint32_t resends;       // qos 1 messages sent again after a reconnect
+      uint32_t acks;          // qos 1 acks received
+      uint32_t connects;      // successful connects
+      uint32_t failures;      // failed or lost connections
+      uint8_t maxDepth;       // most messages waiting
+    };
+
+  private:
+    AsyncMqttClient client;
+
+    MqttMessage queue[MQTT_QUEUE_SIZE];
+    uint8_t tail = 0;         // oldest message
+    uint8_t count = 0;        // messages in the queue
+    uint8_t sentCount = 0;    // messages from tail on that have been sent
+
+    // acks, written by the network task, read by service()
+    uint16_t acks[MQTT_ACK_QUEUE_SIZE];
+    std::atomic<uint8_t> ackHead;
+    std::atomic<uint8_t> ackTail;
+
+    // connection events from the network task
+    std::atomic<bool> connectEvent;
+    std::atomic<bool> disconnectEvent;
+
+    bool connecting = false;  // connect() called, no answer yet
+    bool online = false;      // connect event seen, no disconnect since
+    uint32_t attemptStart = 0;
+    uint32_t nextAttempt = 0;
+    uint32_t backoff = MQTT_BACKOFF_MIN_MS;
+
+    ConnectHandler connectHandler = NULL;
+    MessageHandler messageHandler = NULL;
+
+    Statistics statistics = {};
+
+    void handleAcks(void);
+    void connectionLost(uint32_t now);
+    void sendQueued(void);
+
+  public:
+    MqttTransport(void);
+
+    // server, credentials and last will; the connection is made by service(),
+    // called again after every WiFi reconnect
+    void begin(const char *host, uint16_t port, const char *clientId,
+               const char *user, const char *pass, const char *willTopic, const char *willPayload);
+
+    // called from service() after every (re)connect, to subscribe and announce
+    void onConnect(ConnectHandler handler) { connectHandler = handler; }
+
+    // called from the network task, must not block
+    void onMessage(MessageHandler handler) { messageHandler = handler; }
+
+    // queue a message, false if there is no room
+    bool publish(const char *topic, const char *payload, size_t len, uint8_t qos, bool retain);
+    bool publish(const char *topic, const char *payload, uint8_t qos = 0, bool retain = false)
+      { return publish(topic, payload, strlen(payload), qos, retain); }
+
+    // subscribe while connected, e.g. from the connect handler
+    void subscribe(const char *topic, uint8_t qos = 0) { client.subscribe(topic, qos); }
+
+    // call from loop(), while the network is up; returns at once
+    void service(void);
+
+    bool connected(void) { return client.connected(); }
+
+    // messages waiting to be sent or acked
+    uint8_t getQueueDepth(void) const { return count; }
+
+    // messages publish() takes now
+    uint8_t getFreeSlots(void) const { return MQTT_QUEUE_SIZE - count; }
+
+    const Statistics & getStatistics(void) const { return statistics; }
+};
+
+#endif // _MQTTTRANSPORT_H_
@@ -0,0 +1,52 @@
+/*
+ Copyright (C) 2020 chester4444@wolke7.net
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _RADIOPROFILES_H_
+#define _RADIOPROFILES_H_
+
+#include <stdint.h>
+
+// all configuration registers from IOCFG2 (0x00) to TEST0 (0x2E),
+// written with one burst and read back with another
+#define RADIO_CONFIG_LENGTH 0x2F
+
+// radio profile used at startup, index into RADIO_PROFILES
+#ifndef RADIO_PROFILE
+  #define RADIO_PROFILE 0
+#endif
+
+// what follows the sync word
+enum RadioFraming
+{
+  FramingCT = 0,    // mode C1 frame type, or a 3 of 6 coded mode T1 lfield
+  FramingS,         // manchester coded mode S1 lfield
+};
+
+// a complete cc1101 configuration
+struct RadioProfile
+{
+  const char *name;
+  uint8_t framing;                      // RadioFraming
+  uint8_t regs[RADIO_CONFIG_LENGTH];    // register values by address
+};
+
+#define RADIO_PROFILE_COUNT 4
+
+// C1/T1 325 kHz, C1/T1 narrow 232 kHz, C1/T1 wide 406 kHz, S1 203 kHz
+extern const RadioProfile RADIO_PROFILES[RADIO_PROFILE_COUNT];
+
+// profile by name, NULL if there is none
+const RadioProfile *findRadioProfile(const char *name, uint8_t len);
+
+#endif // _RADIOPROFILES_H_
@@ -0,0 +1,89 @@
+/*
+ Copyright (C) 2020 chester4444@wolke7.net
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _READINGSTORE_H_
+#define _READINGSTORE_H_
+
+#include <Arduino.h>
+#include "MeterProfiles.h"
+
+// readings kept while the broker can't be reached; the store lives in RTC
+// memory, so it survives ESP.restart() and costs no flash writes
+#if defined(ESP8266)
+  // 512 bytes of RTC user memory: eboot keeps the OTA command in the first
+  // 128, then the store, then the wifi cache (WIFI_CACHE_RTC_OFFSET)
+  #define READING_STORE_RTC_OFFSET  128
+  #define READING_STORE_SIZE  9
+#else
+  #define READING_STORE_SIZE  64    // RTC slow memory, not initialized at restart
+#endif
+
+// a reading of a meter, the values as described by its profile
+struct StoredReading
+{
+  uint32_t meterId;
+  uint32_t time;        // gateway clock in seconds
+  uint8_t profile;      // MeterProfile::id
+  uint8_t fields;
+  uint16_t reserved;
+  int32_t values[MAX_PROFILE_FIELDS];
+};
+
+// fixed size ring of readings, the oldest is overwritten when it is full
+class ReadingStore
+{
+  public:
+    struct Statistics
+    {
+      uint32_t stored;        // readings appended
+      uint32_t overwritten;   // oldest readings lost, the store was full
+      uint32_t forwarded;     // readings published later
+      uint32_t savedBytes;    // written through to RTC memory
+    };
+
+  private:
+    Statistics statistics = {};
+    uint32_t bootClock = 0;   // gateway clock at startup
+
+    // write a part of the store through, only what changed
+    void save(size_t offset, size_t size);
+    void saveHeader(void);
+    void remove(uint8_t n);
+
+  public:
+    // restore the store from RTC memory, starts empty after a power cycle
+    void begin(void);
+
+    // seconds since the store was created, continued across restarts
+    uint32_t clock(void) const { return bootClock + millis() / 1000; }
+
+    // keep the clock for the next start, before a restart
+    void saveClock(void) { saveHeader(); }
+
+    void append(const Meter *meter, const int32_t *values, uint8_t fields);
+
+    uint8_t size(void) const;
+
+    // i-th oldest reading
+    const StoredReading &at(uint8_t i) const;
+
+    // remove the n oldest readings, they have been published
+    void forwarded(uint8_t n);
+
+    const Statistics & getStatistics(void) const { return statistics; }
+};
+
+extern ReadingStore readingStore;
+
+#endif // _READINGSTORE_H_
@@ -0,0 +1,64 @@
+/*
+ Copyright (C) 2020 chester4444@wolke7.net
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _RINGBUFFER_H_
+#define _RINGBUFFER_H_
+
+#include <Arduino.h>
+
+// byte ring buffer, SIZE must be a power of two
+template <uint16_t SIZE>
+class RingBuffer
+{
+  private:
+    uint8_t buffer[SIZE];
+    uint16_t head = 0;    // write position
+    uint16_t tail = 0;    // read position
+
+  public:
+    // number of bytes stored
+    uint16_t available(void) const { return (uint16_t)(head - tail); }
+
+    // number of bytes that can still be written
+    uint16_t space(void) const { return SIZE - available(); }
+
+    // discard all stored bytes
+    void clear(void) { head = tail = 0; }
+
+    // store len bytes, returns false if they don't fit
+    bool write(const uint8_t *data, uint16_t len)
+    {
+      if (len > space()) return false;
+
+      for (uint16_t i = 0; i < len; i++)
+      {
+        buffer[head++ & (SIZE - 1)] = data[i];
+      }
+      return true;
+    }
+
+    // remove len bytes, returns false if not enough bytes are stored
+    bool read(uint8_t *data, uint16_t len)
+    {
+      if (len > available()) return false;
+
+      for (uint16_t i = 0; i < len; i++)
+      {
+        data[i] = buffer[tail++ & (SIZE - 1)];
+      }
+      return true;
+    }
+};
+
+#endif // _RINGBUFFER_H_
@@ -0,0 +1,65 @@
+/*
+ Copyright (C) 2020 chester4444@wolke7.net
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _SCHEDULER_H_
+#define _SCHEDULER_H_
+
+#include <Arduino.h>
+
+#ifndef MAX_TASKS
+#define MAX_TASKS 10
+#endif
+
+// cooperative tick scheduler: loop() calls tick(), every task that is due
+// runs once and must return quickly; tasks never wait with delay(), they
+// keep their own state and come back on the next tick
+class Scheduler
+{
+  public:
+    typedef void (*TaskFunction)(void);
+
+    struct Task
+    {
+      const char *name;
+      TaskFunction run;
+      uint32_t intervalUs;    // time between two runs, 0 = every tick
+      uint32_t deadlineUs;    // longest acceptable time between two runs, 0 = none
+      uint32_t lastRun;       // micros() of the last start
+      // trace since the last resetTrace()
+      uint32_t runs;
+      uint32_t misses;        // runs later than the deadline
+      uint32_t maxGapUs;      // longest time between two runs
+      uint32_t maxRunUs;      // longest run
+    };
+
+  private:
+    Task tasks[MAX_TASKS];
+    uint8_t count = 0;
+
+  public:
+    // add a task, false if there are already MAX_TASKS
+    bool add(const char *name, TaskFunction run, uint32_t intervalMs, uint32_t deadlineMs = 0);
+
+    // run the tasks that are due, in the order they were added
+    void tick(void);
+
+    // gaps, run times and deadline misses of the i-th task as a line of
+    // text, then start it over; returns the length like snprintf
+    int formatTrace(uint8_t i, char *text, size_t size);
+
+    uint8_t size(void) const { return count; }
+    const Task &operator[](uint8_t i) const { return tasks[i]; }
+};
+
+#endif // _SCHEDULER_H_
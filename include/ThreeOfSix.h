@@ -0,0 +1,42 @@
+/*
+ Copyright (C) 2020 chester4444@wolke7.net
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _THREEOFSIX_H_
+#define _THREEOFSIX_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+// 3 out of 6 line code of wmbus mode T (EN 13757-4), every nibble is sent
+// as a 6 bit symbol, 2 data bytes take 3 bytes on air; table driven and
+// streaming, so the fifo can be decoded chunk by chunk while a frame arrives
+class ThreeOfSix
+{
+  private:
+    uint16_t bits = 0;      // symbol bits not decoded yet, right aligned
+    uint8_t bitCount = 0;
+
+  public:
+    // start a new frame
+    void reset(void) { bits = 0; bitCount = 0; }
+
+    // decode len coded bytes to out, which may be the same buffer as in,
+    // returns the number of data bytes or -1 for an invalid symbol
+    int16_t decode(const uint8_t *in, size_t len, uint8_t *out);
+
+    // bytes on air for len data bytes, an odd length is padded to a full byte
+    static uint16_t encodedLength(uint16_t len) { return (len * 3 + 1) / 2; }
+};
+
+#endif // _THREEOFSIX_H_
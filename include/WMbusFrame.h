@@ -1,41 +1,151 @@
 #ifndef __WMBUS_FRAME__
 #define __WMBUS_FRAME__
 
-#include <Arduino.h>
-#include <Crypto.h>
-#include <AES.h>
-#include <CTR.h>
-#include "credentials.h"
+#include <stdint.h>
+#include <stddef.h>
+#include "Meter.h"
+#include "AesBackend.h"
+#include "Crc16.h"
+#include "DataRecords.h"
+#include "FormatCache.h"
+
+// logs of every frame, a few hundred bytes that take 30-40 ms at 115200
+// baud and hold up the radio; -D WMBUS_DEBUG=1 turns them on
+#ifndef WMBUS_DEBUG
+  #define WMBUS_DEBUG 0
+#endif
+
+// the decoder is plain C++, on the host (tools/replay.cpp) it doesn't log
+#if defined(ARDUINO) && WMBUS_DEBUG
+  #include <Arduino.h>
+  #define WMBUS_LOG(...) Serial.printf(__VA_ARGS__)
+#else
+  #define WMBUS_LOG(...) do {} while (0)
+#endif
+
+// outcome of WMBusFrame::decode()
+enum FrameStatus
+{
+  FrameOk = 0,          // records passed to the handler
+  FrameTooShort,        // no room for a cipher
+  FrameNotData,         // CI field isn't a Kamstrup long or compact frame
+  FrameCrcError,        // decrypted data doesn't match its crc, wrong key?
+  FrameRecordError,     // malformed data records
+  FrameHeld,            // compact frame, waits for a long frame with its layout
+};
+
+// gets the records of every decoded frame, a held compact frame comes
+// before the next frame of its meter that decodes, with status FrameHeld
+typedef void (*RecordHandler)(Meter *meter, const DataRecords &records, void *context);
+
+// compact frames kept while their layout is unknown, shared by all meters;
+// only needed until the first long frame of a meter type has been seen
+#define HELD_FRAME_LENGTH 48
+#ifndef HELD_FRAMES
+  #define HELD_FRAMES     2
+#endif
+
+// a decrypted compact frame waiting for a long frame of its meter
+struct HeldFrame
+{
+  const Meter *meter;       // NULL = free
+  uint8_t length;
+  uint8_t data[HELD_FRAME_LENGTH];
+};
+
+// the expanded key of a meter
+struct CipherSlot
+{
+  const Meter *meter;       // NULL = free
+  uint32_t lastUsed;
+  Aes128 cipher;
+};
 
 class WMBusFrame
 {
   public:
-    static const uint8_t MAX_LENGTH = 64;
+    static const uint8_t MAX_LENGTH = 255;
+
+    struct CipherStatistics
+    {
+      uint32_t hits;        // frames decrypted with a key expanded before
+      uint32_t expansions;  // keys expanded, into a slot or for a single frame
+    };
+
   private:
-    CTR<AESSmall128> aes128;
-    uint8_t cipher[MAX_LENGTH];
-    uint8_t plaintext[MAX_LENGTH];
-    uint8_t iv[16];
     void check(void);
     void printMeterInfo(uint8_t *data, size_t len);
-    uint16_t crc16_EN13757_per_byte(uint16_t crc, uint8_t b);
-    uint16_t crc16_EN13757(uint8_t *data, size_t len);
+    bool unpackCompact(const uint8_t *data, size_t len, DataRecords &records);
+
+    // keep a compact frame of the meter, replaces its older one
+    void hold(const uint8_t *data, size_t len);
+
+    // report the meter's held frame before a newer frame of it, so the
+    // older reading never comes last
+    void releaseHeld(void);
+
+    // the cipher of the meter, expanded into a slot or into scratch
+    Aes128 &cipherOf(const Meter *sender, Aes128 &scratch);
+
+    // layouts of the long frames, for the compact frames
+    FormatCache formats;
+
+    HeldFrame held[HELD_FRAMES];
+    uint8_t nextHeld = 0;     // replaced when all are in use
+
+    CipherSlot *ciphers = NULL;
+    uint8_t cipherCount = 0;
+    uint32_t cipherClock = 0;
+    CipherStatistics cipherStatistics = {};
+
+    RecordHandler handler = NULL;
+    void *handlerContext = NULL;
 
   public:
-    // check frame and decrypt it
-    void decode(void);
+    WMBusFrame(void);
+
+    // meter id of a frame (little endian at payload index 3)
+    static uint32_t meterIdOf(const uint8_t *payload);
+
+    // check frame of a known meter and decrypt it in place
+    void decode(Meter *sender, uint8_t *data, uint8_t len);
+
+    // expanded keys are kept in these slots, with a slot per meter each key is
+    // expanded once; with fewer the least recently used goes, without slots
+    // the key is expanded for every frame
+    void useCiphers(CipherSlot *slots, uint8_t count);
+
+    // where the records go, e.g. the profile's publish function
+    void onRecords(RecordHandler recordHandler, void *context = NULL)
+    {
+      handler = recordHandler;
+      handlerContext = context;
+    }
 
     // true, if meter information is valid for the last received frame
     bool isValid = false;
 
+    // result of the last frame
+    FrameStatus status = FrameTooShort;
+
+    // sending meter of the last decoded frame
+    Meter *meter = NULL;
+
     // payload length
     uint8_t length = 0;
 
-    // payload data
-    uint8_t payload[MAX_LENGTH];
+    // payload data, the link layer crcs have been checked and removed
+    // points into the caller's buffer, the cipher part is decrypted in place
+    uint8_t *payload = NULL;
+
+    // hits and misses of the compact frame layouts
+    const FormatCache::Statistics & getFormatStatistics(void) const { return formats.getStatistics(); }
+
+    // frames decrypted with a kept key, and key expansions
+    const CipherStatistics & getCipherStatistics(void) const { return cipherStatistics; }
 
-    // constructor
-    WMBusFrame();
+    // the layouts learned so far, e.g. to share them between decoders
+    FormatCache & getFormats(void) { return formats; }
 };
 
 #endif // __WMBUS_FRAME__
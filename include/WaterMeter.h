@@ -18,6 +18,13 @@
 #include <Arduino.h>
 #include <SPI.h>
 #include "WMbusFrame.h"
+#include "RingBuffer.h"
+#include "FrameQueue.h"
+#include "MeterRegistry.h"
+#include "Crc16.h"
+#include "ThreeOfSix.h"
+#include "Manchester.h"
+#include "RadioProfiles.h"
 
 #define MARCSTATE_SLEEP            0x00
 #define MARCSTATE_IDLE             0x01
@@ -43,6 +50,42 @@
 #define MARCSTATE_RXTX_SWITCH      0x15
 #define MARCSTATE_TXFIFO_UNDERFLOW 0x16
 
+#define RXBYTES_OVERFLOW         0x80        // RXBYTES: RX fifo has overflowed
+#define RXBYTES_NUM_BYTES        0x7F        // RXBYTES: number of bytes in RX fifo
+
+#define FIFO_DRAIN_TIMEOUT_US    2000        // give up if no fifo data arrives for ~25 byte times
+#define MISO_TIMEOUT_US          100         // CHIP_RDYn, a few us after the crystal is running
+#define IDLE_TIMEOUT_US          1000        // RX to IDLE takes a few us
+#define RX_TIMEOUT_US            2000        // IDLE to RX with calibration takes ~800 us
+#define RADIO_CHECK_INTERVAL_MS  100         // state check of the receiver between frames
+
+#define CC1101_FIFO_SIZE         64
+
+#define WMBUS_HEADER_LENGTH      3           // C mode: 2 bytes frame type and the lfield, T mode: lfield and cfield, 3 of 6 coded
+#define WMBUS_CRC_LENGTH         2
+#define WMBUS_A_FIRST_BLOCK      9           // frame format A: data bytes of block 1 after the lfield
+#define WMBUS_A_BLOCK            16          // frame format A: data bytes of the following blocks
+#define WMBUS_B_FIRST_BLOCK      125         // frame format B: data bytes of block 1 and 2 after the lfield
+#define PKTLEN_SWITCH_MARGIN     2           // bytes that may arrive while switching to fixed length
+
+#define FRAME_QUEUE_SIZE         8           // captured frames waiting for the decoder, power of two
+
+#if defined(RADIO_TASK) && !defined(ESP32)
+  #error "RADIO_TASK needs a dual core ESP32"
+#endif
+#define RADIO_TASK_CORE          0           // Arduino loop() runs on core 1
+#define RADIO_TASK_PRIORITY      20          // above lwip (18), below esp_timer (22) and wifi (23)
+#define RADIO_TASK_STACK         4096
+#define RSSI_OFFSET              74          // dBm, CC1101 datasheet for 868 MHz
+
+// automatic frequency compensation: the average FREQEST of our meters'
+// frames is added to FSCTRL0, which tracks the crystal offset of the module
+#ifndef RADIO_AFC
+  #define RADIO_AFC              1
+#endif
+#define AFC_FRAMES               8           // frames averaged for one correction
+#define AFC_LIMIT                64          // max. correction, 1.59 kHz steps
+
 #define WRITE_BURST              0x40
 #define READ_SINGLE              0x80
 #define READ_BURST               0xC0
@@ -137,9 +180,9 @@
 
 #define CC1101_DEFVAL_SYNC1      0x54        // Synchronization word, high byte
 #define CC1101_DEFVAL_SYNC0      0x3D        // Synchronization word, low byte
-#define CC1101_DEFVAL_MCSM1      0x00        // Main Radio Control State Machine Configuration
+#define CC1101_DEFVAL_MCSM1      0x0C        // Main Radio Control State Machine Configuration: stay in RX after a packet
 
-#define CC1101_DEFVAL_IOCFG2     0x2E        // GDO2 Output Pin Configuration
+#define CC1101_DEFVAL_IOCFG2     0x00        // GDO2 Output Pin Configuration: asserts at RX fifo threshold
 #define CC1101_DEFVAL_IOCFG0     0x06        // GDO0 Output Pin Configuration
 
 #define CC1101_DEFVAL_FSCTRL1    0x08        // Frequency Synthesizer Control
@@ -172,9 +215,21 @@
 #define CC1101_DEFVAL_TEST0      0x09        // Various Test Settings
 #define CC1101_DEFVAL_PKTCTRL1   0x00        // Packet Automation Control
 #define CC1101_DEFVAL_PKTCTRL0   0x02        // 2 - infinite length 
+#define CC1101_PKTCTRL0_FIXED    0x00        // 0 - fixed length, packet ends after PKTLEN bytes
 #define CC1101_DEFVAL_ADDR       0x00        // Device Address
 #define CC1101_DEFVAL_PKTLEN     0x30        // Packet Length
-#define CC1101_DEFVAL_FIFOTHR    0x00        // RX 4 bytes and TX 61 bytes Thresholds
+#define CC1101_DEFVAL_FIFOTHR    0x01        // RX 8 bytes and TX 57 bytes Thresholds
+
+// not used, reset values, they are part of the burst
+#define CC1101_DEFVAL_IOCFG1     0x2E        // GDO1 Output Pin Configuration: high impedance
+#define CC1101_DEFVAL_MCSM2      0x07        // Main Radio Control State Machine Configuration
+#define CC1101_DEFVAL_WOREVT1    0x87        // High Byte Event0 Timeout
+#define CC1101_DEFVAL_WOREVT0    0x6B        // Low Byte Event0 Timeout
+#define CC1101_DEFVAL_WORCTRL    0xF8        // Wake On Radio Control
+#define CC1101_DEFVAL_RCCTRL1    0x41        // RC Oscillator Configuration
+#define CC1101_DEFVAL_RCCTRL0    0x00        // RC Oscillator Configuration
+#define CC1101_DEFVAL_PTEST      0x7F        // Production Test
+#define CC1101_DEFVAL_AGCTEST    0x3F        // AGC Test
 
 class WaterMeter
 {
@@ -186,8 +241,37 @@ class WaterMeter
     // flush fifo and (re)start receiver
     void startReceiver(void);
 
+    // forget about the frame being received
+    void clearFrame(void);
+
+    // back to infinite length after a fixed length frame, receiver stays in RX
+    void rearmReceiver(void);
+
+    // track the time the receiver was deaf after a frame
+    void updateDeadTime(uint32_t cycles);
+
+    // poll MARCSTATE until it is state, false after timeoutUs
+    bool waitState(uint8_t state, uint32_t timeoutUs);
+
+    // the radio doesn't react, reset and configure it again
+    void reinitialize(void);
+
+    // between frames: make sure the receiver is in RX, recover if not
+    void checkReceiver(void);
+
+    // average the frequency offset of a frame, correct FSCTRL0 every AFC_FRAMES
+    void updateAfc(int8_t freqOffset);
+
+    // read the signal strength of the current frame in dBm
+    int8_t readRssi(void);
+
+#if defined(RADIO_TASK)
+    // radio capture task, woken from the GDO interrupts
+    static void radioTask(void *param);
+#endif
+
     // burst write registers of cc1101
-    void writeBurstReg(uint8_t regaddr, uint8_t* buffer, uint8_t len);
+    void writeBurstReg(uint8_t regaddr, const uint8_t* buffer, uint8_t len);
 
     // burst read registers of cc1101
     void readBurstReg(uint8_t * buffer, uint8_t regaddr, uint8_t len);
@@ -198,20 +282,156 @@ class WaterMeter
     // read a register of cc1101
     uint8_t readReg(uint8_t regaddr, uint8_t regtype);
 
-    // read a byte from fifo
-    uint8_t readByteFromFifo(void);
+    // read RXBYTES status register (fill level and overflow flag)
+    uint8_t readRxBytes(void);
+
+    // read up to len available fifo bytes with a burst read
+    bool drainFifo(uint8_t *buffer, uint8_t len, uint8_t &count);
 
     // write a register of cc1101
     void writeReg(uint8_t regaddr, uint8_t value);
 
-    // initialize cc1101 registers
-    void initializeRegisters(void);
+    // write all cc1101 registers of a profile with one burst, false if
+    // the burst readback differs
+    bool initializeRegisters(const RadioProfile &profile);
+
+    // switch to the requested profile, between frames
+    void applyProfile(void);
 
     // reset cc1101
     void reset(void);
 
-    // receive a wmbus frame 
-    void receive(WMBusFrame *payload);
+    // reset, configure and start the cc1101, attach the interrupts
+    void setupRadio(void);
+
+    // stream the fifo into rxBuffer, true if a wmbus frame is complete
+    bool receive(void);
+
+    // check the frame header and prepare the reception of its blocks
+    bool startFrame(void);
+
+    // let the radio end the packet (PKTLEN), once it can count the rest
+    void switchToFixedLength(uint8_t fifoBytes);
+
+    // frame bytes after the lfield including the crcs, 0 if too short
+    uint16_t frameLength(void);
+
+    // prepare the next block of the frame
+    bool startBlock(void);
+
+    // store frame bytes in rxBuffer, checking the block crcs on the fly
+    bool storeFrameBytes(const uint8_t *data, uint8_t len);
+
+  public:
+    // receiver statistics
+    struct Statistics
+    {
+      uint32_t fifoOverflows;   // RX fifo overflows, during a frame or found by the state check
+      uint32_t fifoUnderruns;   // frames where data stopped before the L-field length was reached
+      uint32_t crcErrors;       // frames dropped because of a link layer crc error
+      uint32_t earlyRejects;    // crc errors found before the last block, the rest was never read
+      uint32_t skippedBytes;    // data bytes of early rejected frames never read, checked or decrypted
+      uint32_t rearms;          // frames ended by the radio (PKTLEN), receiver stayed in RX
+      uint32_t restarts;        // frames that needed an IDLE, flush and RX restart
+      uint32_t deadTimeCycles;  // cpu cycles the receiver was deaf after the last frame
+      uint32_t maxDeadTimeCycles; // worst case of deadTimeCycles
+      uint32_t queueDrops;      // captured frames dropped, because the decoder fell behind
+      uint8_t queueMaxDepth;    // highest number of frames waiting for the decoder
+      uint32_t foreignFrames;   // frames of meters not in credentials.h, dropped before decoding
+      uint32_t isrLatencyCycles;    // RADIO_TASK: cpu cycles from interrupt to the capture task running
+      uint32_t maxIsrLatencyCycles; // RADIO_TASK: worst case of isrLatencyCycles
+      uint32_t framesC1A;       // mode C1 frames, format A
+      uint32_t framesC1B;       // mode C1 frames, format B
+      uint32_t framesT1;        // mode T1 frames, 3 of 6 coded, always format A
+      uint32_t codingErrors;    // T1 and S1 frames dropped because of an invalid symbol
+      uint32_t framesS1;        // mode S1 frames, manchester coded, always format A
+      uint32_t profileSwitches; // radio profiles applied
+      uint32_t configErrors;    // register bursts that didn't read back as written
+      int8_t afcOffset;         // FSCTRL0, frequency correction in 1.59 kHz steps
+      uint32_t afcUpdates;      // FSCTRL0 corrections
+      uint32_t stateTimeouts;   // IDLE or RX not reached in time
+      uint32_t misoTimeouts;    // the chip wasn't ready for a SPI access
+      uint32_t recoveries;      // receiver found out of RX or not entering it, restarted
+      uint32_t reinits;         // radio reset and configured again, the last resort
+      uint64_t deafTimeUs;      // total time the receiver was restarted or recovered
+    };
+
+  private:
+    Statistics statistics = {};
+
+    // frame being received, without the header and the crcs
+    RingBuffer<256> rxBuffer;
+
+    // header of the frame being received
+    uint8_t rxHeader[WMBUS_HEADER_LENGTH];
+    uint8_t rxHeaderCount = 0;
+
+    // lfield of the frame being received, 0 while waiting for the header
+    uint8_t rxLength = 0;
+
+    // data bytes of the frame still to come
+    uint16_t rxRemaining = 0;
+
+    // bytes still to be read from the fifo, more than rxRemaining for T1
+    uint16_t rxRawRemaining = 0;
+
+    // bytes on air including the header, up to 435 for a T1 frame
+    uint16_t rxPacketLength = 0;
+
+    // frame format A (C1 frame type 0x54CD or T1), else B
+    bool rxFormatA = false;
+
+    // T1 frame, the fifo bytes are 3 of 6 coded
+    bool rxEncoded = false;
+    ThreeOfSix rxDecoder;
+
+    // S1 frame, the fifo bytes are manchester coded
+    bool rxManchester = false;
+    Manchester rxManchesterDecoder;
+
+    // configuration of the radio, a switch is done by the radio context
+    const RadioProfile *profile = &RADIO_PROFILES[RADIO_PROFILE];
+    const RadioProfile * volatile requestedProfile = NULL;
+
+    // data bytes still to come in the current block, then its crc
+    uint16_t rxBlockRemaining = 0;
+    uint16_t rxCrc = 0;
+    uint16_t rxCrcReceived = 0;
+    uint8_t rxCrcCount = 0;
+
+    // a frame is being received
+    bool rxActive = false;
+
+    // the radio was switched to fixed length for this frame
+    bool rxFixedLength = false;
+
+    // time of the last data from the fifo
+    unsigned long rxLastData = 0;
+
+    // millis() of the last state check
+    unsigned long lastCheck = 0;
+
+    // signal quality of the frame being received
+    int8_t rxRssi = 0;
+    uint8_t rxLqi = 0;
+    int8_t rxFreqOffset = 0;
+
+    // FREQEST of the last frames and a FSCTRL0 value waiting for the next restart
+    int16_t afcSum = 0;
+    uint8_t afcFrames = 0;
+    bool afcPending = false;
+
+    // complete frames from the radio, waiting for the decoder
+    FrameQueue<FRAME_QUEUE_SIZE> frames;
+
+    // meters we have keys for
+    MeterRegistry meters;
+
+    // decoder for all frames, works on the queued frame buffers
+    WMBusFrame decoder;
+
+    // expanded keys, one per meter up to CIPHER_CACHE_MAX
+    CipherSlot ciphers[CIPHER_CACHE_SIZE];
     
   public:
 
@@ -221,8 +441,33 @@ class WaterMeter
     // startup CC1101 for receiving wmbus mode c 
     void begin();
 
-    // must be called frequently, returns true if a valid frame was received
+    // must be called frequently, captures frames from the radio into the
+    // queue, never waits for the decoder or the network
+    // with RADIO_TASK this is done by the radio task, don't call it
+    void service(void);
+
+    // decodes a queued frame, returns true if it was a valid frame
     bool isFrameAvailable(void);
+
+    // switch the radio profile, takes effect between two frames,
+    // may be called from any task
+    void selectProfile(const RadioProfile *profile);
+
+    // radio profile in use
+    const RadioProfile & getProfile(void) const { return *profile; }
+
+    // number of captured frames waiting for the decoder
+    uint8_t getQueueDepth(void) const { return frames.depth(); }
+
+    // all known meters and their last values
+    MeterRegistry & getMeters(void) { return meters; }
+
+    // receiver statistics since startup
+    const Statistics & getStatistics(void) const { return statistics; }
+
+    // compact frame decoding, misses are frames held for a long frame
+    const FormatCache::Statistics & getFormatStatistics(void) const { return decoder.getFormatStatistics(); }
+    const WMBusFrame::CipherStatistics & getCipherStatistics(void) const { return decoder.getCipherStatistics(); }
 };
 
 #endif // _WATERMETER_H_
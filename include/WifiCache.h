@@ -0,0 +1,55 @@
+/*
+ Copyright (C) 2020 chester4444@wolke7.net
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _WIFICACHE_H_
+#define _WIFICACHE_H_
+
+#include <Arduino.h>
+#if defined(ESP8266)
+  #include <ESP8266WiFi.h>
+#elif defined(ESP32)
+  #include <WiFi.h>
+#endif
+
+// RTC user memory behind the reading store, in bytes
+#define WIFI_CACHE_RTC_OFFSET 464
+
+// the last good connection: access point, channel and DHCP lease, kept in
+// RTC memory, so a restart connects without a scan, and without DHCP while
+// the lease lasts
+class WifiCache
+{
+  public:
+    // restore the cache, false after a power cycle or if it was forgotten
+    bool begin(void);
+
+    bool valid(void) const;
+
+    // index into credentials of the cached network
+    uint8_t credential(void) const;
+
+    // connect straight to the cached access point, with the cached address
+    // until half its lease is over, with DHCP after
+    void connect(const char *ssid, const char *pass);
+
+    // remember the connection that is up now
+    void save(uint8_t credential);
+
+    // drop the cache and go back to DHCP, the next connect needs a scan
+    void forget(void);
+};
+
+extern WifiCache wifiCache;
+
+#endif // _WIFICACHE_H_
@@ -10,8 +10,9 @@
 // MISO  => D6
 // SCK   => D5
 // GD0   => D2  A valid interrupt pin for your platform (defined below this)
-// GD2   => not connected 
+// GD2   => D1  A valid interrupt pin for your platform (defined below this)
   #define CC1101_GDO0         D2   // GDO0 input interrupt pin
+  #define CC1101_GDO2         D1   // GDO2 input interrupt pin (RX fifo threshold)
   #define PIN_LED_BUILTIN     D4
 #elif defined(ESP32)
 // Attach CC1101 pins to ESP32 SPI pins
@@ -22,11 +23,12 @@
 // MISO  => 19
 // SCK   => 18
 // GD0   => 32  any valid interrupt pin for your platform will do
-// GD2   => not connected 
+// GD2   => 33  any valid interrupt pin for your platform will do
 
 // attach CC1101 pins to ESP32 SPI pins
 
   #define CC1101_GDO0          32
+  #define CC1101_GDO2          33
   #define PIN_LED_BUILTIN      2
 #endif
 
@@ -0,0 +1,171 @@
+/*
+ Copyright (C) 2020 chester4444@wolke7.net
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "AesBackend.h"
+
+#if defined(AES_BACKEND_TABLE)
+
+// FIPS-197 substitution box
+static constexpr uint8_t SBOX[256] =
+{
+  0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+  0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+  0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+  0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+  0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+  0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+  0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+  0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+  0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+  0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+  0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+  0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+  0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+  0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+  0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+  0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16
+};
+
+// multiply by x in GF(2^8)
+static constexpr uint8_t xtime(uint8_t b)
+{
+  return (uint8_t)((b << 1) ^ ((b & 0x80) ? 0x1b : 0x00));
+}
+
+// SubBytes and MixColumns of one byte: column (2s, s, s, 3s)
+static constexpr uint32_t teEntry(uint8_t s)
+{
+  return ((uint32_t)xtime(s) << 24)
+       | ((uint32_t)s << 16)
+       | ((uint32_t)s << 8)
+       | (uint32_t)(xtime(s) ^ s);
+}
+
+// T-table generated at compile time, the other three are rotations
+#define TE1(i)   teEntry(SBOX[i])
+#define TE4(i)   TE1(i), TE1(i + 1), TE1(i + 2), TE1(i + 3)
+#define TE16(i)  TE4(i), TE4(i + 4), TE4(i + 8), TE4(i + 12)
+#define TE64(i)  TE16(i), TE16(i + 16), TE16(i + 32), TE16(i + 48)
+static constexpr uint32_t TE0[256] = { TE64(0), TE64(64), TE64(128), TE64(192) };
+
+static const uint8_t RCON[10] = { 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36 };
+
+static inline uint32_t ror(uint32_t x, uint8_t n)
+{
+  return (x >> n) | (x << (32 - n));
+}
+
+static inline uint32_t loadBigEndian(const uint8_t *p)
+{
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static inline void storeBigEndian(uint8_t *p, uint32_t x)
+{
+  p[0] = x >> 24;
+  p[1] = x >> 16;
+  p[2] = x >> 8;
+  p[3] = x;
+}
+
+static inline uint32_t subWord(uint32_t w)
+{
+  return ((uint32_t)SBOX[w >> 24] << 24)
+       | ((uint32_t)SBOX[(w >> 16) & 0xff] << 16)
+       | ((uint32_t)SBOX[(w >> 8) & 0xff] << 8)
+       | SBOX[w & 0xff];
+}
+
+void Aes128::setKey(const uint8_t *key)
+{
+  for (uint8_t i = 0; i < 4; i++)
+  {
+    roundKeys[i] = loadBigEndian(&key[4 * i]);
+  }
+
+  for (uint8_t i = 4; i < 44; i++)
+  {
+    uint32_t temp = roundKeys[i - 1];
+
+    if ((i & 3) == 0)
+    {
+      temp = subWord((temp << 8) | (temp >> 24)) ^ ((uint32_t)RCON[i / 4 - 1] << 24);
+    }
+    roundKeys[i] = roundKeys[i - 4] ^ temp;
+  }
+}
+
+// one full round: SubBytes, ShiftRows and MixColumns by table lookup
+#define AES_ROUND(a, b, c, d, k) \
+  (TE0[(a) >> 24] ^ ror(TE0[((b) >> 16) & 0xff], 8) ^ ror(TE0[((c) >> 8) & 0xff], 16) \
+   ^ ror(TE0[(d) & 0xff], 24) ^ (k))
+
+// last round without MixColumns
+#define AES_FINAL(a, b, c, d, k) \
+  ((((uint32_t)SBOX[(a) >> 24] << 24) | ((uint32_t)SBOX[((b) >> 16) & 0xff] << 16) \
+   | ((uint32_t)SBOX[((c) >> 8) & 0xff] << 8) | SBOX[(d) & 0xff]) ^ (k))
+
+void Aes128::encryptBlock(uint8_t *output, const uint8_t *input) const
+{
+  const uint32_t *rk = roundKeys;
+
+  uint32_t s0 = loadBigEndian(&input[0]) ^ rk[0];
+  uint32_t s1 = loadBigEndian(&input[4]) ^ rk[1];
+  uint32_t s2 = loadBigEndian(&input[8]) ^ rk[2];
+  uint32_t s3 = loadBigEndian(&input[12]) ^ rk[3];
+
+  for (uint8_t round = 1; round < 10; round++)
+  {
+    rk += 4;
+    uint32_t t0 = AES_ROUND(s0, s1, s2, s3, rk[0]);
+    uint32_t t1 = AES_ROUND(s1, s2, s3, s0, rk[1]);
+    uint32_t t2 = AES_ROUND(s2, s3, s0, s1, rk[2]);
+    uint32_t t3 = AES_ROUND(s3, s0, s1, s2, rk[3]);
+    s0 = t0;
+    s1 = t1;
+    s2 = t2;
+    s3 = t3;
+  }
+
+  rk += 4;
+  storeBigEndian(&output[0], AES_FINAL(s0, s1, s2, s3, rk[0]));
+  storeBigEndian(&output[4], AES_FINAL(s1, s2, s3, s0, rk[1]));
+  storeBigEndian(&output[8], AES_FINAL(s2, s3, s0, s1, rk[2]));
+  storeBigEndian(&output[12], AES_FINAL(s3, s0, s1, s2, rk[3]));
+}
+
+#elif defined(AES_BACKEND_HW)
+
+void Aes128::setKey(const uint8_t *key)
+{
+  esp_aes_init(&context);
+  esp_aes_setkey(&context, key, 128);
+}
+
+void Aes128::encryptBlock(uint8_t *output, const uint8_t *input)
+{
+  esp_aes_crypt_ecb(&context, ESP_AES_ENCRYPT, input, output);
+}
+
+void Aes128::ctrCrypt(const uint8_t *iv, const uint8_t *input, uint8_t *output, size_t len)
+{
+  uint8_t counter[AES_BLOCK_SIZE];
+  uint8_t streamBlock[AES_BLOCK_SIZE];
+  size_t offset = 0;
+
+  memcpy(counter, iv, AES_BLOCK_SIZE);
+  esp_aes_crypt_ctr(&context, len, &offset, counter, streamBlock, input, output);
+}
+
+#endif
@@ -0,0 +1,70 @@
+/*
+ Copyright (C) 2020 chester4444@wolke7.net
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Crc16.h"
+
+#define CRC16_EN_13757 0x3D65
+
+// shift bits through the polynomial, msb first
+static constexpr uint16_t crcShift(uint16_t crc, uint8_t bits)
+{
+  return (bits == 0) ? crc
+       : crcShift((crc & 0x8000) ? (uint16_t)((crc << 1) ^ CRC16_EN_13757)
+                                 : (uint16_t)(crc << 1), bits - 1);
+}
+
+// crc of byte i followed by n zero bytes
+static constexpr uint16_t crcEntry(uint8_t n, uint8_t i)
+{
+  return (n == 0) ? crcShift((uint16_t)(i << 8), 8)
+       : (uint16_t)((crcEntry(n - 1, i) << 8) ^ crcEntry(0, crcEntry(n - 1, i) >> 8));
+}
+
+// tables generated at compile time
+#define CRC1(n, i)   crcEntry(n, i)
+#define CRC4(n, i)   CRC1(n, i), CRC1(n, i + 1), CRC1(n, i + 2), CRC1(n, i + 3)
+#define CRC16(n, i)  CRC4(n, i), CRC4(n, i + 4), CRC4(n, i + 8), CRC4(n, i + 12)
+#define CRC64(n, i)  CRC16(n, i), CRC16(n, i + 16), CRC16(n, i + 32), CRC16(n, i + 48)
+#define CRC256(n)    { CRC64(n, 0), CRC64(n, 64), CRC64(n, 128), CRC64(n, 192) }
+
+#if defined(CRC16_SLICE4)
+static constexpr uint16_t CRC_TABLE[4][256] = { CRC256(0), CRC256(1), CRC256(2), CRC256(3) };
+#else
+static constexpr uint16_t CRC_TABLE[1][256] = { CRC256(0) };
+#endif
+
+uint16_t Crc16::update(uint16_t crc, const uint8_t *data, size_t len)
+{
+  for (size_t i = 0; i < len; i++)
+  {
+    crc = (crc << 8) ^ CRC_TABLE[0][(crc >> 8) ^ data[i]];
+  }
+  return crc;
+}
+
+#if defined(CRC16_SLICE4)
+uint16_t Crc16::updateSlice4(uint16_t crc, const uint8_t *data, size_t len)
+{
+  while (len >= 4)
+  {
+    crc = CRC_TABLE[3][(crc >> 8) ^ data[0]]
+        ^ CRC_TABLE[2][(crc & 0xff) ^ data[1]]
+        ^ CRC_TABLE[1][data[2]]
+        ^ CRC_TABLE[0][data[3]];
+    data += 4;
+    len -= 4;
+  }
+  return update(crc, data, len);
+}
+#endif
@@ -0,0 +1,256 @@
+/*
+ Copyright (C) 2020 chester4444@wolke7.net
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "DataRecords.h"
+#include "Crc16.h"
+#include <string.h>
+
+// max. number of DIFEs/VIFEs of one record (EN 13757-3)
+#define MAX_EXTENSIONS 10
+
+uint8_t DataRecords::dataLengthOf(uint8_t dif)
+{
+  static const uint8_t lengths[16] =
+  {
+    0, 1, 2, 3, 4, 4, 6, 8,   // no data, integers, real32, int48, int64
+    0, 1, 2, 3, 4, 0xff, 6, 0 // selection, bcd, variable, bcd12, special
+  };
+  return lengths[dif & 0x0F];
+}
+
+int32_t DataRecord::scaled(int8_t exp) const
+{
+  int64_t v = value;
+  for (int8_t e = exponent; e > exp; e--) v *= 10;
+  for (int8_t e = exponent; e < exp; e++) v /= 10;
+  return (int32_t)v;
+}
+
+void DataRecords::decodeVif(DataRecord &record, uint8_t vif, uint8_t vife)
+{
+  uint8_t code = vif & 0x7F;
+  uint8_t n = vif & 0x07;
+
+  record.type = RecordUnknown;
+  record.exponent = 0;
+
+  if (vif == 0xFF)  // manufacturer specific, the VIFE tells
+  {
+    // Kamstrup info codes
+    if ((vife & 0x7F) == 0x20) record.type = RecordInfoCodes;
+    return;
+  }
+  if (vif == 0xFD)  // first extension table
+  {
+    // error flags
+    if ((vife & 0x7F) == 0x17) record.type = RecordInfoCodes;
+    return;
+  }
+  if (vif == 0xFB) return;  // second extension table, nothing we use
+
+  if (code <= 0x07)
+  {
+    record.type = RecordEnergy;
+    record.exponent = n - 3;
+  }
+  else if (code >= 0x10 && code <= 0x17)
+  {
+    record.type = RecordVolume;
+    record.exponent = n - 6;
+  }
+  else if (code >= 0x18 && code <= 0x1F)
+  {
+    record.type = RecordMass;
+    record.exponent = n - 3;
+  }
+  else if (code >= 0x28 && code <= 0x2F)
+  {
+    record.type = RecordPower;
+    record.exponent = n - 3;
+  }
+  else if (code >= 0x38 && code <= 0x3F)
+  {
+    record.type = RecordVolumeFlow;
+    record.exponent = n - 6;
+  }
+  else if (code >= 0x58 && code <= 0x6B)
+  {
+    // four temperature and pressure ranges with 2 bit exponents
+    static const uint8_t types[] =
+    {
+      RecordFlowTemperature, RecordReturnTemperature, RecordTemperatureDiff,
+      RecordExternalTemperature, RecordPressure
+    };
+    record.type = types[(code - 0x58) >> 2];
+    record.exponent = (n & 0x03) - 3;
+  }
+  else if (code == 0x6C)
+  {
+    record.type = RecordDate;
+  }
+  else if (code == 0x6D)
+  {
+    record.type = RecordDateTime;
+  }
+}
+
+bool DataRecords::readValue(DataRecord &record, const uint8_t *data)
+{
+  uint8_t len = record.dataLength;
+  uint8_t field = record.dif & 0x0F;
+  int64_t v = 0;
+
+  if (field >= 0x09 && field != 0x0D && field != 0x0F)
+  {
+    // bcd, a leading 0xf nibble marks a negative value
+    bool negative = false;
+    for (int8_t i = len - 1; i >= 0; i--)
+    {
+      uint8_t hi = data[i] >> 4;
+      uint8_t lo = data[i] & 0x0F;
+      if (i == len - 1 && hi == 0x0F)
+      {
+        negative = true;
+        hi = 0;
+      }
+      if (hi > 9 || lo > 9) return false;
+      v = v * 100 + hi * 10 + lo;
+    }
+    record.value = negative ? -v : v;
+    return true;
+  }
+
+  if (field == 0x05)
+  {
+    // real32, the fraction is lost
+    float f;
+    memcpy(&f, data, sizeof(f));
+    record.value = (int64_t)f;
+    return true;
+  }
+
+  if (field == 0x0D || len == 0)
+  {
+    // text or no value
+    record.value = 0;
+    return true;
+  }
+
+  // signed integer, little endian
+  for (int8_t i = len - 1; i >= 0; i--)
+  {
+    v = (v << 8) | data[i];
+  }
+  if (len < 8 && (data[len - 1] & 0x80))
+  {
+    v -= (int64_t)1 << (len * 8);
+  }
+  record.value = v;
+  return true;
+}
+
+bool DataRecords::parse(const uint8_t *data, uint8_t len)
+{
+  count = 0;
+  packedLength = 0;
+  uint16_t crc = Crc16::INIT;
+  uint8_t pos = 0;
+
+  while (pos < len)
+  {
+    uint8_t start = pos;
+    uint8_t dif = data[pos++];
+
+    if (dif == 0x2F) continue;         // idle filler
+    if ((dif & 0x0F) == 0x0F) break;   // manufacturer specific data up to the end
+
+    DataRecord record;
+    memset(&record, 0, sizeof(record));
+    record.dif = dif;
+    record.function = (dif >> 4) & 0x03;
+    record.storage = (dif >> 6) & 0x01;
+
+    // DIFEs extend storage number and tariff
+    uint8_t ext = dif;
+    for (uint8_t n = 0; ext & 0x80; n++)
+    {
+      if (pos >= len || n >= MAX_EXTENSIONS) return false;
+      ext = data[pos++];
+      record.storage |= (ext & 0x0F) << (1 + 4 * n);
+      record.tariff |= ((ext >> 4) & 0x03) << (2 * n);
+    }
+
+    if (pos >= len) return false;
+    uint8_t vif = data[pos++];
+    if ((vif & 0x7F) == 0x7C) break;   // plain text unit, not used by our meters
+
+    // only the first VIFE matters for the type, the rest are skipped
+    uint8_t vife = 0;
+    ext = vif;
+    for (uint8_t n = 0; ext & 0x80; n++)
+    {
+      if (pos >= len || n >= MAX_EXTENSIONS) return false;
+      ext = data[pos++];
+      if (n == 0) vife = ext;
+    }
+    decodeVif(record, vif, vife);
+
+    record.headerOffset = start;
+    record.headerLength = pos - start;
+    crc = Crc16::update(crc, &data[start], record.headerLength);
+
+    uint8_t dataLength = dataLengthOf(dif);
+    if (dataLength == 0xff)
+    {
+      // variable length, only plain text (LVAR < 0xc0) is supported
+      if (pos >= len || data[pos] >= 0xC0) return false;
+      dataLength = 1 + data[pos];
+    }
+    if (dataLength > len - pos) return false;
+
+    record.dataOffset = pos;
+    record.dataLength = dataLength;
+    record.packedOffset = packedLength;
+    if (!readValue(record, &data[pos])) return false;
+    pos += dataLength;
+    packedLength += dataLength;
+
+    if (count < MAX_DATA_RECORDS)
+    {
+      records[count++] = record;
+    }
+  }
+
+  signature = Crc16::finish(crc);
+  return true;
+}
+
+const DataRecord *DataRecords::find(RecordType type, RecordFunction function, uint8_t storage) const
+{
+  for (uint8_t i = 0; i < count; i++)
+  {
+    const DataRecord &r = records[i];
+    if (r.type == type && r.function == function && r.storage == storage) return &r;
+  }
+  return NULL;
+}
+
+const DataRecord *DataRecords::first(RecordType type) const
+{
+  for (uint8_t i = 0; i < count; i++)
+  {
+    if (records[i].type == type) return &records[i];
+  }
+  return NULL;
+}
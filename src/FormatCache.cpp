@@ -0,0 +1,122 @@
+/*
+ Copyright (C) 2020 chester4444@wolke7.net
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "FormatCache.h"
+#include <string.h>
+
+FormatCache::FormatCache()
+{
+  memset(entries, 0, sizeof(entries));
+}
+
+FormatEntry *FormatCache::lookup(uint16_t signature)
+{
+  for (uint8_t i = 0; i < FORMAT_CACHE_SIZE; i++)
+  {
+    if (entries[i].count && entries[i].signature == signature) return &entries[i];
+  }
+  return NULL;
+}
+
+// the entry of signature, or a free or the least recently used one for it
+FormatEntry *FormatCache::place(uint16_t signature)
+{
+  FormatEntry *entry = lookup(signature);
+  if (entry != NULL) return entry;
+
+  entry = &entries[0];
+  for (uint8_t i = 1; i < FORMAT_CACHE_SIZE && entry->count; i++)
+  {
+    if (!entries[i].count || entries[i].lastUsed < entry->lastUsed) entry = &entries[i];
+  }
+  if (entry->count) statistics.evictions++;
+  entry->signature = signature;
+  entry->count = 0;
+  return entry;
+}
+
+void FormatCache::learn(const DataRecords &records)
+{
+  // only complete layouts, a compact frame would be misread otherwise
+  if (records.count == 0 || records.count >= MAX_DATA_RECORDS) return;
+
+  FormatEntry *entry = place(records.signature);
+  if (entry->count == 0)
+  {
+    entry->count = records.count;
+    entry->length = records.packedLength;
+    for (uint8_t i = 0; i < records.count; i++)
+    {
+      const DataRecord &r = records.records[i];
+      RecordLayout &l = entry->layout[i];
+      l.dif = r.dif;
+      l.type = r.type;
+      l.function = r.function;
+      l.storage = r.storage;
+      l.exponent = r.exponent;
+      l.offset = r.packedOffset;
+      l.length = r.dataLength;
+    }
+  }
+  entry->lastUsed = ++clock;
+}
+
+void FormatCache::learn(const FormatCache &other)
+{
+  for (uint8_t i = 0; i < FORMAT_CACHE_SIZE; i++)
+  {
+    const FormatEntry &known = other.entries[i];
+    if (known.count == 0) continue;
+
+    FormatEntry *entry = place(known.signature);
+    if (entry->count == 0)
+    {
+      *entry = known;
+    }
+    entry->lastUsed = ++clock;
+  }
+}
+
+bool FormatCache::unpack(uint16_t signature, const uint8_t *data, uint8_t len, DataRecords &records)
+{
+  FormatEntry *entry = lookup(signature);
+  if (entry == NULL || entry->length > len)
+  {
+    statistics.misses++;
+    return false;
+  }
+  entry->lastUsed = ++clock;
+
+  records.count = 0;
+  records.signature = signature;
+  records.packedLength = entry->length;
+  for (uint8_t i = 0; i < entry->count; i++)
+  {
+    const RecordLayout &l = entry->layout[i];
+    DataRecord &r = records.records[records.count];
+    memset(&r, 0, sizeof(r));
+    r.dif = l.dif;
+    r.type = l.type;
+    r.function = l.function;
+    r.storage = l.storage;
+    r.exponent = l.exponent;
+    r.dataOffset = l.offset;
+    r.dataLength = l.length;
+    r.packedOffset = l.offset;
+    if (!DataRecords::readValue(r, &data[l.offset])) break;
+    records.count++;
+  }
+  statistics.hits++;
+  return true;
+}
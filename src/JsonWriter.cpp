@@ -0,0 +1,117 @@
+/*
+ Copyright (C) 2020 chester4444@wolke7.net
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "JsonWriter.h"
+
+JsonWriter::JsonWriter(char *buffer, size_t size)
+  : buffer(buffer), size(size)
+{
+  if (size > 0)
+  {
+    buffer[0] = 0;
+  }
+}
+
+void JsonWriter::append(char c)
+{
+  // keep room for the terminator
+  if (length + 1 >= size)
+  {
+    overflow = true;
+    return;
+  }
+  buffer[length++] = c;
+  buffer[length] = 0;
+}
+
+void JsonWriter::append(const char *text)
+{
+  while (*text)
+  {
+    append(*text++);
+  }
+}
+
+void JsonWriter::key(const char *name)
+{
+  if (!first)
+  {
+    append(',');
+  }
+  first = false;
+
+  append('"');
+  append(name);
+  append("\": ");
+}
+
+void JsonWriter::beginObject(void)
+{
+  append('{');
+  first = true;
+}
+
+void JsonWriter::endObject(void)
+{
+  append('}');
+}
+
+void JsonWriter::addNumber(const char *name, const char *number)
+{
+  key(name);
+  append(number);
+}
+
+void JsonWriter::addString(const char *name, const char *value)
+{
+  key(name);
+  append('"');
+  append(value);
+  append('"');
+}
+
+size_t JsonWriter::formatFixed(char *out, int32_t value, uint8_t decimals)
+{
+  char digits[10];
+  uint8_t count = 0;
+  size_t pos = 0;
+  uint32_t magnitude = (value < 0) ? -(uint32_t)value : value;
+
+  if (decimals > sizeof(digits) - 1)
+  {
+    decimals = sizeof(digits) - 1;
+  }
+
+  // least significant digit first, at least one before the point
+  do
+  {
+    digits[count++] = '0' + magnitude % 10;
+    magnitude /= 10;
+  } while (magnitude > 0 || count <= decimals);
+
+  if (value < 0)
+  {
+    out[pos++] = '-';
+  }
+  while (count > 0)
+  {
+    if (count == decimals)
+    {
+      out[pos++] = '.';
+    }
+    out[pos++] = digits[--count];
+  }
+  out[pos] = 0;
+  return pos;
+}
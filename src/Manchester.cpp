@@ -0,0 +1,49 @@
+/*
+ Copyright (C) 2020 chester4444@wolke7.net
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Manchester.h"
+
+#define INVALID 0xFF
+
+// two data bits of each 4 chips
+static const uint8_t PAIRS[16] =
+{
+  INVALID, INVALID, INVALID, INVALID, INVALID, 0x03,    0x02,    INVALID,   // 0x00
+  INVALID, 0x01,    0x00,    INVALID, INVALID, INVALID, INVALID, INVALID,   // 0x08
+};
+
+int16_t Manchester::decode(const uint8_t *in, size_t len, uint8_t *out)
+{
+  int16_t count = 0;
+
+  // a data byte needs two coded bytes, so out never overtakes in
+  for (size_t i = 0; i < len; i++)
+  {
+    uint8_t hi = PAIRS[in[i] >> 4];
+    uint8_t lo = PAIRS[in[i] & 0x0F];
+    if (hi == INVALID || lo == INVALID)
+    {
+      return -1;
+    }
+
+    uint8_t bits = (hi << 2) | lo;
+    if (half)
+    {
+      out[count++] = (nibble << 4) | bits;
+    }
+    nibble = bits;
+    half = !half;
+  }
+  return count;
+}
@@ -0,0 +1,52 @@
+/*
+ Copyright (C) 2020 chester4444@wolke7.net
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Meter.h"
+#include <stdio.h>
+
+void LinkStats::update(int8_t frameRssi, uint8_t frameLqi, int8_t frameOffset, uint8_t frameAccessNo)
+{
+  if (received == 0)
+  {
+    // the first frame starts the averages
+    rssi = frameRssi * 16;
+    lqi = frameLqi * 16;
+    freqOffset = frameOffset * 16;
+  }
+  else
+  {
+    uint8_t gap = frameAccessNo - accessNo;
+
+    // the same frame again
+    if (gap == 0) return;
+
+    missed += gap - 1;
+    rssi += ((frameRssi * 16) - rssi) >> LINK_AVERAGE_SHIFT;
+    lqi += ((frameLqi * 16) - lqi) >> LINK_AVERAGE_SHIFT;
+    freqOffset += ((frameOffset * 16) - freqOffset) >> LINK_AVERAGE_SHIFT;
+  }
+  accessNo = frameAccessNo;
+  received++;
+}
+
+uint8_t LinkStats::receptionRate(void) const
+{
+  uint32_t sent = received + missed;
+  return sent ? (uint8_t)((uint64_t)received * 100 / sent) : 0;
+}
+
+void meterTopic(char *topic, size_t size, const Meter &meter, const char *leaf)
+{
+  snprintf(topic, size, MQTT_TOPIC_ROOT "%s/%s", meter.name, leaf);
+}
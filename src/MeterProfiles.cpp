@@ -0,0 +1,104 @@
+/*
+ Copyright (C) 2020 chester4444@wolke7.net
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "MeterProfiles.h"
+#include <stddef.h>
+
+// C++11 needs a definition of static constexpr members that are indexed at runtime
+constexpr ProfileField Multical21Profile::FIELD[];
+constexpr ProfileField FlowIQProfile::FIELD[];
+constexpr ProfileField MulticalHeatProfile::FIELD[];
+
+#define MANUFACTURER_KAM  0x2C2D  // "KAM" as 3 x 5 bit letters
+#define ANY_VERSION       0xFF
+
+const DataRecord *findField(const DataRecords &records, const ProfileField &field)
+{
+  for (uint8_t i = 0; i < records.count; i++)
+  {
+    const DataRecord &r = records.records[i];
+    if (r.type == field.type
+        && (field.function == ANY_FUNCTION || r.function == field.function)
+        && (field.storage == ANY_STORAGE || r.storage == field.storage))
+    {
+      return &r;
+    }
+  }
+  return NULL;
+}
+
+// host tools decode only, they don't link the publishing
+#if defined(ARDUINO)
+  #define PUBLISH(P) publishProfile<P>
+#else
+  #define PUBLISH(P) NULL
+#endif
+
+static const MeterProfile MULTICAL21 =
+  { 0, "multical21", Multical21Profile::FIELDS, Multical21Profile::FIELD, PUBLISH(Multical21Profile) };
+static const MeterProfile FLOWIQ =
+  { 1, "flowiq", FlowIQProfile::FIELDS, FlowIQProfile::FIELD, PUBLISH(FlowIQProfile) };
+static const MeterProfile MULTICAL_HEAT =
+  { 2, "multical302/403", MulticalHeatProfile::FIELDS, MulticalHeatProfile::FIELD, PUBLISH(MulticalHeatProfile) };
+
+// by id
+static const MeterProfile *const ALL_PROFILES[] = { &MULTICAL21, &FLOWIQ, &MULTICAL_HEAT };
+
+// which profile a meter gets, first match wins
+struct ProfileMatch
+{
+  uint16_t manufacturer;
+  uint8_t version;
+  uint8_t type;         // device type
+  const MeterProfile *profile;
+};
+
+static const ProfileMatch PROFILES[] =
+{
+  { MANUFACTURER_KAM, 0x1B, 0x16, &MULTICAL21 },      // cold water
+  { MANUFACTURER_KAM, 0x1B, 0x06, &MULTICAL21 },      // warm water
+  { MANUFACTURER_KAM, 0x1D, 0x16, &FLOWIQ },
+  { MANUFACTURER_KAM, 0x1D, 0x06, &FLOWIQ },
+  { MANUFACTURER_KAM, ANY_VERSION, 0x04, &MULTICAL_HEAT }, // heat, return flow
+  { MANUFACTURER_KAM, ANY_VERSION, 0x0C, &MULTICAL_HEAT }, // heat, flow
+};
+
+const MeterProfile *findProfile(const uint8_t *payload)
+{
+  uint16_t manufacturer = payload[1] | (payload[2] << 8);
+  uint8_t version = payload[7];
+  uint8_t type = payload[8];
+
+  for (size_t i = 0; i < sizeof(PROFILES) / sizeof(PROFILES[0]); i++)
+  {
+    const ProfileMatch &match = PROFILES[i];
+    if (match.manufacturer == manufacturer && match.type == type
+        && (match.version == ANY_VERSION || match.version == version))
+    {
+      return match.profile;
+    }
+  }
+
+  // what this firmware has always assumed
+  return &MULTICAL21;
+}
+
+const MeterProfile *profileById(uint8_t id)
+{
+  if (id >= sizeof(ALL_PROFILES) / sizeof(ALL_PROFILES[0]))
+  {
+    return NULL;
+  }
+  return ALL_PROFILES[id];
+}
@@ -0,0 +1,92 @@
+/*
+ Copyright (C) 2020 chester4444@wolke7.net
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "MeterRegistry.h"
+
+#if defined(SINGLE_METER_CREDENTIALS)
+static const uint8_t *credentialId(uint16_t i) { return meterId; }
+static const uint8_t *credentialKey(uint16_t i) { return key; }
+#else
+static const uint8_t *credentialId(uint16_t i) { return meterIds[i]; }
+static const uint8_t *credentialKey(uint16_t i) { return meterKeys[i]; }
+#endif
+
+// serial is printed big endian
+static uint32_t toId(const uint8_t *meterId)
+{
+  return ((uint32_t)meterId[0] << 24)
+       | ((uint32_t)meterId[1] << 16)
+       | ((uint32_t)meterId[2] << 8)
+       | meterId[3];
+}
+
+void MeterRegistry::begin(void)
+{
+  // credentials index of each table entry
+  static uint16_t order[NUM_METERS];
+
+  // insertion sort by id, done once at startup
+  count = 0;
+  for (uint16_t i = 0; i < NUM_METERS; i++)
+  {
+    uint32_t id = toId(credentialId(i));
+    uint16_t pos = count;
+
+    while (pos > 0 && meters[pos-1].id > id)
+    {
+      meters[pos].id = meters[pos-1].id;
+      order[pos] = order[pos-1];
+      pos--;
+    }
+    meters[pos].id = id;
+    order[pos] = i;
+    count++;
+  }
+
+  // keys stay in flash, the decoder expands them when needed
+  for (uint16_t i = 0; i < count; i++)
+  {
+    Meter &meter = meters[i];
+
+    snprintf(meter.name, sizeof(meter.name), "%08x", (unsigned int)meter.id);
+    meter.key = credentialKey(order[i]);
+    meter.lastAccessNo = 0;
+    meter.lastSeen = 0;
+    meter.profile = NULL;
+    memset(meter.values, 0, sizeof(meter.values));
+    meter.lastPublished = 0;
+    meter.sent = 0;
+    meter.suppressed = 0;
+    memset(&meter.link, 0, sizeof(meter.link));
+  }
+}
+
+Meter *MeterRegistry::find(uint32_t id)
+{
+  uint16_t low = 0;
+  uint16_t high = count;
+
+  while (low < high)
+  {
+    uint16_t mid = (low + high) / 2;
+
+    if (meters[mid].id == id) return &meters[mid];
+
+    if (meters[mid].id < id)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  return NULL;
+}
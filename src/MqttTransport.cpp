@@ -0,0 +1,223 @@
+/*
+ Copyright (C) 2020 chester4444@wolke7.net
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "MqttTransport.h"
+
+MqttTransport::MqttTransport()
+  : ackHead(0), ackTail(0), connectEvent(false), disconnectEvent(false)
+{
+  memset(queue, 0, sizeof(queue));
+
+  // once, the client keeps a list of each kind; these run in the
+  // network task, they only hand over to service()
+  client.onConnect([this](bool sessionPresent) {
+    connectEvent = true;
+  });
+  client.onDisconnect([this](AsyncMqttClientDisconnectReason reason) {
+    disconnectEvent = true;
+  });
+  client.onPublish([this](uint16_t packetId) {
+    uint8_t head = ackHead.load(std::memory_order_relaxed);
+    uint8_t next = (head + 1) & (MQTT_ACK_QUEUE_SIZE - 1);
+    if (next == ackTail.load(std::memory_order_acquire))
+    {
+      // can't happen with a smaller window, the message would be resent
+      return;
+    }
+    acks[head] = packetId;
+    ackHead.store(next, std::memory_order_release);
+  });
+  client.onMessage([this](char *topic, char *payload, AsyncMqttClientMessageProperties properties,
+                          size_t len, size_t index, size_t total) {
+    if (messageHandler != NULL && index == 0)
+    {
+      messageHandler(topic, payload, len);
+    }
+  });
+}
+
+void MqttTransport::begin(const char *host, uint16_t port, const char *clientId,
+                          const char *user, const char *pass, const char *willTopic, const char *willPayload)
+{
+  client.setServer(host, port);
+  client.setClientId(clientId);
+  client.setCredentials(user, pass);
+  client.setWill(willTopic, 0, true, willPayload);
+}
+
+bool MqttTransport::publish(const char *topic, const char *payload, size_t len, uint8_t qos, bool retain)
+{
+  if (count == MQTT_QUEUE_SIZE || len > MQTT_PAYLOAD_MAX || strlen(topic) >= MQTT_TOPIC_MAX)
+  {
+    statistics.drops++;
+    return false;
+  }
+
+  MqttMessage &message = queue[(tail + count) & (MQTT_QUEUE_SIZE - 1)];
+  strcpy(message.topic, topic);
+  memcpy(message.payload, payload, len);
+  message.length = len;
+  message.qos = qos;
+  message.retain = retain;
+  message.dup = false;
+  message.done = false;
+  message.packetId = 0;
+
+  count++;
+  statistics.queued++;
+  if (count > statistics.maxDepth)
+  {
+    statistics.maxDepth = count;
+  }
+  return true;
+}
+
+// mark the acked messages, free the done ones at the tail
+void MqttTransport::handleAcks(void)
+{
+  uint8_t head = ackHead.load(std::memory_order_acquire);
+  uint8_t next = ackTail.load(std::memory_order_relaxed);
+
+  while (next != head)
+  {
+    uint16_t packetId = acks[next];
+    next = (next + 1) & (MQTT_ACK_QUEUE_SIZE - 1);
+
+    for (uint8_t i = 0; i < sentCount; i++)
+    {
+      MqttMessage &message = queue[(tail + i) & (MQTT_QUEUE_SIZE - 1)];
+      if (message.qos > 0 && message.packetId == packetId)
+      {
+        message.done = true;
+        statistics.acks++;
+        break;
+      }
+    }
+  }
+  ackTail.store(next, std::memory_order_release);
+
+  while (sentCount > 0 && queue[tail].done)
+  {
+    tail = (tail + 1) & (MQTT_QUEUE_SIZE - 1);
+    count--;
+    sentCount--;
+  }
+}
+
+// unacked messages are sent again after the next connect
+void MqttTransport::connectionLost(uint32_t now)
+{
+  if (!connecting && !online)
+  {
+    // already handled, e.g. after a connect timeout
+    return;
+  }
+
+  for (uint8_t i = 0; i < sentCount; i++)
+  {
+    MqttMessage &message = queue[(tail + i) & (MQTT_QUEUE_SIZE - 1)];
+    if (!message.done)
+    {
+      message.dup = true;
+      message.packetId = 0;
+    }
+  }
+  sentCount = 0;
+
+  connecting = false;
+  online = false;
+  statistics.failures++;
+  nextAttempt = now + backoff;
+  backoff = (backoff * 2 > MQTT_BACKOFF_MAX_MS) ? MQTT_BACKOFF_MAX_MS : backoff * 2;
+}
+
+// hand queued messages to the tcp stack while the window has room, a few
+// per call, each publish of the client takes time
+void MqttTransport::sendQueued(void)
+{
+  uint8_t sends = 0;
+
+  while (sentCount < count && sentCount < MQTT_INFLIGHT_WINDOW)
+  {
+    MqttMessage &message = queue[(tail + sentCount) & (MQTT_QUEUE_SIZE - 1)];
+
+    if (!message.done)
+    {
+      if (sends == MQTT_SENDS_PER_SERVICE)
+      {
+        return;
+      }
+      sends++;
+
+      uint16_t packetId = client.publish(message.topic, message.qos, message.retain,
+                                         message.payload, message.length, message.dup);
+      if (packetId == 0)
+      {
+        // tcp buffer full, try again on the next call
+        return;
+      }
+
+      statistics.sent++;
+      if (message.dup)
+      {
+        statistics.resends++;
+      }
+      message.packetId = packetId;
+      message.done = (message.qos == 0);
+    }
+    sentCount++;
+  }
+}
+
+void MqttTransport::service(void)
+{
+  uint32_t now = millis();
+
+  if (disconnectEvent.exchange(false))
+  {
+    connectionLost(now);
+  }
+  if (connectEvent.exchange(false))
+  {
+    connecting = false;
+    online = true;
+    backoff = MQTT_BACKOFF_MIN_MS;
+    statistics.connects++;
+    if (connectHandler != NULL)
+    {
+      connectHandler();
+    }
+  }
+
+  handleAcks();
+
+  if (!client.connected())
+  {
+    if (connecting && now - attemptStart > MQTT_CONNECT_TIMEOUT_MS)
+    {
+      client.disconnect(true);
+      connectionLost(now);
+    }
+    if (!connecting && (int32_t)(now - nextAttempt) >= 0)
+    {
+      connecting = true;
+      attemptStart = now;
+      client.connect();
+    }
+    return;
+  }
+
+  sendQueued();
+  handleAcks();
+}
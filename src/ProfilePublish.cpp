@@ -0,0 +1,204 @@
+/*
+ Copyright (C) 2020 chester4444@wolke7.net
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <Arduino.h>
+#include "MeterProfiles.h"
+#include "MeterRegistry.h"
+#include "JsonWriter.h"
+#include "ReadingStore.h"
+#include "MqttTransport.h"
+#include "WMbusFrame.h"
+
+#define JSON_LENGTH  200  // all fields of a profile
+
+bool  mqttMyData(const Meter *meter, const char *value);
+bool  mqttMyDataJson(const Meter *meter, const char *json, size_t len);
+bool  mqttOnline(void);
+bool  mqttBacklog(const char *json, size_t len);
+
+// publish policy: changes, at most every PUBLISH_MIN_INTERVAL_S, and
+// the unchanged values again after PUBLISH_HEARTBEAT_MIN
+static bool publishDue(Meter *meter, const int32_t *values, uint8_t count)
+{
+  uint32_t now = millis();
+  uint32_t since = now - meter->lastPublished;
+  bool due;
+
+  if (meter->sent == 0)
+  {
+    // nothing retained yet
+    due = true;
+  }
+  else if (PUBLISH_ON_CHANGE && memcmp(values, meter->values, count * sizeof(values[0])) != 0)
+  {
+    due = since >= PUBLISH_MIN_INTERVAL_S * 1000UL;
+  }
+  else
+  {
+    due = PUBLISH_HEARTBEAT_MIN && since >= PUBLISH_HEARTBEAT_MIN * 60000UL;
+  }
+
+  if (!due)
+  {
+    meter->suppressed++;
+  }
+  return due;
+}
+
+// decode and publish path of a profile, fields and their number are known
+// at compile time, so there is no lookup of the meter kind per frame
+template <class P>
+bool publishProfile(Meter *meter, const DataRecords &records)
+{
+  int32_t values[P::FIELDS];
+
+  // all values or nothing
+  for (uint8_t i = 0; i < P::FIELDS; i++)
+  {
+    const DataRecord *record = findField(records, P::FIELD[i]);
+    if (record == NULL)
+    {
+      WMBUS_LOG("records: MISSING %s\n\r", P::FIELD[i].key);
+      return false;
+    }
+    values[i] = record->scaled(P::FIELD[i].exponent);
+  }
+  bool publish = publishDue(meter, values, P::FIELDS);
+
+  char value[FIXED_TEXT_LENGTH];
+  char first[FIXED_TEXT_LENGTH];
+  char json[JSON_LENGTH];
+  JsonWriter writer(json, sizeof(json));
+
+  writer.beginObject();
+  for (uint8_t i = 0; i < P::FIELDS; i++)
+  {
+    const ProfileField &field = P::FIELD[i];
+
+    JsonWriter::formatFixed(value, values[i], field.decimals);
+    WMBUS_LOG("%s: %s %s%s", field.key, value, field.unit, (i + 1 < P::FIELDS) ? " - " : "\n\r");
+    if (i == 0)
+    {
+      memcpy(first, value, sizeof(first));
+    }
+    writer.addNumber(field.key, value);
+  }
+  writer.endObject();
+
+  if (publish && writer.ok())
+  {
+    // the json is the reading, the plain value follows it
+    if (mqttOnline() && mqttMyDataJson(meter, writer.c_str(), writer.getLength()))
+    {
+      mqttMyData(meter, first);
+    }
+    else
+    {
+      // offline or the queue is full, sent as backlog later
+      readingStore.append(meter, values, P::FIELDS);
+    }
+    // published or stored, the values are the reference for the next change
+    meter->sent++;
+    meter->lastPublished = millis();
+    memcpy(meter->values, values, sizeof(values));
+  }
+
+  meter->lastSeen = millis();
+  return true;
+}
+
+// the profile tables point to these
+template bool publishProfile<Multical21Profile>(Meter *meter, const DataRecords &records);
+template bool publishProfile<FlowIQProfile>(Meter *meter, const DataRecords &records);
+template bool publishProfile<MulticalHeatProfile>(Meter *meter, const DataRecords &records);
+
+// {"meter": "12345678","age": 120,"CurrentValue": 1.234,...}
+static bool formatStoredReading(JsonWriter &writer, const StoredReading &reading, uint32_t now)
+{
+  const MeterProfile *profile = profileById(reading.profile);
+  char name[9];
+  char value[FIXED_TEXT_LENGTH];
+
+  if (profile == NULL)
+  {
+    return false;
+  }
+
+  snprintf(name, sizeof(name), "%08x", (unsigned int)reading.meterId);
+  writer.beginObject();
+  writer.addString("meter", name);
+  JsonWriter::formatFixed(value, now - reading.time, 0);
+  writer.addNumber("age", value);
+  for (uint8_t i = 0; i < reading.fields && i < profile->fields; i++)
+  {
+    JsonWriter::formatFixed(value, reading.values[i], profile->field[i].decimals);
+    writer.addNumber(profile->field[i].key, value);
+  }
+  writer.endObject();
+  return writer.ok();
+}
+
+bool forwardStoredReadings(void)
+{
+  uint8_t stored = readingStore.size();
+  if (stored == 0)
+  {
+    return false;
+  }
+
+  // a json array of the oldest readings
+  char batch[MQTT_PAYLOAD_MAX];
+  size_t len = 0;
+  uint8_t n = 0;
+  uint32_t now = readingStore.clock();
+
+  batch[len++] = '[';
+  for (; n < stored; n++)
+  {
+    // a single reading always fits
+    char item[MQTT_PAYLOAD_MAX - 2];
+    JsonWriter writer(item, sizeof(item));
+
+    if (!formatStoredReading(writer, readingStore.at(n), now))
+    {
+      // can never be sent, skip it
+      if (n == 0)
+      {
+        readingStore.forwarded(1);
+        return true;
+      }
+      break;
+    }
+
+    // separator and closing bracket must fit as well
+    if (len + writer.getLength() + 2 > sizeof(batch))
+    {
+      break;
+    }
+    if (n > 0)
+    {
+      batch[len++] = ',';
+    }
+    memcpy(&batch[len], writer.c_str(), writer.getLength());
+    len += writer.getLength();
+  }
+  batch[len++] = ']';
+
+  if (n == 0 || !mqttBacklog(batch, len))
+  {
+    return false;
+  }
+  readingStore.forwarded(n);
+  return true;
+}
@@ -0,0 +1,72 @@
+/*
+ Copyright (C) 2020 chester4444@wolke7.net
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "RadioProfiles.h"
+#include "WaterMeter.h"
+#include <string.h>
+
+// the registers in address order, only sync word, frequency, data rate,
+// bandwidth and deviation differ between the profiles
+#define RADIO_REGS(sync1, sync0, freq2, freq1, freq0, mdmcfg4, mdmcfg3, deviatn)          \
+  {                                                                                        \
+    CC1101_DEFVAL_IOCFG2, CC1101_DEFVAL_IOCFG1, CC1101_DEFVAL_IOCFG0, CC1101_DEFVAL_FIFOTHR, \
+    sync1, sync0, CC1101_DEFVAL_PKTLEN, CC1101_DEFVAL_PKTCTRL1,                            \
+    CC1101_DEFVAL_PKTCTRL0, CC1101_DEFVAL_ADDR, CC1101_DEFVAL_CHANNR, CC1101_DEFVAL_FSCTRL1, \
+    CC1101_DEFVAL_FSCTRL0, freq2, freq1, freq0,                                            \
+    mdmcfg4, mdmcfg3, CC1101_DEFVAL_MDMCFG2, CC1101_DEFVAL_MDMCFG1,                        \
+    CC1101_DEFVAL_MDMCFG0, deviatn, CC1101_DEFVAL_MCSM2, CC1101_DEFVAL_MCSM1,              \
+    CC1101_DEFVAL_MCSM0, CC1101_DEFVAL_FOCCFG, CC1101_DEFVAL_BSCFG, CC1101_DEFVAL_AGCCTRL2, \
+    CC1101_DEFVAL_AGCCTRL1, CC1101_DEFVAL_AGCCTRL0, CC1101_DEFVAL_WOREVT1, CC1101_DEFVAL_WOREVT0, \
+    CC1101_DEFVAL_WORCTRL, CC1101_DEFVAL_FREND1, CC1101_DEFVAL_FREND0, CC1101_DEFVAL_FSCAL3, \
+    CC1101_DEFVAL_FSCAL2, CC1101_DEFVAL_FSCAL1, CC1101_DEFVAL_FSCAL0, CC1101_DEFVAL_RCCTRL1, \
+    CC1101_DEFVAL_RCCTRL0, CC1101_DEFVAL_FSTEST, CC1101_DEFVAL_PTEST, CC1101_DEFVAL_AGCTEST, \
+    CC1101_DEFVAL_TEST2, CC1101_DEFVAL_TEST1, CC1101_DEFVAL_TEST0,                         \
+  }
+
+extern constexpr RadioProfile RADIO_PROFILES[RADIO_PROFILE_COUNT] =
+{
+  // 868.95 MHz, 103 kBaud, 325 kHz bandwidth, 38 kHz deviation
+  { "C1/T1", FramingCT, RADIO_REGS(0x54, 0x3D, 0x21, 0x6B, 0xD0, 0x5C, 0x04, 0x44) },
+  // less noise, for meters with a good crystal
+  { "C1/T1 narrow", FramingCT, RADIO_REGS(0x54, 0x3D, 0x21, 0x6B, 0xD0, 0x7C, 0x04, 0x44) },
+  // more frequency offset tolerated
+  { "C1/T1 wide", FramingCT, RADIO_REGS(0x54, 0x3D, 0x21, 0x6B, 0xD0, 0x4C, 0x04, 0x44) },
+  // 868.3 MHz, 32.768 kchip/s, 203 kHz bandwidth, 50 kHz deviation
+  { "S1", FramingS, RADIO_REGS(0x76, 0x96, 0x21, 0x65, 0x6A, 0x8A, 0x4A, 0x50) },
+};
+
+// the receiver code relies on these in every profile
+constexpr bool compatible(uint8_t i)
+{
+  return i == RADIO_PROFILE_COUNT
+      || (RADIO_PROFILES[i].regs[CC1101_PKTCTRL0] == CC1101_DEFVAL_PKTCTRL0  // infinite length
+          && RADIO_PROFILES[i].regs[CC1101_IOCFG2] == CC1101_DEFVAL_IOCFG2  // fifo threshold interrupt
+          && RADIO_PROFILES[i].regs[CC1101_IOCFG0] == CC1101_DEFVAL_IOCFG0  // end of packet interrupt
+          && RADIO_PROFILES[i].regs[CC1101_MCSM1] == CC1101_DEFVAL_MCSM1    // stay in RX
+          && compatible(i + 1));
+}
+static_assert(compatible(0), "radio profile breaks the receiver");
+static_assert(RADIO_PROFILE < RADIO_PROFILE_COUNT, "no such RADIO_PROFILE");
+
+const RadioProfile *findRadioProfile(const char *name, uint8_t len)
+{
+  for (uint8_t i = 0; i < RADIO_PROFILE_COUNT; i++)
+  {
+    if (strlen(RADIO_PROFILES[i].name) == len && memcmp(RADIO_PROFILES[i].name, name, len) == 0)
+    {
+      return &RADIO_PROFILES[i];
+    }
+  }
+  return NULL;
+}
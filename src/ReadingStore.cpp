@@ -0,0 +1,133 @@
+/*
+ Copyright (C) 2020 chester4444@wolke7.net
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ReadingStore.h"
+#include "MeterRegistry.h"
+#if defined(ESP8266)
+  #include "WifiCache.h"
+#endif
+
+#define STORE_MAGIC 0x52534731  // "RSG1"
+
+struct StoreData
+{
+  uint32_t magic;
+  uint32_t clock;       // gateway clock of the last change
+  uint8_t head;         // oldest reading
+  uint8_t count;
+  uint16_t reserved;
+  StoredReading readings[READING_STORE_SIZE];
+};
+
+// the RTC user memory is written in blocks of 4 bytes
+static_assert(offsetof(StoreData, readings) % 4 == 0 && sizeof(StoredReading) % 4 == 0,
+              "readings are written one by one");
+
+#if defined(ESP8266)
+  // RAM copy, written through to the RTC user memory
+  static StoreData store;
+  static_assert(READING_STORE_RTC_OFFSET + sizeof(StoreData) <= WIFI_CACHE_RTC_OFFSET,
+                "the wifi cache follows in RTC user memory");
+#else
+  RTC_NOINIT_ATTR static StoreData store;
+#endif
+
+ReadingStore readingStore;
+
+void ReadingStore::save(size_t offset, size_t size)
+{
+#if defined(ESP8266)
+  ESP.rtcUserMemoryWrite((READING_STORE_RTC_OFFSET + offset) / 4, (uint32_t *)((uint8_t *)&store + offset), size);
+#endif
+  statistics.savedBytes += size;
+}
+
+// magic, clock and the ring indexes
+void ReadingStore::saveHeader(void)
+{
+  store.clock = clock();
+  save(0, offsetof(StoreData, readings));
+}
+
+void ReadingStore::begin(void)
+{
+#if defined(ESP8266)
+  ESP.rtcUserMemoryRead(READING_STORE_RTC_OFFSET / 4, (uint32_t *)&store, sizeof(store));
+#endif
+
+  if (store.magic != STORE_MAGIC || store.head >= READING_STORE_SIZE || store.count > READING_STORE_SIZE)
+  {
+    // power on, the memory is random
+    memset(&store, 0, sizeof(store));
+    store.magic = STORE_MAGIC;
+  }
+  bootClock = store.clock;
+  saveHeader();
+
+  if (store.count > 0)
+  {
+    Serial.printf("Stored readings: %u\n\r", store.count);
+  }
+}
+
+void ReadingStore::append(const Meter *meter, const int32_t *values, uint8_t fields)
+{
+  if (store.count == READING_STORE_SIZE)
+  {
+    // keep the newest
+    remove(1);
+    statistics.overwritten++;
+  }
+
+  uint8_t index = (store.head + store.count) % READING_STORE_SIZE;
+  StoredReading &reading = store.readings[index];
+  reading.meterId = meter->id;
+  reading.time = clock();
+  reading.profile = meter->profile->id;
+  reading.fields = (fields > MAX_PROFILE_FIELDS) ? MAX_PROFILE_FIELDS : fields;
+  reading.reserved = 0;
+  memcpy(reading.values, values, reading.fields * sizeof(values[0]));
+
+  store.count++;
+  statistics.stored++;
+  save(offsetof(StoreData, readings) + index * sizeof(StoredReading), sizeof(StoredReading));
+  saveHeader();
+}
+
+uint8_t ReadingStore::size(void) const
+{
+  return store.count;
+}
+
+const StoredReading &ReadingStore::at(uint8_t i) const
+{
+  return store.readings[(store.head + i) % READING_STORE_SIZE];
+}
+
+void ReadingStore::remove(uint8_t n)
+{
+  if (n > store.count)
+  {
+    n = store.count;
+  }
+  store.head = (store.head + n) % READING_STORE_SIZE;
+  store.count -= n;
+}
+
+void ReadingStore::forwarded(uint8_t n)
+{
+  remove(n);
+  statistics.forwarded += n;
+  saveHeader();
+}
@@ -0,0 +1,78 @@
+/*
+ Copyright (C) 2020 chester4444@wolke7.net
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Scheduler.h"
+
+bool Scheduler::add(const char *name, TaskFunction run, uint32_t intervalMs, uint32_t deadlineMs)
+{
+  if (count == MAX_TASKS)
+  {
+    return false;
+  }
+
+  Task &task = tasks[count++];
+  memset(&task, 0, sizeof(task));
+  task.name = name;
+  task.run = run;
+  task.intervalUs = intervalMs * 1000;
+  task.deadlineUs = deadlineMs * 1000;
+  task.lastRun = micros();
+  return true;
+}
+
+void Scheduler::tick(void)
+{
+  for (uint8_t i = 0; i < count; i++)
+  {
+    Task &task = tasks[i];
+    uint32_t start = micros();
+    uint32_t gap = start - task.lastRun;
+
+    if (gap < task.intervalUs)
+    {
+      continue;
+    }
+
+    if (gap > task.maxGapUs)
+    {
+      task.maxGapUs = gap;
+    }
+    if (task.deadlineUs && gap > task.deadlineUs)
+    {
+      task.misses++;
+    }
+
+    task.lastRun = start;
+    task.run();
+    task.runs++;
+
+    uint32_t duration = micros() - start;
+    if (duration > task.maxRunUs)
+    {
+      task.maxRunUs = duration;
+    }
+  }
+}
+
+int Scheduler::formatTrace(uint8_t i, char *text, size_t size)
+{
+  Task &task = tasks[i];
+  int len = snprintf(text, size, "Trace %-6s runs %u, max gap %u us, max run %u us, misses %u\n\r",
+                     task.name, task.runs, task.maxGapUs, task.maxRunUs, task.misses);
+  task.runs = 0;
+  task.misses = 0;
+  task.maxGapUs = 0;
+  task.maxRunUs = 0;
+  return len;
+}
@@ -0,0 +1,55 @@
+/*
+ Copyright (C) 2020 chester4444@wolke7.net
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ThreeOfSix.h"
+
+#define INVALID 0xFF
+
+// nibble of each 6 bit symbol
+static const uint8_t SYMBOLS[64] =
+{
+  INVALID, INVALID, INVALID, INVALID, INVALID, INVALID, INVALID, INVALID,   // 0x00
+  INVALID, INVALID, INVALID, 0x03,    INVALID, 0x01,    0x02,    INVALID,   // 0x08
+  INVALID, INVALID, INVALID, 0x07,    INVALID, INVALID, 0x00,    INVALID,   // 0x10
+  INVALID, 0x05,    0x06,    INVALID, 0x04,    INVALID, INVALID, INVALID,   // 0x18
+  INVALID, INVALID, INVALID, 0x0B,    INVALID, 0x09,    0x0A,    INVALID,   // 0x20
+  INVALID, 0x0F,    INVALID, INVALID, 0x08,    INVALID, INVALID, INVALID,   // 0x28
+  INVALID, 0x0D,    0x0E,    INVALID, 0x0C,    INVALID, INVALID, INVALID,   // 0x30
+  INVALID, INVALID, INVALID, INVALID, INVALID, INVALID, INVALID, INVALID,   // 0x38
+};
+
+int16_t ThreeOfSix::decode(const uint8_t *in, size_t len, uint8_t *out)
+{
+  int16_t count = 0;
+
+  // a data byte needs 12 bits, so out never overtakes in
+  for (size_t i = 0; i < len; i++)
+  {
+    bits = (bits << 8) | in[i];
+    bitCount += 8;
+
+    if (bitCount >= 12)
+    {
+      bitCount -= 12;
+      uint8_t hi = SYMBOLS[(bits >> (bitCount + 6)) & 0x3F];
+      uint8_t lo = SYMBOLS[(bits >> bitCount) & 0x3F];
+      if ((hi | lo) == INVALID)
+      {
+        return -1;
+      }
+      out[count++] = (hi << 4) | lo;
+    }
+  }
+  return count;
+}
@@ -13,135 +13,225 @@
 */
 
 #include "WMbusFrame.h"
-
-void  mqttMyData(const char* debug_str);
-void  mqttMyDataJson(const char* debug_str);
+#include <string.h>
 
 WMBusFrame::WMBusFrame()
 {
-  aes128.setKey(key, sizeof(key));
+  memset(held, 0, sizeof(held));
+}
+
+void WMBusFrame::useCiphers(CipherSlot *slots, uint8_t count)
+{
+  memset(slots, 0, count * sizeof(CipherSlot));
+  ciphers = slots;
+  cipherCount = count;
+}
+
+Aes128 &WMBusFrame::cipherOf(const Meter *sender, Aes128 &scratch)
+{
+  if (cipherCount == 0)
+  {
+    cipherStatistics.expansions++;
+    scratch.setKey(sender->key);
+    return scratch;
+  }
+
+  // the meter's slot, or the least recently used one (free ones are 0)
+  CipherSlot *slot = &ciphers[0];
+  for (uint8_t i = 0; i < cipherCount; i++)
+  {
+    if (ciphers[i].meter == sender)
+    {
+      slot = &ciphers[i];
+      slot->lastUsed = ++cipherClock;
+      cipherStatistics.hits++;
+      return slot->cipher;
+    }
+    if (ciphers[i].lastUsed < slot->lastUsed) slot = &ciphers[i];
+  }
+
+  slot->meter = sender;
+  slot->lastUsed = ++cipherClock;
+  cipherStatistics.expansions++;
+  slot->cipher.setKey(sender->key);
+  return slot->cipher;
+}
+
+void WMBusFrame::hold(const uint8_t *data, size_t len)
+{
+  if (len > HELD_FRAME_LENGTH) return;
+
+  // the meter's older frame, a free slot or the oldest one
+  HeldFrame *frame = NULL;
+  for (uint8_t i = 0; i < HELD_FRAMES && frame == NULL; i++)
+  {
+    if (held[i].meter == meter) frame = &held[i];
+  }
+  for (uint8_t i = 0; i < HELD_FRAMES && frame == NULL; i++)
+  {
+    if (held[i].meter == NULL) frame = &held[i];
+  }
+  if (frame == NULL)
+  {
+    frame = &held[nextHeld];
+    nextHeld = (nextHeld + 1) % HELD_FRAMES;
+  }
+
+  frame->meter = meter;
+  frame->length = len;
+  memcpy(frame->data, data, len);
+}
+
+void WMBusFrame::releaseHeld()
+{
+  for (uint8_t i = 0; i < HELD_FRAMES; i++)
+  {
+    HeldFrame &frame = held[i];
+    if (frame.meter != meter) continue;
+
+    // dropped if its layout is still unknown
+    DataRecords heldRecords;
+    status = FrameHeld;
+    if (unpackCompact(frame.data, frame.length, heldRecords) && handler) handler(meter, heldRecords, handlerContext);
+    frame.meter = NULL;
+  }
+}
+
+uint32_t WMBusFrame::meterIdOf(const uint8_t *payload)
+{
+  return payload[3]
+       | (payload[4] << 8)
+       | (payload[5] << 16)
+       | ((uint32_t)payload[6] << 24);
 }
 
 void WMBusFrame::check()
 {
-    // check meterId
-    for (uint8_t i = 0; i< 4; i++)
+    // header up to the cipher, then at least the crc and the CI field
+    if (length < 16 + 3)
     {
-        if (meterId[i] != payload[6-i])
-        {
-          isValid = false;
-          return;
-        }
+      isValid = false;
+      status = FrameTooShort;
+      return;
     }
 
-  Serial.printf("Payload: "); 
+  WMBUS_LOG("Payload: "); 
   for(int k=0; k < length; k++) { 
-    Serial.printf("%02x", payload[k]);
+    WMBUS_LOG("%02x", payload[k]);
   }
-  Serial.printf("\n\r");
+  WMBUS_LOG("\n\r");
 
   isValid = true;
 }
 
-void WMBusFrame::printMeterInfo(uint8_t *data, size_t len)
+bool WMBusFrame::unpackCompact(const uint8_t *data, size_t len, DataRecords &records)
 {
-    // init positions for compact frame
-  int pos_tt = 9; // total consumption, 9, 10, 11, 12
-  int pos_tg = 13; // target consumption 13, 14, 15, 16
-  //int pos_ic = 7; // info codes
-  int pos_ft = 17; // flow temp
-  int pos_at = 18; // ambient temp
-  
-  char mqttstring[25];
-  char mqttjsondstring[100];
-
-  Serial.printf("Data: "); 
-  for(int k=0; k < len; k++) { 
-    Serial.printf("%02x", data[k]);
-  }
-  Serial.printf("\n\r");
+  // format signature and data crc precede the values
+  if (len < 7) return false;
+  uint16_t signature = data[3] | (data[4] << 8);
+  return formats.unpack(signature, data + 7, len - 7, records);
+}
 
-  if(data[2] == 0x79)  //compact frame
+void WMBusFrame::printMeterInfo(uint8_t *data, size_t len)
+{
+  // crc and CI field
+  if (len < 3)
   {
-    pos_tt = 9;
-    pos_tg = 13;
-    //pos_ic = 7;
-    pos_ft = 17;
-    pos_at = 18;
+    status = FrameTooShort;
+    return;
   }
-  else if (data[2] == 0x78) // long frame
+
+  WMBUS_LOG("Data: "); 
+  for(size_t k=0; k < len; k++) { 
+    WMBUS_LOG("%02x", data[k]);
+  }
+  WMBUS_LOG("\n\r");
+
+  if (data[2] != 0x79 && data[2] != 0x78)
   {
-    // overwrite it with long frame positions
-    pos_tt = 10;
-    pos_tg = 16;
-    //pos_ic = 6;
-    pos_ft = 23;
-    pos_at = 29;
-  } 
-  else
+    status = FrameNotData;
     return;
+  }
 
-  uint16_t calc_crc = crc16_EN13757(data+2, len-2);
+  uint16_t calc_crc = Crc16::compute(data+2, len-2);
   uint16_t read_crc = data[1] << 8 | data[0];
-  Serial.printf("calc_crc: 0x%04x\n\r", calc_crc);
-  Serial.printf("read_crc: 0x%04x\n\r", read_crc);
+  WMBUS_LOG("calc_crc: 0x%04x\n\r", calc_crc);
+  WMBUS_LOG("read_crc: 0x%04x\n\r", read_crc);
 
   if (calc_crc == read_crc) 
   {
-    Serial.printf("CRC: OK\n\r");
+    WMBUS_LOG("CRC: OK\n\r");
   }
   else{
-    Serial.printf("CRC: ERROR\n\r");
+    WMBUS_LOG("CRC: ERROR\n\r");
+    status = FrameCrcError;
     return;
   }
 
+  DataRecords records;
 
-  char total[10];
-  uint32_t tt = data[pos_tt]
-              + (data[pos_tt+1] << 8)
-              + (data[pos_tt+2] << 16)
-              + (data[pos_tt+3] << 24);
-  snprintf(total, sizeof(total), "%d.%03d", tt/1000, tt%1000 );
-  Serial.printf("total: %s m%c - ", total, 179);
-  snprintf(mqttstring, sizeof(mqttstring), "%d.%03d", tt/1000, tt%1000 );
-  mqttMyData(mqttstring);
-
-  char target[10];
-  uint32_t tg = data[pos_tg]
-              + (data[pos_tg+1] << 8)
-              + (data[pos_tg+2] << 16)
-              + (data[pos_tg+3] << 24);
-  snprintf(target, sizeof(target), "%d.%03d", tg/1000, tg%1000 );
-  Serial.printf("target: %s m%c - ", target, 179);
-
-  char flow_temp[3];
-  snprintf(flow_temp, sizeof(flow_temp), "%2d", data[pos_ft]);
-  Serial.printf("%s %cC - ", flow_temp, 176);
+  if(data[2] == 0x79)  //compact frame
+  {
+    // no DIF/VIF, the layout comes from an earlier long frame
+    if (!unpackCompact(data, len, records))
+    {
+      WMBUS_LOG("format: UNKNOWN\n\r");
+      status = FrameHeld;
+      // keep it until the long frame tells the layout
+      hold(data, len);
+      return;
+    }
+  }
+  else // long frame
+  {
+    // data records follow the CI field
+    if (!records.parse(data + 3, len - 3))
+    {
+      WMBUS_LOG("records: ERROR\n\r");
+      status = FrameRecordError;
+      return;
+    }
+    formats.learn(records);
+  }
 
-  char ambient_temp[3];
-  snprintf(ambient_temp, sizeof(ambient_temp), "%2d", data[pos_at]);
-  Serial.printf("%s %cC\n\r", ambient_temp, 176);
+  // a held compact frame is older, report it first
+  releaseHeld();
 
-  snprintf(mqttjsondstring, sizeof(mqttjsondstring), "{\"CurrentValue\": %d.%03d,\"MonthStartValue\": %d.%03d,\"WaterTemp\": %2d,\"RoomTemp\": %2d}",tt/1000, tt%1000, tg/1000, tg%1000, data[pos_ft],data[pos_at]);
-  mqttMyDataJson(mqttjsondstring);
+  status = FrameOk;
+  if (handler) handler(meter, records, handlerContext);
 }
 
-void WMBusFrame::decode()
+void WMBusFrame::decode(Meter *sender, uint8_t *data, uint8_t len)
 {
-  // check meterId, CRC
+  // the meterId has been checked by the caller
+  meter = sender;
+  payload = data;
+  length = len;
   check();
   if (!isValid) return;
 
-  uint8_t cipherLength = length - 2 - 16; // cipher starts at index 16, remove 2 crc bytes
-  memcpy(cipher, &payload[16], cipherLength);
+  meter->lastAccessNo = payload[11];
 
+  // the kind of meter doesn't change, look it up once
+  if (meter->profile == NULL)
+  {
+    meter->profile = findProfile(payload);
+    WMBUS_LOG("Meter %s: %s\n\r", meter->name, meter->profile->name);
+  }
+
+  uint8_t cipherLength = length - 16; // cipher starts at index 16
+  uint8_t *cipher = &payload[16];
+
+  uint8_t iv[16];
   memset(iv, 0, sizeof(iv));   // padding with 0
   memcpy(iv, &payload[1], 8);
   iv[8] = payload[10];
   memcpy(&iv[9], &payload[12], 4);
 
-  aes128.setIV(iv, sizeof(iv));
-  aes128.decrypt(plaintext, (const uint8_t *) cipher, cipherLength);
+  // no copies, the plaintext replaces the cipher
+  Aes128 scratch;
+  cipherOf(meter, scratch).ctrCrypt(iv, cipher, cipher, cipherLength);
+  uint8_t *plaintext = cipher;
 
 /*
   Serial.printf("C:     ");
@@ -161,37 +251,3 @@ void WMBusFrame::decode()
   printMeterInfo(plaintext, cipherLength);
 }
 
-
-uint16_t WMBusFrame::crc16_EN13757(uint8_t *data, size_t len)
-{
-    uint16_t crc = 0x0000;
-
-    assert(len == 0 || data != NULL);
-
-    for (size_t i=0; i<len; ++i)
-    {
-        crc = crc16_EN13757_per_byte(crc, data[i]);
-    }
-
-    return (~crc);
-}
-
-#define CRC16_EN_13757 0x3D65
-
-uint16_t WMBusFrame::crc16_EN13757_per_byte(uint16_t crc, uint8_t b)
-{
-    unsigned char i;
-
-    for (i = 0; i < 8; i++) {
-
-        if (((crc & 0x8000) >> 8) ^ (b & 0x80)){
-            crc = (crc << 1)  ^ CRC16_EN_13757;
-        }else{
-            crc = (crc << 1);
-        }
-
-        b <<= 1;
-    }
-
-    return crc;
-}
\ No newline at end of file
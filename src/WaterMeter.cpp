@@ -31,10 +31,19 @@ inline void WaterMeter::deselectCC1101(void)
   digitalWrite(SS, HIGH);
 }
 
-// wait for MISO pulling down
+// wait for MISO pulling down, a chip that never gets ready doesn't hang us
 inline void WaterMeter::waitMiso(void)
 {
-  while(digitalRead(MISO) == HIGH);
+  uint32_t start = micros();
+
+  while(digitalRead(MISO) == HIGH)
+  {
+    if (micros() - start > MISO_TIMEOUT_US)
+    {
+      statistics.misoTimeouts++;
+      return;
+    }
+  }
 }
 
 // write a single register of CC1101
@@ -73,7 +82,21 @@ uint8_t WaterMeter::readReg(uint8_t regAddr, uint8_t regType)
   return val;
 }
 
-// 
+// write consecutive registers, one chip select cycle for all of them
+void WaterMeter::writeBurstReg(uint8_t regAddr, const uint8_t * buffer, uint8_t len)
+{
+  uint8_t addr, i;
+
+  addr = regAddr | WRITE_BURST;
+  selectCC1101();                      // Select CC1101
+  waitMiso();                          // Wait until MISO goes low
+  SPI.transfer(addr);                   // Send register address
+  for(i=0 ; i<len ; i++)
+    SPI.transfer(buffer[i]);            // Send value byte by byte
+  deselectCC1101();                    // Deselect CC1101
+}
+
+// read consecutive registers, one chip select cycle for all of them
 void WaterMeter::readBurstReg(uint8_t * buffer, uint8_t regAddr, uint8_t len) 
 {
   uint8_t addr, i;
@@ -112,155 +135,827 @@ void WaterMeter::reset(void)
   deselectCC1101();                    // Deselect CC1101
 }
 
-// set IDLE state, flush FIFO and (re)start receiver
+volatile boolean packetAvailable = false;
+volatile boolean fifoThreshold = false;
+void ICACHE_RAM_ATTR GD0_ISR(void);
+void ICACHE_RAM_ATTR GD2_ISR(void);
+
+#if defined(RADIO_TASK)
+static TaskHandle_t radioTaskHandle = NULL;
+static volatile uint32_t isrCycles = 0;
+
+// wake up the radio task
+static inline void IRAM_ATTR notifyRadioTask(void)
+{
+  BaseType_t woken = pdFALSE;
+
+  isrCycles = ESP.getCycleCount();
+  xTaskNotifyFromISR(radioTaskHandle, 0, eNoAction, &woken);
+  if (woken == pdTRUE)
+  {
+    portYIELD_FROM_ISR();
+  }
+}
+#endif
+
+// handle interrupt from CC1101 via GDO0
+void GD0_ISR(void) {
+  // set the flag that a package is available
+  packetAvailable = true;
+#if defined(RADIO_TASK)
+  notifyRadioTask();
+#endif
+}
+
+// handle interrupt from CC1101 via GDO2
+void GD2_ISR(void) {
+  // set the flag that the RX fifo has reached its threshold
+  fifoThreshold = true;
+#if defined(RADIO_TASK)
+  notifyRadioTask();
+#endif
+}
+
+// poll the state machine, no delay, the transitions take microseconds
+bool WaterMeter::waitState(uint8_t state, uint32_t timeoutUs)
+{
+  uint32_t start = micros();
+
+  while ((readReg(CC1101_MARCSTATE, CC1101_STATUS_REGISTER) & 0x1F) != state)
+  {
+    if (micros() - start > timeoutUs)
+    {
+      statistics.stateTimeouts++;
+      return false;
+    }
+  }
+  return true;
+}
+
+void WaterMeter::reinitialize(void)
+{
+  statistics.reinits++;
+  reset();
+  initializeRegisters(*profile);
+  afcPending = statistics.afcOffset != 0;
+  waitState(MARCSTATE_IDLE, IDLE_TIMEOUT_US);
+}
+
+// set IDLE state, flush FIFO if needed and (re)start receiver
 void WaterMeter::startReceiver(void)
 {
+  uint32_t start = micros();
+
   cmdStrobe(CC1101_SIDLE);      // Enter IDLE state
-  while (readReg(CC1101_MARCSTATE, CC1101_STATUS_REGISTER) != MARCSTATE_IDLE);
+  if (!waitState(MARCSTATE_IDLE, IDLE_TIMEOUT_US))
   {
-    delay(1);
+    reinitialize();
   }
-  
-  cmdStrobe(CC1101_SFRX);              // flush receive queue
+
+  writeReg(CC1101_PKTCTRL0, CC1101_DEFVAL_PKTCTRL0); // infinite length
+
+  // flush receive queue, only if something is left or it overflowed
+  if (readRxBytes() != 0)
+  {
+    cmdStrobe(CC1101_SFRX);
+  }
+
+  if (afcPending)
+  {
+    // the synthesizer takes it on the way to RX
+    writeReg(CC1101_FSCTRL0, (uint8_t)statistics.afcOffset);
+    afcPending = false;
+  }
+
+  // forget about the previous frame
+  clearFrame();
+  packetAvailable = false;
+  fifoThreshold = false;
 
   cmdStrobe(CC1101_SRX);               // Enter RX state
-  while (readReg(CC1101_MARCSTATE, CC1101_STATUS_REGISTER) != MARCSTATE_RX);
+  if (!waitState(MARCSTATE_RX, RX_TIMEOUT_US))
+  {
+    // e.g. overflowed right away: flush and try once more
+    statistics.recoveries++;
+    cmdStrobe(CC1101_SIDLE);
+    if (!waitState(MARCSTATE_IDLE, IDLE_TIMEOUT_US))
+    {
+      reinitialize();
+    }
+    cmdStrobe(CC1101_SFRX);
+    cmdStrobe(CC1101_SRX);
+    if (!waitState(MARCSTATE_RX, RX_TIMEOUT_US))
+    {
+      reinitialize();
+      cmdStrobe(CC1101_SRX);
+      waitState(MARCSTATE_RX, RX_TIMEOUT_US);
+    }
+  }
+
+  statistics.deafTimeUs += micros() - start;
+}
+
+// the receiver should always be in RX (MCSM1), between frames nothing else
+// reads the chip, so an overflow or a lost RX state would go unnoticed
+void WaterMeter::checkReceiver(void)
+{
+  uint8_t state = readReg(CC1101_MARCSTATE, CC1101_STATUS_REGISTER) & 0x1F;
+
+  if (state == MARCSTATE_RXFIFO_OVERFLOW)
   {
-    delay(1);
+    // minimal recovery: flush, which ends in IDLE, and back to RX
+    uint32_t start = micros();
+
+    statistics.fifoOverflows++;
+    statistics.recoveries++;
+    cmdStrobe(CC1101_SFRX);
+    clearFrame();
+    if (waitState(MARCSTATE_IDLE, IDLE_TIMEOUT_US))
+    {
+      cmdStrobe(CC1101_SRX);
+      if (waitState(MARCSTATE_RX, RX_TIMEOUT_US))
+      {
+        statistics.deafTimeUs += micros() - start;
+        return;
+      }
+    }
+    statistics.deafTimeUs += micros() - start;
+    startReceiver();
+  }
+  else if (state == MARCSTATE_IDLE || state == MARCSTATE_SLEEP)
+  {
+    // dropped out of RX, e.g. after a brown out of the radio
+    statistics.recoveries++;
+    startReceiver();
   }
 }
 
-// initialize all the CC1101 registers
-void WaterMeter::initializeRegisters(void) 
+// reset the streaming state for the next frame
+void WaterMeter::clearFrame(void)
+{
+  rxBuffer.clear();
+  rxHeaderCount = 0;
+  rxLength = 0;
+  rxRemaining = 0;
+  rxRawRemaining = 0;
+  rxFormatA = false;
+  rxEncoded = false;
+  rxManchester = false;
+  rxActive = false;
+  rxFixedLength = false;
+}
+
+// the radio has ended a fixed length frame and stayed in RX (MCSM1),
+// switch back to infinite length before the next sync word arrives
+void WaterMeter::rearmReceiver(void)
 {
-  writeReg(CC1101_IOCFG2, CC1101_DEFVAL_IOCFG2);
-  writeReg(CC1101_IOCFG0, CC1101_DEFVAL_IOCFG0);
-  writeReg(CC1101_FIFOTHR, CC1101_DEFVAL_FIFOTHR);
-  writeReg(CC1101_PKTLEN, CC1101_DEFVAL_PKTLEN);
-  writeReg(CC1101_PKTCTRL1, CC1101_DEFVAL_PKTCTRL1);
   writeReg(CC1101_PKTCTRL0, CC1101_DEFVAL_PKTCTRL0);
-  writeReg(CC1101_SYNC1, CC1101_DEFVAL_SYNC1);
-  writeReg(CC1101_SYNC0, CC1101_DEFVAL_SYNC0);
-  writeReg(CC1101_ADDR, CC1101_DEFVAL_ADDR);
-  writeReg(CC1101_CHANNR, CC1101_DEFVAL_CHANNR);
-  writeReg(CC1101_FSCTRL1, CC1101_DEFVAL_FSCTRL1);
-  writeReg(CC1101_FSCTRL0, CC1101_DEFVAL_FSCTRL0);
-  writeReg(CC1101_FREQ2, CC1101_DEFVAL_FREQ2);
-  writeReg(CC1101_FREQ1, CC1101_DEFVAL_FREQ1);
-  writeReg(CC1101_FREQ0, CC1101_DEFVAL_FREQ0);
-  writeReg(CC1101_MDMCFG4, CC1101_DEFVAL_MDMCFG4);
-  writeReg(CC1101_MDMCFG3, CC1101_DEFVAL_MDMCFG3);
-  writeReg(CC1101_MDMCFG2, CC1101_DEFVAL_MDMCFG2);
-  writeReg(CC1101_MDMCFG1, CC1101_DEFVAL_MDMCFG1);
-  writeReg(CC1101_MDMCFG0, CC1101_DEFVAL_MDMCFG0);
-  writeReg(CC1101_DEVIATN, CC1101_DEFVAL_DEVIATN);
-  writeReg(CC1101_MCSM1, CC1101_DEFVAL_MCSM1);
-  writeReg(CC1101_MCSM0, CC1101_DEFVAL_MCSM0);
-  writeReg(CC1101_FOCCFG, CC1101_DEFVAL_FOCCFG);
-  writeReg(CC1101_BSCFG, CC1101_DEFVAL_BSCFG);
-  writeReg(CC1101_AGCCTRL2, CC1101_DEFVAL_AGCCTRL2);
-  writeReg(CC1101_AGCCTRL1, CC1101_DEFVAL_AGCCTRL1);
-  writeReg(CC1101_AGCCTRL0, CC1101_DEFVAL_AGCCTRL0);
-  writeReg(CC1101_FREND1, CC1101_DEFVAL_FREND1);
-  writeReg(CC1101_FREND0, CC1101_DEFVAL_FREND0);
-  writeReg(CC1101_FSCAL3, CC1101_DEFVAL_FSCAL3);
-  writeReg(CC1101_FSCAL2, CC1101_DEFVAL_FSCAL2);
-  writeReg(CC1101_FSCAL1, CC1101_DEFVAL_FSCAL1);
-  writeReg(CC1101_FSCAL0, CC1101_DEFVAL_FSCAL0);
-  writeReg(CC1101_FSTEST, CC1101_DEFVAL_FSTEST);
-  writeReg(CC1101_TEST2, CC1101_DEFVAL_TEST2);
-  writeReg(CC1101_TEST1, CC1101_DEFVAL_TEST1);
-  writeReg(CC1101_TEST0, CC1101_DEFVAL_TEST0);
+  clearFrame();
 }
 
-volatile boolean packetAvailable = false;
-void ICACHE_RAM_ATTR GD0_ISR(void);
+// keep the last and the worst receiver dead time
+void WaterMeter::updateDeadTime(uint32_t cycles)
+{
+  statistics.deadTimeCycles = cycles;
+  if (cycles > statistics.maxDeadTimeCycles)
+  {
+    statistics.maxDeadTimeCycles = cycles;
+  }
+}
 
-// handle interrupt from CC1101 via GDO0
-void GD0_ISR(void) {
-  // set the flag that a package is available
-  packetAvailable = true;
+void WaterMeter::updateAfc(int8_t freqOffset)
+{
+  afcSum += freqOffset;
+  if (++afcFrames < AFC_FRAMES)
+  {
+    return;
+  }
+
+  // FREQEST is relative to the frequency in use, so the corrections add up
+  int16_t step = (afcSum + (afcSum < 0 ? -AFC_FRAMES / 2 : AFC_FRAMES / 2)) / AFC_FRAMES;
+  afcSum = 0;
+  afcFrames = 0;
+  if (step == 0)
+  {
+    return;
+  }
+
+  int16_t offset = statistics.afcOffset + step;
+  if (offset > AFC_LIMIT) offset = AFC_LIMIT;
+  if (offset < -AFC_LIMIT) offset = -AFC_LIMIT;
+  if (offset != statistics.afcOffset)
+  {
+    statistics.afcOffset = offset;
+    statistics.afcUpdates++;
+    afcPending = true;
+  }
 }
 
-// should be called frequently, handles the ISR flag
-// does the frame checkin and decryption
-bool WaterMeter::isFrameAvailable(void)
+// initialize all the CC1101 registers
+bool WaterMeter::initializeRegisters(const RadioProfile &profile)
 {
-  if (packetAvailable)
+  uint8_t readback[RADIO_CONFIG_LENGTH];
+
+  writeBurstReg(CC1101_IOCFG2, profile.regs, RADIO_CONFIG_LENGTH);
+  readBurstReg(readback, CC1101_IOCFG2, RADIO_CONFIG_LENGTH);
+
+  for (uint8_t i = 0; i < RADIO_CONFIG_LENGTH; i++)
   {
-    // Serial.println("packet received");
-    // Disable wireless reception interrupt
-    detachInterrupt(digitalPinToInterrupt(CC1101_GDO0));
- 
-    // clear the flag
+    if (readback[i] != profile.regs[i])
+    {
+      Serial.printf("CC1101 register 0x%02x: 0x%02x, expected 0x%02x\n\r", i, readback[i], profile.regs[i]);
+      statistics.configErrors++;
+      return false;
+    }
+  }
+  return true;
+}
+
+// called by the radio context, the frame being received is dropped
+void WaterMeter::applyProfile(void)
+{
+  const RadioProfile *next = requestedProfile;
+  requestedProfile = NULL;
+
+  cmdStrobe(CC1101_SIDLE);      // Enter IDLE state
+  if (!waitState(MARCSTATE_IDLE, IDLE_TIMEOUT_US))
+  {
+    reinitialize();
+  }
+
+  if (!initializeRegisters(*next))
+  {
+    // a half written configuration is no use, try the old one
+    initializeRegisters(*profile);
+  }
+  else
+  {
+    profile = next;
+    statistics.profileSwitches++;
+  }
+
+  // the profiles have no frequency correction, keep ours
+  afcPending = statistics.afcOffset != 0;
+
+  // calibrated on the way to RX (MCSM0)
+  startReceiver();
+  Serial.printf("Radio profile: %s\n\r", profile->name);
+}
+
+void WaterMeter::selectProfile(const RadioProfile *next)
+{
+  requestedProfile = next;
+#if defined(RADIO_TASK)
+  // the task may be waiting for a frame
+  if (radioTaskHandle != NULL)
+  {
+    xTaskNotify(radioTaskHandle, 0, eNoAction);
+  }
+#endif
+}
+
+// should be called frequently, handles the ISR flags and streams
+// the fifo while a frame arrives, complete frames are queued for
+// the decoder together with their signal quality
+void WaterMeter::service(void)
+{
+  if (requestedProfile != NULL)
+  {
+    applyProfile();
+  }
+
+  if (packetAvailable || fifoThreshold)
+  {
+    // clear the flags
     packetAvailable = false;
- 
-    WMBusFrame frame;
- 
-    receive(&frame);
+    fifoThreshold = false;
+
+    if (!rxActive)
+    {
+      rxActive = true;
+      rxLastData = micros();
+    }
+  }
+
+  if (!rxActive && millis() - lastCheck >= RADIO_CHECK_INTERVAL_MS)
+  {
+    lastCheck = millis();
+    checkReceiver();
+  }
+
+  if (!rxActive || !receive())
+  {
+    return;
+  }
+
+  RawFrame *raw = frames.claim();
+  if (raw != NULL)
+  {
+    raw->timestamp = millis();
+    raw->rssi = rxRssi;
+    raw->lqi = rxLqi;
+    raw->freqOffset = rxFreqOffset;
+    raw->length = rxBuffer.available();
+    rxBuffer.read(raw->payload, raw->length);
+
+#if RADIO_AFC
+    // only our meters, the neighbours' crystals are none of our business
+    if (raw->length > 6 && meters.find(WMBusFrame::meterIdOf(raw->payload)) != NULL)
+    {
+      updateAfc(rxFreqOffset);
+    }
+#endif
+    frames.push();
 
-    // Enable wireless reception interrupt
-    attachInterrupt(digitalPinToInterrupt(CC1101_GDO0), GD0_ISR, FALLING);
-    return frame.isValid;
+    uint8_t depth = frames.depth();
+    if (depth > statistics.queueMaxDepth)
+    {
+      statistics.queueMaxDepth = depth;
+    }
   }
-  return false;
+  else
+  {
+    statistics.queueDrops++;
+  }
+
+  uint32_t frameEnd = ESP.getCycleCount();
+  if (rxFixedLength && !afcPending)
+  {
+    rearmReceiver();
+    statistics.rearms++;
+  }
+  else
+  {
+    // flush RX fifo and restart receiver, applies a frequency correction
+    startReceiver();
+    statistics.restarts++;
+  }
+  updateDeadTime(ESP.getCycleCount() - frameEnd);
 }
 
-// Initialize CC1101 to receive WMBus MODE C1 
-void WaterMeter::begin()
+// takes the oldest captured frame from the queue, does the checking,
+// decryption and publishing
+bool WaterMeter::isFrameAvailable(void)
+{
+  RawFrame *raw = frames.front();
+  if (raw == NULL)
+  {
+    return false;
+  }
+
+  // neighbours' meters are dropped before copying or any crypto
+  Meter *meter = NULL;
+  if (raw->length > 6)
+  {
+    meter = meters.find(WMBusFrame::meterIdOf(raw->payload));
+  }
+  if (meter == NULL)
+  {
+    statistics.foreignFrames++;
+    frames.pop();
+    return false;
+  }
+
+  // decoded in place, the slot is ours until it is popped
+  decoder.decode(meter, raw->payload, raw->length);
+
+  if (decoder.isValid)
+  {
+    // the access number has been checked by the crc, it isn't encrypted
+    LinkStats &link = meter->link;
+    link.update(raw->rssi, raw->lqi, raw->freqOffset, raw->payload[11]);
+
+    WMBUS_LOG("Meter %s RSSI: %d dBm (avg %d), LQI: %d, offset: %d, received %u, missed %u (%u%%)\n\r",
+              meter->name, raw->rssi, link.rssi / 16, raw->lqi, raw->freqOffset,
+              link.received, link.missed, link.receptionRate());
+  }
+  frames.pop();
+
+  return decoder.isValid;
+}
+
+// reset and configure the CC1101, start receiving
+void WaterMeter::setupRadio(void)
 {
   pinMode(SS, OUTPUT);	// SS Pin -> Output
   SPI.begin();                          // Initialize SPI interface
   pinMode(CC1101_GDO0, INPUT);          // Config GDO0 as input
+  pinMode(CC1101_GDO2, INPUT);          // Config GDO2 as input
 
   reset();                              // power on CC1101
 
   //Serial.println("Setting CC1101 registers");
-  initializeRegisters();                // init CC1101 registers
+  initializeRegisters(*profile);        // init CC1101 registers
+  afcPending = statistics.afcOffset != 0;
 
   cmdStrobe(CC1101_SCAL);
   delay(1);
 
   attachInterrupt(digitalPinToInterrupt(CC1101_GDO0), GD0_ISR, FALLING);
+  attachInterrupt(digitalPinToInterrupt(CC1101_GDO2), GD2_ISR, RISING);
   startReceiver();
 }
 
-// reads a single byte from the RX fifo
-uint8_t WaterMeter::readByteFromFifo(void)
+#if defined(RADIO_TASK)
+// radio capture task, owns the SPI bus and the CC1101
+void WaterMeter::radioTask(void *param)
 {
-  return readReg(CC1101_RXFIFO, CC1101_CONFIG_REGISTER);
+  WaterMeter *meter = (WaterMeter *)param;
+
+  // interrupts are attached from this core, so the ISR and
+  // this task share the same cycle counter
+  meter->setupRadio();
+
+  for (;;)
+  {
+    // while a frame is arriving, poll to notice a stalled frame
+    // otherwise wake up for the receiver state check
+    TickType_t timeout = meter->rxActive ? 1 : pdMS_TO_TICKS(RADIO_CHECK_INTERVAL_MS);
+
+    if (xTaskNotifyWait(0, 0, NULL, timeout) == pdTRUE)
+    {
+      uint32_t latency = ESP.getCycleCount() - isrCycles;
+
+      meter->statistics.isrLatencyCycles = latency;
+      if (latency > meter->statistics.maxIsrLatencyCycles)
+      {
+        meter->statistics.maxIsrLatencyCycles = latency;
+      }
+    }
+
+    meter->service();
+  }
+}
+#endif
+
+// decoded records go to the meter's profile, which publishes them;
+// host builds have no publish functions
+static void publishRecords(Meter *meter, const DataRecords &records, void *context)
+{
+  if (meter->profile->publish != NULL)
+  {
+    meter->profile->publish(meter, records);
+  }
 }
 
-// handles a received frame and restart the CC1101 receiver
-void WaterMeter::receive(WMBusFrame * frame)
+// Initialize CC1101 to receive WMBus MODE C1 and T1
+void WaterMeter::begin()
 {
-  // read preamble, should be 0x543D
-  uint8_t p1 = readByteFromFifo();
-  uint8_t p2 = readByteFromFifo();
-  //Serial.printf("Preamble: %02x%02x\n\r", p1, p2);
+  meters.begin();
+  decoder.useCiphers(ciphers, CIPHER_CACHE_SIZE);
+  decoder.onRecords(publishRecords);
+
+#if defined(RADIO_TASK)
+  xTaskCreatePinnedToCore(radioTask, "radio", RADIO_TASK_STACK, this,
+                          RADIO_TASK_PRIORITY, &radioTaskHandle, RADIO_TASK_CORE);
+#else
+  setupRadio();
+#endif
+}
 
-  uint8_t payloadLength = readByteFromFifo();
+// reads the RSSI status register and converts it to dBm
+int8_t WaterMeter::readRssi(void)
+{
+  int16_t rssi = (int8_t)readReg(CC1101_RSSI, CC1101_STATUS_REGISTER);
 
-  // is it Mode C1, frame B and does it fit in the buffer
-  if ( (payloadLength < WMBusFrame::MAX_LENGTH )
-       && (p1 == 0x54) && (p2 == 0x3D) )
-  { 
-    // 3rd byte is payload length
-    frame->length = payloadLength;
+  // two's complement in 0.5 dB steps
+  return (int8_t)(rssi / 2 - RSSI_OFFSET);
+}
+
+// reads the RXBYTES status register
+uint8_t WaterMeter::readRxBytes(void)
+{
+  uint8_t last;
+  uint8_t rxBytes = readReg(CC1101_RXBYTES, CC1101_STATUS_REGISTER);
+
+  // CC1101 errata: read until two consecutive values are equal
+  do
+  {
+    last = rxBytes;
+    rxBytes = readReg(CC1101_RXBYTES, CC1101_STATUS_REGISTER);
+  } while (rxBytes != last);
+
+  return rxBytes;
+}
+
+// reads up to len bytes from the RX fifo, all available bytes are
+// drained with a single burst read; returns false if the frame
+// could not be completed
+bool WaterMeter::drainFifo(uint8_t *buffer, uint8_t len, uint8_t &count)
+{
+  uint8_t rxBytes = readRxBytes();
+  uint8_t available = rxBytes & RXBYTES_NUM_BYTES;
 
-    //Serial.printf("%02X", lfield);
+  count = 0;
 
-    // starting with 1! index 0 is lfield
-    for (int i = 0; i < payloadLength; i++)
+  if (rxLength != 0)
+  {
+    // a long frame got short enough for the radio to end it
+    switchToFixedLength(available);
+  }
+
+  if (available >= len)
+  {
+    available = len;
+  }
+  else if (rxBytes & RXBYTES_OVERFLOW)
+  {
+    // radio stopped writing, the rest of the frame is lost
+    statistics.fifoOverflows++;
+    return false;
+  }
+  else if (available > 0)
+  {
+    // CC1101 errata: don't read the last byte while the radio is still writing
+    available--;
+  }
+
+  if (available == 0)
+  {
+    if (micros() - rxLastData <= FIFO_DRAIN_TIMEOUT_US)
     {
-	    frame->payload[i] = readByteFromFifo();
+      return true;
     }
 
-    // do some checks: my meterId, crc ok
-    frame->decode();
+    if (rxLength == 0 && rxHeaderCount == 0)
+    {
+      // woken up without a frame, the receiver is still fine
+      rxActive = false;
+      return true;
+    }
+
+    statistics.fifoUnderruns++;
+    return false;
   }
 
-  // flush RX fifo and restart receiver
-  startReceiver();
-  //Serial.printf("rxStatus: 0x%02x\n\r", readStatusReg(CC1101_RXBYTES));
-}
\ No newline at end of file
+  readBurstReg(buffer, CC1101_RXFIFO, available);
+  count = available;
+  rxLastData = micros();
+
+  return true;
+}
+
+// streams the RX fifo into rxBuffer while the frame is still arriving
+// returns true once the complete frame is buffered
+bool WaterMeter::receive(void)
+{
+  uint8_t chunk[CC1101_FIFO_SIZE];
+  uint8_t count;
+  uint16_t wanted = (rxLength == 0) ? WMBUS_HEADER_LENGTH - rxHeaderCount : rxRawRemaining;
+
+  if (wanted > sizeof(chunk))
+  {
+    wanted = sizeof(chunk);
+  }
+
+  if (!drainFifo(chunk, wanted, count))
+  {
+    // flush RX fifo and restart receiver
+    startReceiver();
+    return false;
+  }
+
+  if (rxLength == 0)
+  {
+    memcpy(&rxHeader[rxHeaderCount], chunk, count);
+    rxHeaderCount += count;
+
+    if (rxHeaderCount == WMBUS_HEADER_LENGTH && !startFrame())
+    {
+      startReceiver();
+    }
+    return false;
+  }
+  rxRawRemaining -= count;
+
+  if (rxEncoded)
+  {
+    int16_t decoded = rxDecoder.decode(chunk, count, chunk);
+    if (decoded < 0)
+    {
+      statistics.codingErrors++;
+      startReceiver();
+      return false;
+    }
+    count = decoded;
+  }
+  else if (rxManchester)
+  {
+    int16_t decoded = rxManchesterDecoder.decode(chunk, count, chunk);
+    if (decoded < 0)
+    {
+      statistics.codingErrors++;
+      startReceiver();
+      return false;
+    }
+    count = decoded;
+  }
+
+  if (!storeFrameBytes(chunk, count))
+  {
+    // no need to wait for the rest of it
+    statistics.crcErrors++;
+    if (rxRemaining > 0)
+    {
+      statistics.earlyRejects++;
+      statistics.skippedBytes += rxRemaining;
+    }
+    startReceiver();
+    return false;
+  }
+
+  return rxRemaining == 0;
+}
+
+// checks the header, switches the radio to the frame length
+// returns false if it isn't a frame we can receive
+bool WaterMeter::startFrame(void)
+{
+  // C1 and T1 share the sync word, in mode C the frame type follows it
+  //Serial.printf("Preamble: %02x%02x\n\r", rxHeader[0], rxHeader[1]);
+  uint8_t decoded[2];
+
+  if (profile->framing == FramingS)
+  {
+    // Mode S1, manchester coded lfield and the first half of the cfield
+    rxManchesterDecoder.reset();
+    if (rxManchesterDecoder.decode(rxHeader, WMBUS_HEADER_LENGTH, decoded) < 0)
+    {
+      return false;
+    }
+    rxLength = decoded[0];
+    rxFormatA = true;
+    rxManchester = true;
+  }
+  else if ((rxHeader[0] == 0x54) && (rxHeader[1] == 0x3D))
+  {
+    // Mode C1, frame B
+    rxLength = rxHeader[2];
+  }
+  else if ((rxHeader[0] == 0x54) && (rxHeader[1] == 0xCD))
+  {
+    // Mode C1, frame A
+    rxLength = rxHeader[2];
+    rxFormatA = true;
+  }
+  else
+  {
+    // Mode T1, 3 of 6 coded lfield and cfield
+    rxDecoder.reset();
+    if (rxDecoder.decode(rxHeader, WMBUS_HEADER_LENGTH, decoded) < 0)
+    {
+      return false;
+    }
+    rxLength = decoded[0];
+    rxFormatA = true;
+    rxEncoded = true;
+  }
+
+  rxRemaining = frameLength();
+  if (!startBlock())
+  {
+    return false;
+  }
+
+  // bytes on air, including the header
+  uint16_t packetLength;
+  if (rxEncoded)
+  {
+    packetLength = ThreeOfSix::encodedLength(1 + rxRemaining);
+    if (!storeFrameBytes(&decoded[1], 1))
+    {
+      return false;
+    }
+    statistics.framesT1++;
+  }
+  else if (rxManchester)
+  {
+    // the half cfield waits in the decoder
+    packetLength = Manchester::encodedLength(1 + rxRemaining);
+    statistics.framesS1++;
+  }
+  else
+  {
+    packetLength = WMBUS_HEADER_LENGTH + rxRemaining;
+    if (rxFormatA) statistics.framesC1A++;
+    else statistics.framesC1B++;
+  }
+  rxRawRemaining = packetLength - WMBUS_HEADER_LENGTH;
+
+  // the signal is present and LQI is valid 8 bytes after the sync word
+  rxRssi = readRssi();
+  rxLqi = readReg(CC1101_LQI, CC1101_STATUS_REGISTER) & 0x7F;
+  rxFreqOffset = (int8_t)readReg(CC1101_FREQEST, CC1101_STATUS_REGISTER);
+
+  // let the radio end the packet, long ones once they are short enough
+  rxPacketLength = packetLength;
+  switchToFixedLength(readRxBytes() & RXBYTES_NUM_BYTES);
+  return true;
+}
+
+// the packet counter of the radio is 8 bit, in fixed length mode the packet
+// ends when it reaches PKTLEN; so stay in infinite mode until less than 256
+// bytes are left on air, PKTLEN is the packet length modulo 256 then
+void WaterMeter::switchToFixedLength(uint8_t fifoBytes)
+{
+  if (rxFixedLength || rxRawRemaining <= fifoBytes) return;
+
+  uint16_t onAir = rxRawRemaining - fifoBytes;
+  if (onAir <= PKTLEN_SWITCH_MARGIN || onAir >= 256) return;
+
+  writeReg(CC1101_PKTLEN, (uint8_t)rxPacketLength);
+  writeReg(CC1101_PKTCTRL0, CC1101_PKTCTRL0_FIXED);
+  rxFixedLength = true;
+}
+
+// frame format A has a crc after the first 9 and then every 16 data
+// bytes, the lfield doesn't count them; in format B the lfield does
+uint16_t WaterMeter::frameLength(void)
+{
+  if (!rxFormatA)
+  {
+    return rxLength;
+  }
+  if (rxLength < WMBUS_A_FIRST_BLOCK)
+  {
+    return 0;
+  }
+
+  uint16_t blocks = 1 + (rxLength - WMBUS_A_FIRST_BLOCK + WMBUS_A_BLOCK - 1) / WMBUS_A_BLOCK;
+  return rxLength + blocks * WMBUS_CRC_LENGTH;
+}
+
+// frame format A: block 1 has the lfield and 9 bytes, the next ones 16 bytes
+// frame format B: block 1 and 2 share a crc, which also covers the
+// lfield, an optional block 3 has the rest with its own crc
+bool WaterMeter::startBlock(void)
+{
+  // at least one data byte and the crc
+  if (rxRemaining <= WMBUS_CRC_LENGTH)
+  {
+    return false;
+  }
+
+  rxBlockRemaining = rxRemaining - WMBUS_CRC_LENGTH;
+  rxCrc = Crc16::INIT;
+  rxCrcReceived = 0;
+  rxCrcCount = 0;
+
+  uint16_t blockSize = rxBlockRemaining;
+  if (rxBuffer.available() == 0)
+  {
+    // first block, nothing stored yet
+    blockSize = rxFormatA ? WMBUS_A_FIRST_BLOCK : WMBUS_B_FIRST_BLOCK;
+    rxCrc = Crc16::update(rxCrc, &rxLength, 1);
+  }
+  else if (rxFormatA)
+  {
+    blockSize = WMBUS_A_BLOCK;
+  }
+
+  if (rxBlockRemaining > blockSize)
+  {
+    rxBlockRemaining = blockSize;
+  }
+  return true;
+}
+
+// moves frame bytes into rxBuffer without the link layer crcs, the
+// crc of a block is checked as soon as its last byte has arrived
+bool WaterMeter::storeFrameBytes(const uint8_t *data, uint8_t len)
+{
+  while (len > 0 && rxRemaining > 0)
+  {
+    if (rxBlockRemaining > 0)
+    {
+      uint8_t n = (len < rxBlockRemaining) ? len : rxBlockRemaining;
+
+      rxCrc = Crc16::update(rxCrc, data, n);
+      rxBuffer.write(data, n);
+      rxBlockRemaining -= n;
+      rxRemaining -= n;
+      data += n;
+      len -= n;
+      continue;
+    }
+
+    // crc is sent msb first
+    rxCrcReceived = (rxCrcReceived << 8) | *data++;
+    rxRemaining--;
+    len--;
+
+    if (++rxCrcCount == WMBUS_CRC_LENGTH)
+    {
+      if (rxCrcReceived != Crc16::finish(rxCrc))
+      {
+        return false;
+      }
+
+      if (rxRemaining > 0 && !startBlock())
+      {
+        return false;
+      }
+    }
+  }
+  return true;
+}
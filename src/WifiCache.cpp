@@ -0,0 +1,150 @@
+/*
+ Copyright (C) 2020 chester4444@wolke7.net
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "WifiCache.h"
+#include "Crc16.h"
+#include "ReadingStore.h"
+#include <lwip/netif.h>
+#include <lwip/dhcp.h>
+
+#define CACHE_MAGIC 0x57464332  // "WFC2"
+
+struct CacheData
+{
+  uint32_t magic;
+  uint8_t bssid[6];
+  uint8_t credential;
+  uint8_t channel;
+  uint32_t ip;
+  uint32_t gateway;
+  uint32_t subnet;
+  uint32_t dns;
+  uint32_t leaseStart;  // ReadingStore::clock() when the lease was given
+  uint32_t lease;       // lease time in seconds, 0 = unknown
+  uint16_t reserved;
+  uint16_t crc;         // over everything before
+};
+
+#if defined(ESP8266)
+  // RAM copy, written through to the RTC user memory
+  static CacheData cache;
+  static_assert(WIFI_CACHE_RTC_OFFSET + sizeof(CacheData) <= 512, "RTC user memory is 512 bytes");
+#else
+  RTC_NOINIT_ATTR static CacheData cache;
+#endif
+
+WifiCache wifiCache;
+
+static uint16_t crcOf(const CacheData &data)
+{
+  return Crc16::compute((const uint8_t *)&data, offsetof(CacheData, crc));
+}
+
+static void write(void)
+{
+  cache.crc = crcOf(cache);
+#if defined(ESP8266)
+  ESP.rtcUserMemoryWrite(WIFI_CACHE_RTC_OFFSET / 4, (uint32_t *)&cache, sizeof(cache));
+#endif
+}
+
+// the lease of the address DHCP gave us, 0 if the address is not from DHCP
+static uint32_t leaseTime(void)
+{
+  struct netif *netif = netif_default;
+  struct dhcp *dhcp = (netif != NULL) ? netif_dhcp_data(netif) : NULL;
+  return (dhcp != NULL && dhcp->state == DHCP_STATE_BOUND) ? dhcp->offered_t0_lease : 0;
+}
+
+// a DHCP client renews at half the lease, the address is safe until then
+static bool leaseValid(void)
+{
+  return cache.lease != 0 && readingStore.clock() - cache.leaseStart < cache.lease / 2;
+}
+
+bool WifiCache::begin(void)
+{
+#if defined(ESP8266)
+  ESP.rtcUserMemoryRead(WIFI_CACHE_RTC_OFFSET / 4, (uint32_t *)&cache, sizeof(cache));
+#endif
+
+  if (!valid())
+  {
+    // power on, the memory is random
+    memset(&cache, 0, sizeof(cache));
+    return false;
+  }
+  return true;
+}
+
+bool WifiCache::valid(void) const
+{
+  return cache.magic == CACHE_MAGIC && cache.crc == crcOf(cache);
+}
+
+uint8_t WifiCache::credential(void) const
+{
+  return cache.credential;
+}
+
+void WifiCache::connect(const char *ssid, const char *pass)
+{
+  if (leaseValid())
+  {
+    // the lease as static address, no DHCP round trip
+    WiFi.config(IPAddress(cache.ip), IPAddress(cache.gateway), IPAddress(cache.subnet), IPAddress(cache.dns));
+  }
+  else
+  {
+    // the address may be someone else's by now, ask DHCP
+    WiFi.config(IPAddress((uint32_t)0), IPAddress((uint32_t)0), IPAddress((uint32_t)0));
+  }
+  // no scan, the access point is known
+  WiFi.begin(ssid, pass, cache.channel, cache.bssid);
+}
+
+void WifiCache::save(uint8_t credential)
+{
+  cache.magic = CACHE_MAGIC;
+  memcpy(cache.bssid, WiFi.BSSID(), sizeof(cache.bssid));
+  cache.credential = credential;
+  cache.channel = WiFi.channel();
+  cache.ip = (uint32_t)WiFi.localIP();
+  cache.gateway = (uint32_t)WiFi.gatewayIP();
+  cache.subnet = (uint32_t)WiFi.subnetMask();
+  cache.dns = (uint32_t)WiFi.dnsIP(0);
+
+  // a static address keeps the lease it came from
+  uint32_t lease = leaseTime();
+  if (lease != 0)
+  {
+    cache.leaseStart = readingStore.clock();
+    cache.lease = lease;
+  }
+  else if (!leaseValid())
+  {
+    cache.lease = 0;
+  }
+  cache.reserved = 0;
+  write();
+}
+
+void WifiCache::forget(void)
+{
+  memset(&cache, 0, sizeof(cache));
+  write();
+
+  // all zero switches DHCP on again
+  WiFi.config(IPAddress((uint32_t)0), IPAddress((uint32_t)0), IPAddress((uint32_t)0));
+}
@@ -13,7 +13,15 @@ static const char *credentials[NUM_SSID_CREDENTIALS][3] =
 const char mqtt_user[] = "mosquitto-user";
 const char mqtt_pass[] = "mosquitto-pass!";
 
-const uint8_t meterId[4] = { 0x00, 0x00, 0x00, 0x00 }; // Multical21 serial. Printed as hex on meter.
-const uint8_t key[16] = { 0x00 ,0x00 ,0x00 ,0x00 ,0x00 ,0x00 ,0x00 ,0x00 ,0x00 ,0x00 ,0x00 ,0x00 ,0x00 ,0x00 ,0x00 ,0x00 }; // AES-128 key. Ask your service provider.
+// Meters to receive: serial and AES-128 key of each meter
+#define NUM_METERS  1
+static const uint8_t meterIds[NUM_METERS][4] =
+  // Multical21 serial. Printed as hex on meter.
+  { { 0x00, 0x00, 0x00, 0x00 }
+  };
+static const uint8_t meterKeys[NUM_METERS][16] =
+  // AES-128 key. Ask your service provider.
+  { { 0x00 ,0x00 ,0x00 ,0x00 ,0x00 ,0x00 ,0x00 ,0x00 ,0x00 ,0x00 ,0x00 ,0x00 ,0x00 ,0x00 ,0x00 ,0x00 }
+  };
 
 #endif
\ No newline at end of file
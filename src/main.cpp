@@ -20,10 +20,14 @@
   #include <WiFi.h>
   #include <ESPmDNS.h>
 #endif
-#include <PubSubClient.h>
 #include <ArduinoOTA.h>
 #include "credentials.h"
 #include "WaterMeter.h"
+#include "MqttTransport.h"
+#include "ReadingStore.h"
+#include "Scheduler.h"
+#include "WifiCache.h"
+#include "JsonWriter.h"
 #include "hwconfig.h"
 
 #define ESP_NAME "WaterMeter"
@@ -37,8 +41,54 @@
 
 WaterMeter waterMeter;
 
-WiFiClient espMqttClient;
-PubSubClient mqttClient(espMqttClient);
+MqttTransport mqtt;
+
+Scheduler scheduler;
+
+// task intervals, the radio runs on every tick
+#define DECODE_INTERVAL_MS 0
+#define WIFI_INTERVAL_MS 50
+#define MQTT_INTERVAL_MS 0
+#define OTA_INTERVAL_MS 10
+#define TRACE_INTERVAL_MS 60000
+#define TRACE_LINE_MS 10
+#define TRACE_LINE_LENGTH 128   // the uart fifo, a line is written without waiting
+#define LINK_INTERVAL_MS 300000
+#define LINK_STEP_MS 50
+#define STATS_INTERVAL_MS 300000
+
+// the fifo has to be read before it overflows
+#define RADIO_DEADLINE_MS 5
+
+// give up on a network after this, restart after a few failed attempts;
+// a fast connect that reaches no broker falls back to a scan and DHCP
+#define WIFI_CONNECT_TIMEOUT_MS 20000
+#define WIFI_FAST_TIMEOUT_MS 3000
+#define WIFI_FAST_MQTT_TIMEOUT_MS 30000
+#define WIFI_MAX_ATTEMPTS 3
+#define LED_BLINK_MS 300
+
+enum WifiStateType
+  { WifiFastConnect
+  , WifiScan
+  , WifiScanning
+  , WifiConnecting
+  , WifiOnline
+  };
+WifiStateType wifiState = WifiFastConnect;
+uint32_t wifiStarted = 0;
+bool wifiFast = false;     // connecting with the cached access point and address
+bool bootReported = false;
+uint8_t wifiAttempts = 0;
+bool otaStarted = false;
+bool mqttWasOnline = false;
+
+// set by a reset request from the network task, handled in loop()
+volatile bool resetRequested = false;
+
+// the restart waits for the status message to go out
+uint32_t restartAt = 0;
+#define RESTART_DELAY_MS 200
 
 char MyIp[16];
 int cred = -1;
@@ -67,77 +117,24 @@ int getWifiToConnect(int numSsid)
   return -1;
 }
 
-// connect to wifi – returns true if successful or false if not
-bool ConnectWifi(void)
-{
-  int i = 0;
-
-  Serial.println("starting scan");
-  // scan for nearby networks:
-  int numSsid = WiFi.scanNetworks();
-
-  Serial.print("scanning WIFI, found ");
-  Serial.print(numSsid);
-  Serial.println(" available access points:");
-
-  if (numSsid == -1)
-  {
-    Serial.println("Couldn't get a wifi connection");
-    return false;
-  }
-  
-  for (int i = 0; i < numSsid; i++)
-  {
-    Serial.print(i+1);
-    Serial.print(") ");
-    Serial.println(WiFi.SSID(i));
-  }
-
-  // search for given credentials
-  cred = getWifiToConnect(numSsid);
-  if (cred == -1)
-  {
-    Serial.println("No Wifi!");
-    return false;
-  }
-
-  // try to connect
-  WiFi.begin(credentials[cred][0], credentials[cred][1]);
-  Serial.println("");
-  Serial.print("Connecting to WiFi ");
-  Serial.println(credentials[cred][0]);
-
-  i = 0;
-  while (WiFi.status() != WL_CONNECTED)
-  {
-    digitalWrite(LED_BUILTIN, LOW);
-    delay(300);
-    Serial.print(".");
-    digitalWrite(LED_BUILTIN, HIGH);
-    delay(300);
-    if (i++ > 30)
-    {
-      // giving up
-      return false;
-    }
-  }
-  return true;
-}
+// gateway topics
+static const char TOPIC_DEBUG[] = MQTT_TOPIC_ROOT "0/debug";
+static const char TOPIC_ONLINE[] = MQTT_TOPIC_ROOT "0/online";
+static const char TOPIC_IPADDR[] = MQTT_TOPIC_ROOT "0/ipaddr";
+static const char TOPIC_LIVEDATA[] = MQTT_TOPIC_ROOT "0/liveData";
+static const char TOPIC_BACKLOG[] = MQTT_TOPIC_ROOT "0/backlog";
+static const char TOPIC_CONNECTTIME[] = MQTT_TOPIC_ROOT "0/connectTime";
+static const char TOPIC_RADIOPROFILE[] = MQTT_TOPIC_ROOT "0/radioProfile";
+static const char TOPIC_STATS[] = MQTT_TOPIC_ROOT "0/stats/";
 
 void mqttDebug(const char* debug_str)
 {
-    String s="watermeter/0/debug";
-    mqttClient.publish(s.c_str(), debug_str);
+    mqtt.publish(TOPIC_DEBUG, debug_str);
 }
 
-void mqttCallback(char* topic, byte* payload, unsigned int len)
+// runs in the network task: only look at the message, loop() does the rest
+void mqttCallback(const char* topic, const char* payload, size_t len)
 {
-  // create a local copies of topic and payload
-  // PubSubClient overwrites it internally
-  String t(topic);
-  byte *p = new byte[len];
-  memcpy(p, payload, len);
-  
 /*  Serial.print("MQTT-RECV: ");
   Serial.print(topic);
   Serial.print(" ");
@@ -150,78 +147,93 @@ void mqttCallback(char* topic, byte* payload, unsigned int len)
       // maybe to something
     }
   }
+  else if (strcmp(topic, TOPIC_RADIOPROFILE) == 0)
+  {
+    // e.g. "S1", the radio switches between two frames
+    const RadioProfile *profile = findRadioProfile(payload, len);
+    if (profile != NULL)
+    {
+      waterMeter.selectProfile(profile);
+    }
+  }
   else if (strstr(topic, "/espmeter/reset"))
   {
     if (len == 4) // True
     {
-      // maybe to something
-      const char *topic = "/espmeter/reset/status";
-      const char *msg = "False";
-      mqttClient.publish(topic, msg);
-      mqttClient.loop();
-      delay(200);
-
-      // reboot
-      ESP.restart();
+      resetRequested = true;
     }
   }
-  // and of course, free it
-  delete[] p;
 }
 
-bool mqttConnect()
-{
-  mqttClient.setServer(credentials[cred][2], 1883);
-  mqttClient.setCallback(mqttCallback);
+void mqttSubscribe();
 
+// the connection is made and kept by mqtt.service()
+void mqttBegin()
+{
   // connect client to retainable last will message
-  return mqttClient.connect(ESP_NAME, mqtt_user, mqtt_pass, "watermeter/0/online", 0, true, "False");
+  mqtt.begin(credentials[cred][2], 1883, ESP_NAME, mqtt_user, mqtt_pass, TOPIC_ONLINE, "False");
+  mqtt.onMessage(mqttCallback);
+  mqtt.onConnect(mqttSubscribe);
+}
+
+// value of a meter, the message and its topic are queued with qos 1;
+// false if the queue is full
+bool  mqttMyData(const Meter *meter, const char *value)
+{
+    char topic[MQTT_TOPIC_LENGTH];
+    meterTopic(topic, sizeof(topic), *meter, "sensor/mydata");
+    return mqtt.publish(topic, value, 1, true);
+}
+
+bool  mqttMyDataJson(const Meter *meter, const char *json, size_t len)
+{
+    char topic[MQTT_TOPIC_LENGTH];
+    meterTopic(topic, sizeof(topic), *meter, "sensor/mydatajson");
+    return mqtt.publish(topic, json, len, 1, true);
 }
 
-void  mqttMyData(const char* debug_str)
+// readings go to the store instead, while this is false
+bool mqttOnline()
 {
-    String s="watermeter/0/sensor/mydata";
-    mqttClient.publish(s.c_str(), debug_str, true);
+    return wifiState == WifiOnline && mqtt.connected();
 }
 
-void  mqttMyDataJson(const char* debug_str)
+// readings stored while offline, not retained, they are history
+bool mqttBacklog(const char *json, size_t len)
 {
-    String s="watermeter/0/sensor/mydatajson";
-    mqttClient.publish(s.c_str(), debug_str, true);
+    return mqtt.publish(TOPIC_BACKLOG, json, len, 1, false);
 }
 
+// announce and subscribe, after every (re)connect
 void mqttSubscribe()
 {
-  String s;
   // publish online status
-  s = "watermeter/0/online";
-  mqttClient.publish(s.c_str(), "True", true);
+  mqtt.publish(TOPIC_ONLINE, "True", 0, true);
   Serial.print("MQTT-SEND: ");
-  Serial.print(s);
+  Serial.print(TOPIC_ONLINE);
   Serial.println(" True");
   
   // publish ip address
-  s="watermeter/0/ipaddr";
   IPAddress MyIP = WiFi.localIP();
   snprintf(MyIp, 16, "%d.%d.%d.%d", MyIP[0], MyIP[1], MyIP[2], MyIP[3]);
-  mqttClient.publish(s.c_str(), MyIp, true);
+  mqtt.publish(TOPIC_IPADDR, MyIp, 0, true);
   Serial.print("MQTT-SEND: ");
-  Serial.print(s);
+  Serial.print(TOPIC_IPADDR);
   Serial.print(" ");
   Serial.println(MyIp);
 
   // if smarthome.py restarts -> publish init values
-  s = "/smarthomeNG/start";
-  mqttClient.subscribe(s.c_str());
+  mqtt.subscribe("/smarthomeNG/start");
 
   // if True; meter data are published every 5 seconds
   // if False: meter data are published once a minute
-  s = "watermeter/0/liveData";
-  mqttClient.subscribe(s.c_str());
+  mqtt.subscribe(TOPIC_LIVEDATA);
+
+  // name of a radio profile from include/RadioProfiles.h
+  mqtt.subscribe(TOPIC_RADIOPROFILE);
 
   // if True -> perform an reset
-  s = "espmeter/reset";
-  mqttClient.subscribe(s.c_str());
+  mqtt.subscribe("espmeter/reset");
 }
 
 void setupOTA()
@@ -236,7 +248,7 @@ void setupOTA()
   // ArduinoOTA.setPassword((const char *)"123");
 
   ArduinoOTA.onStart([]() {
-    String type;
+    const char *type;
     if (ArduinoOTA.getCommand() == U_FLASH) {
       type = "sketch";
     } else { // U_FS
@@ -244,9 +256,11 @@ void setupOTA()
     }
 
     // NOTE: if updating FS this would be the place to unmount FS using FS.end()
-    Serial.println("Start updating " + type);
+    Serial.printf("Start updating %s\n", type);
   });
   ArduinoOTA.onEnd([]() {
+    // the update restarts
+    readingStore.saveClock();
     Serial.println("\nEnd");
   });
   ArduinoOTA.onProgress([](unsigned int progress, unsigned int total) {
@@ -263,160 +277,537 @@ void setupOTA()
   ArduinoOTA.begin();
 }
 
-// receive encrypted packets -> send it via MQTT to decrypter
-void waterMeterLoop()
+// free heap and the lowest free stack seen so far, as a line of text
+int formatMemoryInfo(char *text, size_t size)
 {
-  if (waterMeter.isFrameAvailable())
-  {
-    // publish meter info via MQTT
-
-  }
+#if defined(ESP32)
+  return snprintf(text, size, "Memory: heap free %u, min free %u, stack free %u\n\r",
+                  ESP.getFreeHeap(), ESP.getMinFreeHeap(),
+                  (unsigned int)uxTaskGetStackHighWaterMark(NULL));
+#elif defined(ESP8266)
+  return snprintf(text, size, "Memory: heap free %u, max block %u, stack free %u\n\r",
+                  ESP.getFreeHeap(), ESP.getMaxFreeBlockSize(),
+                  ESP.getFreeContStack());
+#endif
 }
 
-void setup()
+void printMemoryInfo()
 {
-    pinMode(LED_BUILTIN, OUTPUT);
-
-    Serial.begin(115200);
+  char text[TRACE_LINE_LENGTH];
+  formatMemoryInfo(text, sizeof(text));
+  Serial.print(text);
+}
 
-    waterMeter.begin();
-    Serial.println("Setup done...");
+// decode captured packets -> publish meter info via MQTT
+void waterMeterLoop()
+{
+  waterMeter.isFrameAvailable();
 }
 
-enum ControlStateType
-  { StateInit
-  , StateNotConnected
-  , StateWifiConnect
-  , StateMqttConnect
-  , StateConnected
-  , StateOperating
-  };
-ControlStateType ControlState = StateInit;
+// a failed scan or connect starts over, too many of them restart
+void wifiFailed()
+{
+  Serial.println("Connection failed.");
+  if (++wifiAttempts >= WIFI_MAX_ATTEMPTS)
+  {
+    // reboot, the stored readings keep their age
+    readingStore.saveClock();
+    ESP.restart();
+  }
+  wifiState = WifiScan;
+}
 
-void loop()
+// scan, connect and watch the connection, never waits
+void wifiTask()
 {
-  switch (ControlState)
+  switch (wifiState)
   {
-    case StateInit:
-      //Serial.println("StateInit:");
-      WiFi.mode(WIFI_STA);
+    case WifiFastConnect:
+      if (!wifiCache.valid() || wifiCache.credential() >= NUM_SSID_CREDENTIALS)
+      {
+        wifiState = WifiScan;
+        break;
+      }
+      // the network we had before the restart, no scan, no DHCP
+      cred = wifiCache.credential();
+      Serial.print("Fast connect to WiFi ");
+      Serial.println(credentials[cred][0]);
+      wifiCache.connect(credentials[cred][0], credentials[cred][1]);
+      wifiFast = true;
+      wifiStarted = millis();
+      wifiState = WifiConnecting;
+      break;
 
-      ControlState = StateNotConnected;
+    case WifiScan:
+      Serial.println("starting scan");
+      // scan for nearby networks in the background
+      WiFi.scanNetworks(true);
+      wifiState = WifiScanning;
       break;
 
-    case StateNotConnected:
-      //Serial.println("StateNotConnected:");
+    case WifiScanning:
+    {
+      int numSsid = WiFi.scanComplete();
+      if (numSsid == WIFI_SCAN_RUNNING) break;
+
+      Serial.print("scanning WIFI, found ");
+      Serial.print(numSsid);
+      Serial.println(" available access points:");
+
+      if (numSsid < 0)
+      {
+        Serial.println("Couldn't get a wifi connection");
+        wifiFailed();
+        break;
+      }
+
+      for (int i = 0; i < numSsid; i++)
+      {
+        Serial.print(i+1);
+        Serial.print(") ");
+        Serial.println(WiFi.SSID(i));
+      }
+
+      // search for given credentials
+      cred = getWifiToConnect(numSsid);
+      WiFi.scanDelete();
+      if (cred == -1)
+      {
+        Serial.println("No Wifi!");
+        wifiFailed();
+        break;
+      }
 
-      ControlState = StateWifiConnect;
+      // try to connect
+      wifiFast = false;
+      WiFi.begin(credentials[cred][0], credentials[cred][1]);
+      Serial.println("");
+      Serial.print("Connecting to WiFi ");
+      Serial.println(credentials[cred][0]);
+      wifiStarted = millis();
+      wifiState = WifiConnecting;
       break;
-      
-    case StateWifiConnect:
-      //Serial.println("StateWifiConnect:");
-      // station mode
-      ConnectWifi();
-
-      delay(500);
-      
+    }
+
+    case WifiConnecting:
       if (WiFi.status() == WL_CONNECTED)
       {
         Serial.println("");
         Serial.print("Connected to ");
-        Serial.println(credentials[cred][0]); // FIXME
+        Serial.println(credentials[cred][0]);
         Serial.print("IP address: ");
         Serial.println(WiFi.localIP());
 
-        setupOTA();
-        
-        ControlState = StateMqttConnect;
+        if (!otaStarted)
+        {
+          setupOTA();
+          otaStarted = true;
+        }
+        // the broker belongs to the network
+        mqttBegin();
+
+        digitalWrite(LED_BUILTIN, HIGH); // off
+        // the next restart or reconnect skips the scan
+        wifiCache.save(cred);
+        wifiAttempts = 0;
+        wifiState = WifiOnline;
+        break;
       }
-      else
-      {
-        Serial.println("");
-        Serial.println("Connection failed.");
 
-        // try again
-        ControlState = StateNotConnected;
+      // blink while connecting
+      digitalWrite(LED_BUILTIN, (millis() / LED_BLINK_MS) & 1 ? HIGH : LOW);
 
-        // reboot 
-        ESP.restart();
+      if (wifiFast && millis() - wifiStarted > WIFI_FAST_TIMEOUT_MS)
+      {
+        // access point or lease changed, scan and ask DHCP
+        Serial.println("Fast connect failed.");
+        WiFi.disconnect();
+        wifiCache.forget();
+        wifiState = WifiScan;
+      }
+      else if (millis() - wifiStarted > WIFI_CONNECT_TIMEOUT_MS)
+      {
+        WiFi.disconnect();
+        wifiFailed();
       }
       break;
 
-    case StateMqttConnect:
-      Serial.println("StateMqttConnect:");
-      digitalWrite(LED_BUILTIN, HIGH); // off
-
+    case WifiOnline:
       if (WiFi.status() != WL_CONNECTED)
       {
-        ControlState = StateNotConnected;
-        break; // exit (hopefully) switch statement
+        Serial.println("WiFi lost");
+        digitalWrite(LED_BUILTIN, HIGH); // off
+        // most likely the same access point comes back
+        wifiState = WifiFastConnect;
       }
-      
-      Serial.print("try to connect to MQTT server ");
-      Serial.println(credentials[cred][2]); // FIXME
-
-      if (mqttConnect())
+      else if (wifiFast && mqtt.connected())
       {
-        ControlState = StateConnected;
+        // the cached connection works
+        wifiFast = false;
       }
-      else
+      else if (wifiFast && millis() - wifiStarted > WIFI_FAST_MQTT_TIMEOUT_MS)
       {
-        Serial.println("MQTT connect failed");
-
-        delay(1000);
-        // try again
+        // associated, but the cached address doesn't get us anywhere
+        Serial.println("Fast connect: no broker, scan and ask DHCP");
+        WiFi.disconnect();
+        wifiCache.forget();
+        wifiFast = false;
+        wifiState = WifiScan;
       }
-      ArduinoOTA.handle();
-      
       break;
+  }
+}
 
-    case StateConnected:
-      Serial.println("StateConnected:");
+// keep the broker connection, forward stored readings, handle resets
+void mqttTask()
+{
+  if (restartAt != 0 && (int32_t)(millis() - restartAt) >= 0)
+  {
+    // reboot
+    readingStore.saveClock();
+    ESP.restart();
+  }
 
-      if (!mqttClient.connected())
-      {
-        ControlState = StateMqttConnect;
-        delay(1000);
-      }
-      else
-      {
-        // subscribe to given topics
-        mqttSubscribe();
-        
-        ControlState = StateOperating;
-        digitalWrite(LED_BUILTIN, LOW); // on
-        Serial.println("StateOperating:");
-        //mqttDebug("up and running");
-      }
-      ArduinoOTA.handle();
-      
-      break;
-    
-    case StateOperating:
-      //Serial.println("StateOperating:");
+  if (wifiState != WifiOnline) return;
 
-      if (WiFi.status() != WL_CONNECTED)
+  // connects in the background, retries with backoff
+  mqtt.service();
+
+  bool online = mqtt.connected();
+  if (online != mqttWasOnline)
+  {
+    mqttWasOnline = online;
+    if (online)
+    {
+      // topics are subscribed by the connect handler
+      Serial.print("connected to MQTT server ");
+      Serial.println(credentials[cred][2]);
+      digitalWrite(LED_BUILTIN, LOW); // on
+
+      if (!bootReported)
       {
-        ControlState = StateWifiConnect;
-        break; // exit (hopefully switch statement)
+        // boot to broker, the time until readings flow
+        char ms[12];
+        snprintf(ms, sizeof(ms), "%lu", (unsigned long)millis());
+        Serial.printf("Connect time: %s ms (%s)\n\r", ms, wifiFast ? "fast" : "scan");
+        mqtt.publish(TOPIC_CONNECTTIME, ms, 0, true);
+        bootReported = true;
       }
+    }
+    else
+    {
+      Serial.println("not connected to MQTT server");
+      digitalWrite(LED_BUILTIN, HIGH); // off
+    }
+  }
+  if (!online) return;
+
+  // stored readings, a batch at a time while the queue has room
+  if (mqtt.getQueueDepth() < MQTT_QUEUE_SIZE / 2)
+  {
+    forwardStoredReadings();
+  }
 
-      if (!mqttClient.connected())
+  if (resetRequested)
+  {
+    resetRequested = false;
+    mqtt.publish("/espmeter/reset/status", "False");
+
+    // reboot, once the status has been sent
+    restartAt = millis() + RESTART_DELAY_MS;
+    if (restartAt == 0) restartAt = 1;
+  }
+}
+
+void otaTask()
+{
+  if (otaStarted && wifiState == WifiOnline)
+  {
+    ArduinoOTA.handle();
+  }
+}
+
+#if !defined(RADIO_TASK)
+void radioTask()
+{
+  waterMeter.service();
+}
+#endif
+
+// one line of the trace, 0 if it is left out in this build, -1 past the last
+int formatTraceLine(uint8_t line, char *text, size_t size)
+{
+  static const char *const states[] = { "fast", "scan", "scanning", "connecting", "online" };
+
+  const WaterMeter::Statistics &radio = waterMeter.getStatistics();
+  uint32_t mhz = ESP.getCpuFreqMHz();
+
+  switch (line)
+  {
+    case 0:
+      return snprintf(text, size, "Trace: wifi %s, mqtt %s, afc %d\n\r", states[wifiState],
+                      mqtt.connected() ? "online" : "offline", radio.afcOffset);
+    case 1:
+      return snprintf(text, size, "Trace: radio overflows %u, recoveries %u, reinits %u, timeouts %u, deaf %u ms\n\r",
+                      radio.fifoOverflows, radio.recoveries, radio.reinits, radio.stateTimeouts,
+                      (unsigned int)(radio.deafTimeUs / 1000));
+    case 2:
+      // bad frames, an early reject stops reading at the first bad block
+      return snprintf(text, size, "Trace: crc errors %u, early rejects %u, skipped bytes %u\n\r",
+                      radio.crcErrors, radio.earlyRejects, radio.skippedBytes);
+    case 3:
+      // receiver dead time after a frame: a rearm should take a few us, a restart more
+      return snprintf(text, size, "Trace: frames rearmed %u, restarted %u, dead time %u us, max %u us\n\r",
+                      radio.rearms, radio.restarts, radio.deadTimeCycles / mhz, radio.maxDeadTimeCycles / mhz);
+    case 4:
+      // drops mean the decoder falls behind the radio
+      return snprintf(text, size, "Trace: queue depth %u, max %u, drops %u\n\r",
+                      waterMeter.getQueueDepth(), radio.queueMaxDepth, radio.queueDrops);
+    case 5:
+#if defined(RADIO_TASK)
+      // interrupt to radio task, the capture runs on its own core
+      return snprintf(text, size, "Trace: radio task latency %u us, max %u us\n\r",
+                      radio.isrLatencyCycles / mhz, radio.maxIsrLatencyCycles / mhz);
+#else
+      return 0;
+#endif
+    case 6:
+      return formatMemoryInfo(text, size);
+    default:
+      if (line - 7 < scheduler.size())
       {
-        Serial.println("not connected to MQTT server");
-        ControlState = StateMqttConnect;
+        return scheduler.formatTrace(line - 7, text, size);
       }
+      return -1;
+  }
+}
 
-      // here we go
-      waterMeterLoop();
+// how late the radio was served, per minute, with the wifi state at the time;
+// a line per run and only if the serial port takes it without waiting, a
+// whole trace at once would hold up the radio for 100 ms
+void traceTask()
+{
+  static uint32_t lastTrace = 0;
+  static uint8_t line = 0;
+  char text[TRACE_LINE_LENGTH];
 
-      mqttClient.loop();
+  if (line == 0 && millis() - lastTrace < TRACE_INTERVAL_MS) return;
 
-      ArduinoOTA.handle();
+  int len = formatTraceLine(line, text, sizeof(text));
+  if (len < 0)
+  {
+    // done, until the next minute
+    line = 0;
+    lastTrace = millis();
+    return;
+  }
+  if (len == 0)
+  {
+    line++;
+    return;
+  }
+  if (len >= (int)sizeof(text)) len = sizeof(text) - 1;
+  if (Serial.availableForWrite() < len) return;
 
-      break;
+  Serial.write((const uint8_t *)text, len);
+  line++;
+}
 
-    default:
-      Serial.println("Error: invalid ControlState");  
+// link quality and reception rate of a meter, retained
+void publishLink(const Meter &meter)
+{
+  const LinkStats &link = meter.link;
+  if (link.received == 0) return;
+
+  char json[160];
+  char number[FIXED_TEXT_LENGTH];
+  JsonWriter writer(json, sizeof(json));
+
+  writer.beginObject();
+  // averages are x16, FREQEST steps are 1587 Hz
+  JsonWriter::formatFixed(number, link.rssi * 10 / 16, 1);
+  writer.addNumber("rssi", number);
+  JsonWriter::formatFixed(number, link.lqi / 16, 0);
+  writer.addNumber("lqi", number);
+  JsonWriter::formatFixed(number, (int32_t)link.freqOffset * 1587 / 1600, 1);
+  writer.addNumber("freqOffset", number);
+  JsonWriter::formatFixed(number, link.received, 0);
+  writer.addNumber("received", number);
+  JsonWriter::formatFixed(number, link.missed, 0);
+  writer.addNumber("missed", number);
+  JsonWriter::formatFixed(number, link.receptionRate(), 0);
+  writer.addNumber("receptionRate", number);
+  writer.endObject();
+
+  if (writer.ok())
+  {
+    char topic[MQTT_TOPIC_LENGTH];
+    meterTopic(topic, sizeof(topic), meter, "link");
+    mqtt.publish(topic, writer.c_str(), writer.getLength(), 0, true);
+  }
+}
+
+// signal quality and reception rate of every meter heard so far, a pass
+// every LINK_INTERVAL_MS; a run only fills the queue up to half, readings
+// keep the other half, the next run goes on with the next meter
+void linkTask()
+{
+  static uint32_t lastPass = 0;
+  static bool passing = false;
+  static uint16_t next = 0;
+
+  if (!mqttOnline()) return;
+
+  if (!passing)
+  {
+    if (millis() - lastPass < LINK_INTERVAL_MS) return;
+    lastPass = millis();
+    passing = true;
+    next = 0;
+  }
+
+  MeterRegistry &meters = waterMeter.getMeters();
+  while (next < meters.size() && mqtt.getFreeSlots() > MQTT_QUEUE_SIZE / 2)
+  {
+    publishLink(meters[next++]);
+  }
+  if (next >= meters.size())
+  {
+    passing = false;
+  }
+}
+
+static void addCounter(JsonWriter &writer, const char *name, uint32_t value)
+{
+  char number[FIXED_TEXT_LENGTH];
+  JsonWriter::formatFixed(number, value, 0);
+  writer.addNumber(name, number);
+}
+
+// MQTT_TOPIC_ROOT0/stats/<group>, the writer's object is closed here
+static void publishStats(const char *group, JsonWriter &writer)
+{
+  char topic[MQTT_TOPIC_LENGTH];
+  snprintf(topic, sizeof(topic), "%s%s", TOPIC_STATS, group);
+
+  writer.endObject();
+  if (writer.ok())
+  {
+    mqtt.publish(topic, writer.c_str(), writer.getLength(), 0, true);
   }
 }
+
+// counters of the gateway since boot, a flat object per group, so each
+// one fits into an mqtt message
+void statsTask()
+{
+  // a crash restarts without warning, the clock is at most this interval behind
+  readingStore.saveClock();
+
+  if (!mqttOnline()) return;
+
+  char json[MQTT_PAYLOAD_MAX];
+
+  // layouts of the compact frames, expanded keys
+  const FormatCache::Statistics &formats = waterMeter.getFormatStatistics();
+  JsonWriter decoder(json, sizeof(json));
+  decoder.beginObject();
+  addCounter(decoder, "formatHits", formats.hits);
+  addCounter(decoder, "formatMisses", formats.misses);
+  addCounter(decoder, "formatEvictions", formats.evictions);
+  const WMBusFrame::CipherStatistics &keys = waterMeter.getCipherStatistics();
+  addCounter(decoder, "keyHits", keys.hits);
+  addCounter(decoder, "keyExpansions", keys.expansions);
+  publishStats("decoder", decoder);
+
+  // radio profiles applied, and configurations that didn't read back
+  const WaterMeter::Statistics &radioStats = waterMeter.getStatistics();
+  JsonWriter radio(json, sizeof(json));
+  radio.beginObject();
+  addCounter(radio, "profileSwitches", radioStats.profileSwitches);
+  addCounter(radio, "configErrors", radioStats.configErrors);
+  publishStats("radio", radio);
+
+  // readings of all meters, by the publish policy, and those kept while
+  // the broker couldn't take them
+  MeterRegistry &meters = waterMeter.getMeters();
+  uint32_t sent = 0;
+  uint32_t suppressed = 0;
+  for (uint16_t i = 0; i < meters.size(); i++)
+  {
+    sent += meters[i].sent;
+    suppressed += meters[i].suppressed;
+  }
+  const ReadingStore::Statistics &store = readingStore.getStatistics();
+  JsonWriter readings(json, sizeof(json));
+  readings.beginObject();
+  addCounter(readings, "sent", sent);
+  addCounter(readings, "suppressed", suppressed);
+  addCounter(readings, "stored", store.stored);
+  addCounter(readings, "storeOverwritten", store.overwritten);
+  addCounter(readings, "storeForwarded", store.forwarded);
+  addCounter(readings, "storeDepth", readingStore.size());
+  addCounter(readings, "storeSavedBytes", store.savedBytes);
+  publishStats("readings", readings);
+
+  // the broker connection and the outgoing queue
+  const MqttTransport::Statistics &transport = mqtt.getStatistics();
+  JsonWriter broker(json, sizeof(json));
+  broker.beginObject();
+  addCounter(broker, "queued", transport.queued);
+  addCounter(broker, "drops", transport.drops);
+  addCounter(broker, "sent", transport.sent);
+  addCounter(broker, "resends", transport.resends);
+  addCounter(broker, "acks", transport.acks);
+  addCounter(broker, "connects", transport.connects);
+  addCounter(broker, "failures", transport.failures);
+  addCounter(broker, "maxDepth", transport.maxDepth);
+  publishStats("mqtt", broker);
+}
+
+// a task without room would never run, and nothing would tell
+void addTask(const char *name, Scheduler::TaskFunction run, uint32_t intervalMs, uint32_t deadlineMs = 0)
+{
+  if (!scheduler.add(name, run, intervalMs, deadlineMs))
+  {
+    Serial.printf("Scheduler: no room for task %s, raise MAX_TASKS\n\r", name);
+  }
+}
+
+void setup()
+{
+    pinMode(LED_BUILTIN, OUTPUT);
+
+    Serial.begin(115200);
+
+    readingStore.begin();
+    waterMeter.begin();
+
+    WiFi.mode(WIFI_STA);
+    // the cache below replaces the SDK's own, which writes flash on every begin
+    WiFi.persistent(false);
+    wifiCache.begin();
+
+#if !defined(RADIO_TASK)
+    // capture frames in every state
+    addTask("radio", radioTask, 0, RADIO_DEADLINE_MS);
+#endif
+    // readings are published, or stored while we are offline
+    addTask("decode", waterMeterLoop, DECODE_INTERVAL_MS);
+    addTask("wifi", wifiTask, WIFI_INTERVAL_MS);
+    addTask("mqtt", mqttTask, MQTT_INTERVAL_MS);
+    addTask("ota", otaTask, OTA_INTERVAL_MS);
+    addTask("trace", traceTask, TRACE_LINE_MS);
+    addTask("link", linkTask, LINK_STEP_MS);
+    addTask("stats", statsTask, STATS_INTERVAL_MS);
+
+    Serial.println("Setup done...");
+    printMemoryInfo();
+}
+
+
+void loop()
+{
+  // no task waits, every tick is short
+  scheduler.tick();
+}
@@ -0,0 +1,94 @@
+/*
+ Copyright (C) 2020 chester4444@wolke7.net
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _FAKE_ARDUINO_H_
+#define _FAKE_ARDUINO_H_
+
+// the parts of the ESP32 Arduino core the firmware sources use, for the
+// host tests; time only moves when the fake radio or a test moves it
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+
+typedef bool boolean;
+
+#define HIGH      1
+#define LOW       0
+#define INPUT     0
+#define OUTPUT    1
+#define RISING    1
+#define FALLING   2
+
+#define ICACHE_RAM_ATTR
+#define IRAM_ATTR
+#define RTC_NOINIT_ATTR
+
+static const uint8_t SS = 5;
+static const uint8_t MOSI = 23;
+static const uint8_t MISO = 19;
+static const uint8_t SCK = 18;
+
+// microseconds since the start of the test
+inline uint64_t &fakeMicros(void)
+{
+  static uint64_t now = 0;
+  return now;
+}
+
+#include "FakeCC1101.h"
+
+inline unsigned long micros(void) { return (unsigned long)fakeMicros(); }
+inline unsigned long millis(void) { return (unsigned long)(fakeMicros() / 1000); }
+inline void delay(unsigned long ms) { fakeMicros() += ms * 1000; }
+inline void delayMicroseconds(unsigned int us) { fakeMicros() += us; }
+
+inline void pinMode(uint8_t pin, uint8_t mode) {}
+inline int digitalPinToInterrupt(int pin) { return pin; }
+
+// chip select goes to the radio, MISO is always ready
+inline void digitalWrite(uint8_t pin, uint8_t level)
+{
+  if (pin == SS) fakeRadio().select(level == LOW);
+}
+inline int digitalRead(uint8_t pin) { return LOW; }
+
+inline void attachInterrupt(int pin, void (*isr)(void), int mode)
+{
+  fakeRadio().attach(pin, isr);
+}
+
+// the firmware logs a lot, the tests don't want to see it
+struct FakeSerial
+{
+  void begin(unsigned long baud) {}
+  int printf(const char *format, ...) { return 0; }
+  template <class T> void print(const T &value) {}
+  template <class T> void println(const T &value) {}
+  void println(void) {}
+};
+static FakeSerial Serial __attribute__((unused));
+
+struct FakeEsp
+{
+  // 240 MHz
+  uint32_t getCycleCount(void) { return (uint32_t)(fakeMicros() * 240); }
+  void restart(void) {}
+  uint32_t getFreeHeap(void) { return 0; }
+};
+static FakeEsp ESP __attribute__((unused));
+
+#endif // _FAKE_ARDUINO_H_
@@ -0,0 +1,160 @@
+/*
+ Copyright (C) 2020 chester4444@wolke7.net
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _FAKE_ASYNCMQTTCLIENT_H_
+#define _FAKE_ASYNCMQTTCLIENT_H_
+
+// AsyncMqttClient with the broker left out: the test plays the broker,
+// it accepts or drops the connection and acks publishes. Callbacks are
+// kept in lists like the real client does, every on...() adds one
+
+#include <Arduino.h>
+#include <stdint.h>
+#include <string.h>
+#include <functional>
+#include <vector>
+
+enum class AsyncMqttClientDisconnectReason : int8_t
+{
+  TCP_DISCONNECTED = 0,
+  MQTT_SERVER_UNAVAILABLE = 3,
+};
+
+struct AsyncMqttClientMessageProperties
+{
+  uint8_t qos;
+  bool dup;
+  bool retain;
+};
+
+// a publish as the broker got it
+struct FakePublish
+{
+  char topic[64];
+  uint16_t length;
+  uint8_t qos;
+  bool retain;
+  bool dup;
+  uint16_t packetId;
+};
+
+class AsyncMqttClient;
+
+// the client of the transport under test, the last one constructed
+inline AsyncMqttClient *&fakeMqtt(void)
+{
+  static AsyncMqttClient *client = nullptr;
+  return client;
+}
+
+class AsyncMqttClient
+{
+  public:
+    typedef std::function<void(bool sessionPresent)> OnConnectUserCallback;
+    typedef std::function<void(AsyncMqttClientDisconnectReason reason)> OnDisconnectUserCallback;
+    typedef std::function<void(uint16_t packetId)> OnPublishUserCallback;
+    typedef std::function<void(char *topic, char *payload, AsyncMqttClientMessageProperties properties,
+                               size_t len, size_t index, size_t total)> OnMessageUserCallback;
+
+    static const size_t PUBLISH_LOG = 32;
+
+    // broker side
+    bool isConnected = false;
+    uint32_t connectCalls = 0;
+    bool tcpFull = false;             // publish() fails like a full tcp buffer
+    uint32_t publishCostUs = 0;       // time a publish() blocks, the real client
+                                      // builds the packet and waits for the tcp task
+    FakePublish log[PUBLISH_LOG];     // ring of the last publishes
+    uint32_t publishes = 0;
+    uint16_t nextPacketId = 1;
+
+    std::vector<OnConnectUserCallback> connectCallbacks;
+    std::vector<OnDisconnectUserCallback> disconnectCallbacks;
+    std::vector<OnPublishUserCallback> publishCallbacks;
+    std::vector<OnMessageUserCallback> messageCallbacks;
+
+    AsyncMqttClient(void) { fakeMqtt() = this; }
+
+    AsyncMqttClient &setServer(const char *host, uint16_t port) { return *this; }
+    AsyncMqttClient &setClientId(const char *clientId) { return *this; }
+    AsyncMqttClient &setCredentials(const char *username, const char *password = nullptr) { return *this; }
+    AsyncMqttClient &setWill(const char *topic, uint8_t qos, bool retain,
+                             const char *payload = nullptr, size_t length = 0) { return *this; }
+
+    AsyncMqttClient &onConnect(OnConnectUserCallback callback)
+      { connectCallbacks.push_back(callback); return *this; }
+    AsyncMqttClient &onDisconnect(OnDisconnectUserCallback callback)
+      { disconnectCallbacks.push_back(callback); return *this; }
+    AsyncMqttClient &onPublish(OnPublishUserCallback callback)
+      { publishCallbacks.push_back(callback); return *this; }
+    AsyncMqttClient &onMessage(OnMessageUserCallback callback)
+      { messageCallbacks.push_back(callback); return *this; }
+
+    bool connected(void) const { return isConnected; }
+    void connect(void) { connectCalls++; }
+    void disconnect(bool force = false) { isConnected = false; }
+
+    uint16_t publish(const char *topic, uint8_t qos, bool retain,
+                     const char *payload = nullptr, size_t length = 0, bool dup = false, uint16_t messageId = 0)
+    {
+      if (!isConnected || tcpFull) return 0;
+      fakeMicros() += publishCostUs;
+
+      FakePublish &entry = log[publishes++ % PUBLISH_LOG];
+      strncpy(entry.topic, topic, sizeof(entry.topic) - 1);
+      entry.topic[sizeof(entry.topic) - 1] = 0;
+      entry.length = length;
+      entry.qos = qos;
+      entry.retain = retain;
+      entry.dup = dup;
+      // qos 0 has no packet id, but the call still succeeds
+      entry.packetId = (qos == 0) ? 1 : nextPacketId++;
+      if (nextPacketId == 0) nextPacketId = 1;
+      return entry.packetId;
+    }
+
+    uint16_t subscribe(const char *topic, uint8_t qos) { return isConnected ? nextPacketId++ : 0; }
+
+    // the broker's answers, delivered like the network task does
+    void acceptConnect(void)
+    {
+      isConnected = true;
+      for (auto &callback : connectCallbacks) callback(false);
+    }
+
+    void dropConnection(void)
+    {
+      isConnected = false;
+      for (auto &callback : disconnectCallbacks) callback(AsyncMqttClientDisconnectReason::TCP_DISCONNECTED);
+    }
+
+    void ack(uint16_t packetId)
+    {
+      for (auto &callback : publishCallbacks) callback(packetId);
+    }
+
+    void deliver(const char *topic, const char *payload)
+    {
+      AsyncMqttClientMessageProperties properties = { 0, false, false };
+      size_t len = strlen(payload);
+      for (auto &callback : messageCallbacks)
+        callback((char *)topic, (char *)payload, properties, len, 0, len);
+    }
+
+    // last publish, or one further back
+    const FakePublish &last(uint32_t back = 0) const { return log[(publishes - 1 - back) % PUBLISH_LOG]; }
+};
+
+#endif // _FAKE_ASYNCMQTTCLIENT_H_
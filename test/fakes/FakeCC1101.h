@@ -0,0 +1,259 @@
+/*
+ Copyright (C) 2020 chester4444@wolke7.net
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _FAKECC1101_H_
+#define _FAKECC1101_H_
+
+#include <stdint.h>
+#include <deque>
+#include <vector>
+#include "hwconfig.h"
+
+// CC1101 as seen over SPI: registers, strobes, MARCSTATE, the RX fifo with
+// its 8 bit packet counter and the GDO interrupts; a packet "on air" is
+// moved into the fifo by deliver(), faults can be injected in between
+class FakeCC1101
+{
+  public:
+    static const uint8_t FIFO_SIZE = 64;
+    static const uint8_t CONFIG_REGISTERS = 0x2F;
+
+    // MARCSTATE values
+    static const uint8_t STATE_IDLE = 0x01;
+    static const uint8_t STATE_RX = 0x0D;
+    static const uint8_t STATE_RXFIFO_OVERFLOW = 0x11;
+
+    uint8_t regs[CONFIG_REGISTERS];
+    uint8_t state = STATE_IDLE;
+    std::deque<uint8_t> fifo;
+    bool overflowed = false;
+
+    // packet on air after the sync word, and how far it has been received
+    std::vector<uint8_t> air;
+    size_t airPos = 0;
+    bool receiving = false;
+    uint8_t packetCounter = 0;    // 8 bit, like the chip's
+    uint32_t byteUs = 80;         // 100 kchip/s
+
+    // status registers
+    int8_t freqEst = 0;
+    uint8_t rssi = 0;
+    uint8_t lqi = 0;
+
+    // faults
+    bool ignoreRx = false;        // SRX has no effect
+    bool hung = false;            // no strobe has an effect until SRES
+    int corruptRegister = -1;     // config register that reads back wrong
+
+    // MOSI bytes of every chip select cycle
+    std::vector<std::vector<uint8_t>> transcript;
+
+    void (*gdo0)(void) = NULL;
+    void (*gdo2)(void) = NULL;
+
+    // power on, forgets all faults and the transcript
+    void powerOn(void)
+    {
+      *this = FakeCC1101();
+      memset(regs, 0, sizeof(regs));
+    }
+
+    void attach(int pin, void (*isr)(void))
+    {
+      if (pin == CC1101_GDO0) gdo0 = isr;
+      if (pin == CC1101_GDO2) gdo2 = isr;
+    }
+
+    // CSn
+    void select(bool on)
+    {
+      if (on && !selected)
+      {
+        transcript.push_back(std::vector<uint8_t>());
+      }
+      selected = on;
+      first = true;
+    }
+
+    uint8_t transfer(uint8_t data)
+    {
+      // a byte takes about 1 us at 8 MHz
+      fakeMicros() += 1;
+      if (!selected) return 0xFF;
+      transcript.back().push_back(data);
+
+      if (first)
+      {
+        first = false;
+        address = data & 0x3F;
+        burst = (data & 0x40) != 0;
+        read = (data & 0x80) != 0;
+        if (address >= 0x30 && address <= 0x3D && !burst)
+        {
+          strobe(address);
+        }
+        return state << 4;
+      }
+
+      if (address == 0x3F)
+      {
+        // RX fifo, TX isn't used
+        if (!read || fifo.empty()) return 0;
+        uint8_t value = fifo.front();
+        fifo.pop_front();
+        return value;
+      }
+      if (address >= 0x30)
+      {
+        // status registers are read with the burst bit
+        return readStatus(address);
+      }
+      if (address >= CONFIG_REGISTERS)
+      {
+        // PATABLE
+        return 0;
+      }
+
+      uint8_t reg = address;
+      if (burst) address++;
+      if (!read)
+      {
+        regs[reg] = data;
+        return 0;
+      }
+      return (reg == corruptRegister) ? regs[reg] ^ 0x01 : regs[reg];
+    }
+
+    // a packet starts, if the radio is listening
+    void send(const std::vector<uint8_t> &packet)
+    {
+      air = packet;
+      airPos = 0;
+      receiving = (state == STATE_RX);
+      packetCounter = 0;
+    }
+
+    // move up to n bytes of the packet into the fifo, one byte time each;
+    // returns the number of bytes received
+    size_t deliver(size_t n)
+    {
+      size_t count = 0;
+
+      for (; count < n && receiving && airPos < air.size(); count++)
+      {
+        fakeMicros() += byteUs;
+        if (fifo.size() == FIFO_SIZE)
+        {
+          // the radio stops and waits for SFRX
+          overflowed = true;
+          state = STATE_RXFIFO_OVERFLOW;
+          receiving = false;
+          break;
+        }
+        fifo.push_back(air[airPos++]);
+        packetCounter++;
+
+        // GDO2 (IOCFG2 0x00) rises at the RX fifo threshold
+        if (fifo.size() == threshold() && gdo2 != NULL) gdo2();
+
+        // fixed length: the packet ends after PKTLEN bytes, GDO0 (IOCFG0 0x06)
+        // falls and the radio stays in RX (MCSM1)
+        if ((regs[0x08] & 0x03) == 0 && packetCounter == regs[0x06])
+        {
+          receiving = false;
+          if (gdo0 != NULL) gdo0();
+        }
+      }
+      return count;
+    }
+
+    // the rest of the packet that will never be received
+    size_t lost(void) const { return receiving ? 0 : air.size() - airPos; }
+
+    // chip select cycles that started with header
+    size_t countTransactions(uint8_t header) const
+    {
+      size_t n = 0;
+      for (const std::vector<uint8_t> &t : transcript)
+      {
+        if (!t.empty() && t[0] == header) n++;
+      }
+      return n;
+    }
+
+  private:
+    bool selected = false;
+    bool first = true;
+    uint8_t address = 0;
+    bool burst = false;
+    bool read = false;
+
+    size_t threshold(void) const { return ((regs[0x03] & 0x0F) + 1) * 4; }
+
+    void strobe(uint8_t command)
+    {
+      if (command == 0x30)
+      {
+        // SRES, back to the reset state, faults included
+        memset(regs, 0, sizeof(regs));
+        hung = false;
+        ignoreRx = false;
+        fifo.clear();
+        overflowed = false;
+        receiving = false;
+        state = STATE_IDLE;
+        return;
+      }
+      if (hung) return;
+
+      switch (command)
+      {
+        case 0x34:    // SRX
+          if (!ignoreRx && state == STATE_IDLE) state = STATE_RX;
+          break;
+        case 0x36:    // SIDLE
+          state = STATE_IDLE;
+          receiving = false;
+          break;
+        case 0x3A:    // SFRX
+          fifo.clear();
+          overflowed = false;
+          if (state == STATE_RXFIFO_OVERFLOW) state = STATE_IDLE;
+          break;
+      }
+    }
+
+    uint8_t readStatus(uint8_t reg) const
+    {
+      switch (reg)
+      {
+        case 0x31: return 0x14;             // VERSION
+        case 0x32: return (uint8_t)freqEst;
+        case 0x33: return lqi | 0x80;       // CRC_OK
+        case 0x34: return rssi;
+        case 0x35: return state;            // MARCSTATE
+        case 0x3B: return (overflowed ? 0x80 : 0) | (uint8_t)fifo.size();
+      }
+      return 0;
+    }
+};
+
+inline FakeCC1101 &fakeRadio(void)
+{
+  static FakeCC1101 radio;
+  return radio;
+}
+
+#endif // _FAKECC1101_H_
@@ -0,0 +1,29 @@
+/*
+ Copyright (C) 2020 chester4444@wolke7.net
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _FAKE_SPI_H_
+#define _FAKE_SPI_H_
+
+#include <Arduino.h>
+
+// every byte goes to the fake CC1101
+struct FakeSPI
+{
+  void begin(void) {}
+  uint8_t transfer(uint8_t data) { return fakeRadio().transfer(data); }
+};
+static FakeSPI SPI __attribute__((unused));
+
+#endif // _FAKE_SPI_H_
@@ -0,0 +1,32 @@
+/*
+ Copyright (C) 2020 chester4444@wolke7.net
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _FAKE_CREDENTIALS_H_
+#define _FAKE_CREDENTIALS_H_
+
+#include <stdint.h>
+
+// meters of the host tests, whatever src/credentials.h has
+#define NUM_METERS  2
+static const uint8_t meterIds[NUM_METERS][4] =
+  { { 0x12, 0x34, 0x56, 0x78 },
+    { 0x87, 0x65, 0x43, 0x21 }
+  };
+static const uint8_t meterKeys[NUM_METERS][16] =
+  { { 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f },
+    { 0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c }
+  };
+
+#endif // _FAKE_CREDENTIALS_H_
@@ -0,0 +1,54 @@
+/*
+ Copyright (C) 2020 chester4444@wolke7.net
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+// time bases of the benchmarks, on the boards and on the PC
+
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+#include <stdint.h>
+#if defined(ARDUINO)
+  #include <Arduino.h>
+#else
+  #include <chrono>
+  #if defined(__x86_64__) || defined(__i386__)
+    #include <x86intrin.h>
+  #endif
+#endif
+
+inline uint32_t testMicros(void)
+{
+#if defined(ARDUINO)
+  return micros();
+#else
+  return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// cpu cycles, 0 where there is no counter; wraps after a few seconds,
+// so only short loops are measured in cycles
+inline uint32_t testCycles(void)
+{
+#if defined(ARDUINO)
+  return ESP.getCycleCount();
+#elif defined(__x86_64__) || defined(__i386__)
+  return (uint32_t)__rdtsc();
+#else
+  return 0;
+#endif
+}
+
+#endif // _BENCH_H_
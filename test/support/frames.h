@@ -0,0 +1,153 @@
+/*
+ Copyright (C) 2020 chester4444@wolke7.net
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _TEST_FRAMES_H_
+#define _TEST_FRAMES_H_
+
+#include <stdint.h>
+#include <vector>
+#include "Crc16.h"
+
+// wmbus frames as the CC1101 receives them after the sync word
+
+typedef std::vector<uint8_t> Bytes;
+
+// link layer data of a meter: C, M, A (id little endian), CI, then filler
+inline Bytes linkData(uint32_t id, size_t len)
+{
+  Bytes data(len);
+  const uint8_t header[] = { 0x44, 0x2D, 0x2C, (uint8_t)id, (uint8_t)(id >> 8),
+                             (uint8_t)(id >> 16), (uint8_t)(id >> 24), 0x1B, 0x16, 0x8D };
+  for (size_t i = 0; i < len; i++)
+  {
+    data[i] = (i < sizeof(header)) ? header[i] : (uint8_t)(i * 7);
+  }
+  return data;
+}
+
+inline void appendCrc(Bytes &frame, size_t start)
+{
+  uint16_t crc = Crc16::compute(&frame[start], frame.size() - start);
+  frame.push_back(crc >> 8);
+  frame.push_back(crc & 0xFF);
+}
+
+// format A: lfield and 9 bytes, then blocks of 16, each with its crc
+inline Bytes formatA(const Bytes &data)
+{
+  Bytes frame;
+  frame.push_back((uint8_t)data.size());
+  size_t block = 0;
+  size_t start = 0;
+  for (size_t i = 0; i < data.size(); i++)
+  {
+    frame.push_back(data[i]);
+    if (++block == (start == 0 ? 9 : 16) || i + 1 == data.size())
+    {
+      appendCrc(frame, start);
+      start = frame.size();
+      block = 0;
+    }
+  }
+  return frame;
+}
+
+// format B: lfield and up to 125 bytes with one crc, the rest with a second,
+// the lfield counts the crcs
+inline Bytes formatB(const Bytes &data)
+{
+  Bytes frame;
+  size_t first = data.size() < 125 ? data.size() : 125;
+  frame.push_back((uint8_t)(data.size() + (data.size() > first ? 4 : 2)));
+  frame.insert(frame.end(), data.begin(), data.begin() + first);
+  appendCrc(frame, 0);
+  if (data.size() > first)
+  {
+    size_t start = frame.size();
+    frame.insert(frame.end(), data.begin() + first, data.end());
+    appendCrc(frame, start);
+  }
+  return frame;
+}
+
+// mode C1 packets, frame type and the frame
+inline Bytes packetC1A(const Bytes &data)
+{
+  Bytes packet = { 0x54, 0xCD };
+  Bytes frame = formatA(data);
+  packet.insert(packet.end(), frame.begin(), frame.end());
+  return packet;
+}
+
+inline Bytes packetC1B(const Bytes &data)
+{
+  Bytes packet = { 0x54, 0x3D };
+  Bytes frame = formatB(data);
+  packet.insert(packet.end(), frame.begin(), frame.end());
+  return packet;
+}
+
+// mode T1: format A, 3 of 6 coded, an odd length is padded
+inline Bytes encodeThreeOfSix(const Bytes &data)
+{
+  static const uint8_t CODES[16] =
+  {
+    0x16, 0x0D, 0x0E, 0x0B, 0x1C, 0x19, 0x1A, 0x13,
+    0x2C, 0x25, 0x26, 0x23, 0x34, 0x31, 0x32, 0x29,
+  };
+  Bytes coded;
+  uint32_t bits = 0;
+  uint8_t count = 0;
+  for (uint8_t byte : data)
+  {
+    bits = (bits << 12) | (CODES[byte >> 4] << 6) | CODES[byte & 0x0F];
+    count += 12;
+    while (count >= 8)
+    {
+      count -= 8;
+      coded.push_back((uint8_t)(bits >> count));
+    }
+  }
+  if (count > 0)
+  {
+    coded.push_back((uint8_t)(bits << (8 - count)));
+  }
+  return coded;
+}
+
+inline Bytes packetT1(const Bytes &data)
+{
+  return encodeThreeOfSix(formatA(data));
+}
+
+// mode S1: format A, manchester coded, 01 for a one
+inline Bytes packetS1(const Bytes &data)
+{
+  Bytes frame = formatA(data);
+  Bytes coded;
+  for (uint8_t byte : frame)
+  {
+    uint16_t chips = 0;
+    for (int bit = 7; bit >= 0; bit--)
+    {
+      chips = (chips << 2) | (((byte >> bit) & 1) ? 0x1 : 0x2);
+    }
+    coded.push_back(chips >> 8);
+    coded.push_back(chips & 0xFF);
+  }
+  return coded;
+}
+
+#endif // _TEST_FRAMES_H_
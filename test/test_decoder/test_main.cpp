@@ -0,0 +1,449 @@
+/*
+ Copyright (C) 2020 chester4444@wolke7.net
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+// golden frames of each meter profile through the whole decoder: crc,
+// decryption, data records, compact frames and the profile fields; and the
+// reception rate a meter's access numbers give
+
+#include <unity.h>
+#include <limits.h>
+#include <vector>
+#include "WMbusFrame.h"
+#include "frames.h"
+#include "bench.h"
+
+static const uint8_t KEY[16] =
+{
+  0x4e, 0x2f, 0x9a, 0x01, 0x77, 0xc3, 0x58, 0xb6, 0x12, 0xe0, 0x3d, 0x85, 0xaa, 0x64, 0x0b, 0xf1
+};
+
+#define MULTICAL21_ID  0x12345678
+#define FLOWIQ_ID      0x23456789
+#define HEAT_ID        0x34567890
+
+// what the handler got for one frame, the profile fields scaled like published
+struct Reading
+{
+  FrameStatus status;
+  int32_t values[MAX_PROFILE_FIELDS];
+};
+
+static WMBusFrame *decoder;
+static std::vector<Reading> readings;
+
+static void collect(Meter *meter, const DataRecords &records, void *context)
+{
+  Reading reading;
+  reading.status = decoder->status;
+  for (uint8_t i = 0; i < MAX_PROFILE_FIELDS; i++)
+  {
+    reading.values[i] = INT32_MIN;
+    if (i >= meter->profile->fields) continue;
+
+    const ProfileField &field = meter->profile->field[i];
+    const DataRecord *record = findField(records, field);
+    if (record != NULL) reading.values[i] = record->scaled(field.exponent);
+  }
+  readings.push_back(reading);
+}
+
+void setUp(void)
+{
+  decoder = new WMBusFrame();
+  decoder->onRecords(collect);
+  readings.clear();
+}
+
+void tearDown(void)
+{
+  delete decoder;
+}
+
+static Meter meterOf(uint32_t id)
+{
+  Meter meter;
+  memset(&meter, 0, sizeof(meter));
+  meter.id = id;
+  meter.key = KEY;
+  return meter;
+}
+
+// the payload after the lfield: link layer, ELL and the AES-CTR encrypted
+// application layer, which starts with its crc and the CI field
+static Bytes encryptedFrame(uint32_t id, uint8_t version, uint8_t type, uint8_t accessNo,
+                            uint8_t ci, const Bytes &application)
+{
+  Bytes frame = { 0x44, 0x2D, 0x2C, (uint8_t)id, (uint8_t)(id >> 8), (uint8_t)(id >> 16), (uint8_t)(id >> 24),
+                  version, type, 0x8D, 0x20, accessNo, 0x21, 0x43, 0x65, 0x07 };
+
+  Bytes plain = { 0, 0, ci };
+  plain.insert(plain.end(), application.begin(), application.end());
+  uint16_t crc = Crc16::compute(&plain[2], plain.size() - 2);
+  plain[0] = crc & 0xFF;
+  plain[1] = crc >> 8;
+
+  // M, A, CC, SN
+  uint8_t iv[16] = {};
+  memcpy(iv, &frame[1], 8);
+  iv[8] = frame[10];
+  memcpy(&iv[9], &frame[12], 4);
+
+  Aes128 aes;
+  aes.setKey(KEY);
+  size_t start = frame.size();
+  frame.resize(start + plain.size());
+  aes.ctrCrypt(iv, &plain[0], &frame[start], plain.size());
+  return frame;
+}
+
+// compact frame of the same records: format signature, crc of the values
+static Bytes compactOf(const Bytes &records, const Bytes &values)
+{
+  DataRecords parsed;
+  TEST_ASSERT_TRUE(parsed.parse(&records[0], records.size()));
+
+  uint16_t crc = Crc16::compute(&values[0], values.size());
+  Bytes application = { (uint8_t)parsed.signature, (uint8_t)(parsed.signature >> 8),
+                        (uint8_t)crc, (uint8_t)(crc >> 8) };
+  application.insert(application.end(), values.begin(), values.end());
+  return application;
+}
+
+static void decode(Meter &meter, Bytes frame)
+{
+  decoder->decode(&meter, &frame[0], frame.size());
+}
+
+// Multical21: volume 12.345 m3, at month start 11.000 m3, 15 C water, 20 C room
+static const Bytes MULTICAL21_RECORDS =
+  { 0x04, 0x13, 0x39, 0x30, 0x00, 0x00,  0x44, 0x13, 0xF8, 0x2A, 0x00, 0x00,  0x01, 0x5B, 0x0F,  0x01, 0x67, 0x14 };
+static const Bytes MULTICAL21_VALUES =
+  { 0x3A, 0x30, 0x00, 0x00,  0xF8, 0x2A, 0x00, 0x00,  0x10,  0x13 };
+
+static void test_multical21_long_frame(void)
+{
+  Meter meter = meterOf(MULTICAL21_ID);
+  decode(meter, encryptedFrame(MULTICAL21_ID, 0x1B, 0x16, 1, 0x78, MULTICAL21_RECORDS));
+
+  TEST_ASSERT_EQUAL(FrameOk, decoder->status);
+  TEST_ASSERT_EQUAL_STRING("multical21", meter.profile->name);
+  TEST_ASSERT_EQUAL(1, meter.lastAccessNo);
+  TEST_ASSERT_EQUAL(1, readings.size());
+  TEST_ASSERT_EQUAL(12345, readings[0].values[0]);
+  TEST_ASSERT_EQUAL(11000, readings[0].values[1]);
+  TEST_ASSERT_EQUAL(15, readings[0].values[2]);
+  TEST_ASSERT_EQUAL(20, readings[0].values[3]);
+}
+
+// the long frame above with access number 42 as it is received, checked
+// against openssl enc -aes-128-ctr
+static const uint8_t GOLDEN_MULTICAL21[] =
+{
+  0x44, 0x2D, 0x2C, 0x78, 0x56, 0x34, 0x12, 0x1B, 0x16, 0x8D, 0x20, 0x2A, 0x21, 0x43, 0x65, 0x07,
+  0x8A, 0x54, 0xFD, 0xA6, 0x80, 0x34, 0xB6, 0xFD, 0xBE, 0x93, 0xC1, 0x97, 0xD3, 0x71, 0x28, 0x00,
+  0x85, 0xF5, 0x66, 0xA4, 0x57,
+};
+
+static void test_multical21_golden_frame(void)
+{
+  Meter meter = meterOf(MULTICAL21_ID);
+  decode(meter, Bytes(GOLDEN_MULTICAL21, GOLDEN_MULTICAL21 + sizeof(GOLDEN_MULTICAL21)));
+
+  TEST_ASSERT_EQUAL(FrameOk, decoder->status);
+  TEST_ASSERT_EQUAL(42, meter.lastAccessNo);
+  TEST_ASSERT_EQUAL(1, readings.size());
+  TEST_ASSERT_EQUAL(12345, readings[0].values[0]);
+  TEST_ASSERT_EQUAL(20, readings[0].values[3]);
+}
+
+static void test_multical21_compact_frame(void)
+{
+  // the layout is learned from the long frame
+  Meter meter = meterOf(MULTICAL21_ID);
+  decode(meter, encryptedFrame(MULTICAL21_ID, 0x1B, 0x16, 1, 0x78, MULTICAL21_RECORDS));
+  decode(meter, encryptedFrame(MULTICAL21_ID, 0x1B, 0x16, 2, 0x79, compactOf(MULTICAL21_RECORDS, MULTICAL21_VALUES)));
+
+  TEST_ASSERT_EQUAL(FrameOk, decoder->status);
+  TEST_ASSERT_EQUAL(2, readings.size());
+  TEST_ASSERT_EQUAL(12346, readings[1].values[0]);
+  TEST_ASSERT_EQUAL(11000, readings[1].values[1]);
+  TEST_ASSERT_EQUAL(16, readings[1].values[2]);
+  TEST_ASSERT_EQUAL(19, readings[1].values[3]);
+  TEST_ASSERT_EQUAL(1, decoder->getFormatStatistics().hits);
+}
+
+static void test_compact_frame_held_until_long_frame(void)
+{
+  Meter meter = meterOf(MULTICAL21_ID);
+  decode(meter, encryptedFrame(MULTICAL21_ID, 0x1B, 0x16, 1, 0x79, compactOf(MULTICAL21_RECORDS, MULTICAL21_VALUES)));
+  TEST_ASSERT_EQUAL(FrameHeld, decoder->status);
+  TEST_ASSERT_EQUAL(0, readings.size());
+
+  // the older compact frame is reported first
+  decode(meter, encryptedFrame(MULTICAL21_ID, 0x1B, 0x16, 2, 0x78, MULTICAL21_RECORDS));
+  TEST_ASSERT_EQUAL(2, readings.size());
+  TEST_ASSERT_EQUAL(FrameHeld, readings[0].status);
+  TEST_ASSERT_EQUAL(12346, readings[0].values[0]);
+  TEST_ASSERT_EQUAL(FrameOk, readings[1].status);
+  TEST_ASSERT_EQUAL(12345, readings[1].values[0]);
+}
+
+static void test_held_frame_released_by_compact_frame(void)
+{
+  // the layout is not known yet when the first meter's compact frame comes
+  Meter first = meterOf(MULTICAL21_ID);
+  Meter second = meterOf(MULTICAL21_ID + 1);
+  decode(first, encryptedFrame(MULTICAL21_ID, 0x1B, 0x16, 1, 0x79, compactOf(MULTICAL21_RECORDS, MULTICAL21_VALUES)));
+  TEST_ASSERT_EQUAL(FrameHeld, decoder->status);
+
+  // another meter of the type tells it
+  decode(second, encryptedFrame(MULTICAL21_ID + 1, 0x1B, 0x16, 1, 0x78, MULTICAL21_RECORDS));
+  TEST_ASSERT_EQUAL(1, readings.size());
+
+  // the newer compact frame comes after the held one, not before
+  Bytes newer = MULTICAL21_VALUES;
+  newer[0] = 0x40;
+  decode(first, encryptedFrame(MULTICAL21_ID, 0x1B, 0x16, 2, 0x79, compactOf(MULTICAL21_RECORDS, newer)));
+  TEST_ASSERT_EQUAL(FrameOk, decoder->status);
+  TEST_ASSERT_EQUAL(3, readings.size());
+  TEST_ASSERT_EQUAL(FrameHeld, readings[1].status);
+  TEST_ASSERT_EQUAL(12346, readings[1].values[0]);
+  TEST_ASSERT_EQUAL(FrameOk, readings[2].status);
+  TEST_ASSERT_EQUAL(12352, readings[2].values[0]);
+
+  // and is not reported again by the long frame
+  decode(first, encryptedFrame(MULTICAL21_ID, 0x1B, 0x16, 3, 0x78, MULTICAL21_RECORDS));
+  TEST_ASSERT_EQUAL(4, readings.size());
+  TEST_ASSERT_EQUAL(FrameOk, readings[3].status);
+}
+
+static void test_flowiq_long_frame(void)
+{
+  // as the Multical21, plus a max. flow of 1.234 m3/h
+  Bytes records = MULTICAL21_RECORDS;
+  const Bytes maxFlow = { 0x13, 0x3B, 0xD2, 0x04, 0x00 };
+  records.insert(records.end(), maxFlow.begin(), maxFlow.end());
+
+  Meter meter = meterOf(FLOWIQ_ID);
+  decode(meter, encryptedFrame(FLOWIQ_ID, 0x1D, 0x16, 7, 0x78, records));
+
+  TEST_ASSERT_EQUAL(FrameOk, decoder->status);
+  TEST_ASSERT_EQUAL_STRING("flowiq", meter.profile->name);
+  TEST_ASSERT_EQUAL(1, readings.size());
+  TEST_ASSERT_EQUAL(12345, readings[0].values[0]);
+  TEST_ASSERT_EQUAL(1234, readings[0].values[4]);
+}
+
+static void test_multical_heat_long_frame(void)
+{
+  // 5000 kWh, 25.00 m3, 4800 kWh at month start, 65.43 C flow, 40.12 C return, 3.5 kW
+  const Bytes records =
+    { 0x04, 0x06, 0x88, 0x13, 0x00, 0x00,  0x04, 0x14, 0xC4, 0x09, 0x00, 0x00,
+      0x44, 0x06, 0xC0, 0x12, 0x00, 0x00,  0x02, 0x59, 0x8F, 0x19,
+      0x02, 0x5D, 0xAC, 0x0F,  0x02, 0x2D, 0x23, 0x00 };
+
+  Meter meter = meterOf(HEAT_ID);
+  decode(meter, encryptedFrame(HEAT_ID, 0x34, 0x04, 3, 0x78, records));
+
+  TEST_ASSERT_EQUAL(FrameOk, decoder->status);
+  TEST_ASSERT_EQUAL_STRING("multical302/403", meter.profile->name);
+  TEST_ASSERT_EQUAL(1, readings.size());
+  TEST_ASSERT_EQUAL(5000, readings[0].values[0]);
+  TEST_ASSERT_EQUAL(2500, readings[0].values[1]);
+  TEST_ASSERT_EQUAL(4800, readings[0].values[2]);
+  TEST_ASSERT_EQUAL(6543, readings[0].values[3]);
+  TEST_ASSERT_EQUAL(4012, readings[0].values[4]);
+  TEST_ASSERT_EQUAL(35, readings[0].values[5]);
+}
+
+static void test_wrong_key_is_rejected(void)
+{
+  Meter meter = meterOf(MULTICAL21_ID);
+  static const uint8_t OTHER_KEY[16] = { 1 };
+  meter.key = OTHER_KEY;
+  decode(meter, encryptedFrame(MULTICAL21_ID, 0x1B, 0x16, 1, 0x78, MULTICAL21_RECORDS));
+
+  TEST_ASSERT_NOT_EQUAL(FrameOk, decoder->status);
+  TEST_ASSERT_EQUAL(0, readings.size());
+}
+
+// a cipher of one or two bytes has no room for the crc and the CI field
+static void test_short_cipher_is_rejected(void)
+{
+  Meter meter = meterOf(MULTICAL21_ID);
+  Bytes frame = encryptedFrame(MULTICAL21_ID, 0x1B, 0x16, 1, 0x78, MULTICAL21_RECORDS);
+
+  for (size_t length = 16; length <= 18; length++)
+  {
+    Bytes shortFrame(frame.begin(), frame.begin() + length);
+    decode(meter, shortFrame);
+    TEST_ASSERT_EQUAL(FrameTooShort, decoder->status);
+    TEST_ASSERT_FALSE(decoder->isValid);
+  }
+
+  // three bytes are decrypted and checked
+  Bytes shortFrame(frame.begin(), frame.begin() + 19);
+  decode(meter, shortFrame);
+  TEST_ASSERT_NOT_EQUAL(FrameTooShort, decoder->status);
+  TEST_ASSERT_EQUAL(0, readings.size());
+}
+
+// a slot per meter: each key is expanded once; fewer slots than meters
+// heard in turn: every frame expands a key
+static void test_expanded_keys_are_kept(void)
+{
+  Meter meters[3] = { meterOf(MULTICAL21_ID), meterOf(FLOWIQ_ID), meterOf(HEAT_ID) };
+  CipherSlot slots[2];
+  decoder->useCiphers(slots, 2);
+
+  for (uint8_t i = 0; i < 10; i++)
+  {
+    decode(meters[i % 2], encryptedFrame(meters[i % 2].id, 0x1B, 0x16, i, 0x78, MULTICAL21_RECORDS));
+    TEST_ASSERT_EQUAL(FrameOk, decoder->status);
+  }
+  TEST_ASSERT_EQUAL(2, decoder->getCipherStatistics().expansions);
+  TEST_ASSERT_EQUAL(8, decoder->getCipherStatistics().hits);
+
+  for (uint8_t i = 0; i < 9; i++)
+  {
+    decode(meters[i % 3], encryptedFrame(meters[i % 3].id, 0x1B, 0x16, 10 + i, 0x78, MULTICAL21_RECORDS));
+    TEST_ASSERT_EQUAL(FrameOk, decoder->status);
+  }
+  // the first two meters' keys were still there once, then the lru
+  // always dropped the key needed next
+  TEST_ASSERT_EQUAL(2 + 7, decoder->getCipherStatistics().expansions);
+  TEST_ASSERT_EQUAL(8 + 2, decoder->getCipherStatistics().hits);
+
+  // no slots, one expansion per frame
+  WMBusFrame plain;
+  Bytes frame = encryptedFrame(meters[0].id, 0x1B, 0x16, 1, 0x78, MULTICAL21_RECORDS);
+  plain.decode(&meters[0], &frame[0], frame.size());
+  frame = encryptedFrame(meters[0].id, 0x1B, 0x16, 2, 0x78, MULTICAL21_RECORDS);
+  plain.decode(&meters[0], &frame[0], frame.size());
+  TEST_ASSERT_EQUAL(2, plain.getCipherStatistics().expansions);
+  TEST_ASSERT_EQUAL(0, plain.getCipherStatistics().hits);
+}
+
+// a Multical21 long frame through check, decrypt, crc, records and handler:
+// a decoder per frame that expands the key, like before, against the
+// long-lived decoder with the key kept in a slot
+static void test_decode_benchmark(void)
+{
+  Meter meter = meterOf(MULTICAL21_ID);
+  const Bytes frame = encryptedFrame(MULTICAL21_ID, 0x1B, 0x16, 1, 0x78, MULTICAL21_RECORDS);
+  const uint32_t rounds = 20000;
+  uint8_t buffer[WMBusFrame::MAX_LENGTH];
+
+  // decrypted in place, each round gets a fresh copy
+  uint32_t startUs = testMicros();
+  uint32_t startCycles = testCycles();
+  for (uint32_t i = 0; i < rounds; i++)
+  {
+    WMBusFrame fresh;
+    memcpy(buffer, &frame[0], frame.size());
+    fresh.decode(&meter, buffer, frame.size());
+  }
+  uint32_t freshCycles = testCycles() - startCycles;
+  uint32_t freshUs = testMicros() - startUs;
+
+  CipherSlot slots[1];
+  decoder->useCiphers(slots, 1);
+  decoder->onRecords(NULL);
+  startUs = testMicros();
+  startCycles = testCycles();
+  for (uint32_t i = 0; i < rounds; i++)
+  {
+    memcpy(buffer, &frame[0], frame.size());
+    decoder->decode(&meter, buffer, frame.size());
+  }
+  uint32_t keptCycles = testCycles() - startCycles;
+  uint32_t keptUs = testMicros() - startUs;
+  TEST_ASSERT_EQUAL(FrameOk, decoder->status);
+  TEST_ASSERT_EQUAL(1, decoder->getCipherStatistics().expansions);
+
+  char message[160];
+  snprintf(message, sizeof(message), "%u byte frame: %u cycles (%u ns) with a decoder per frame, "
+           "%u cycles (%u ns) with the key kept",
+           (unsigned int)frame.size(), freshCycles / rounds, (unsigned int)((uint64_t)freshUs * 1000 / rounds),
+           keptCycles / rounds, (unsigned int)((uint64_t)keptUs * 1000 / rounds));
+  TEST_MESSAGE(message);
+}
+
+static void test_link_counts_access_number_gaps(void)
+{
+  LinkStats link = {};
+
+  link.update(-70, 10, 2, 10);
+  TEST_ASSERT_EQUAL(1, link.received);
+  TEST_ASSERT_EQUAL(0, link.missed);
+  TEST_ASSERT_EQUAL(100, link.receptionRate());
+
+  // 12 and 13 never arrived, 11 came twice
+  link.update(-70, 10, 2, 11);
+  link.update(-70, 10, 2, 11);
+  link.update(-70, 10, 2, 14);
+  TEST_ASSERT_EQUAL(3, link.received);
+  TEST_ASSERT_EQUAL(2, link.missed);
+  TEST_ASSERT_EQUAL(60, link.receptionRate());
+
+  // the 8 bit access number wraps
+  link.accessNo = 254;
+  link.update(-70, 10, 2, 1);
+  TEST_ASSERT_EQUAL(4, link.received);
+  TEST_ASSERT_EQUAL(4, link.missed);
+  TEST_ASSERT_EQUAL(50, link.receptionRate());
+}
+
+static void test_link_averages(void)
+{
+  LinkStats link = {};
+  TEST_ASSERT_EQUAL(0, link.receptionRate());
+
+  // the first frame starts the averages, x16
+  link.update(-80, 20, -3, 1);
+  TEST_ASSERT_EQUAL(-80 * 16, link.rssi);
+  TEST_ASSERT_EQUAL(20 * 16, link.lqi);
+  TEST_ASSERT_EQUAL(-3 * 16, link.freqOffset);
+
+  // the later ones move them towards theirs
+  for (uint8_t accessNo = 2; accessNo < 200; accessNo++)
+  {
+    link.update(-60, 20, -3, accessNo);
+  }
+  TEST_ASSERT_GREATER_THAN(-61 * 16, link.rssi);
+  TEST_ASSERT_LESS_OR_EQUAL(-60 * 16, link.rssi);
+  TEST_ASSERT_EQUAL(20 * 16, link.lqi);
+  TEST_ASSERT_EQUAL(100, link.receptionRate());
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_multical21_long_frame);
+  RUN_TEST(test_multical21_golden_frame);
+  RUN_TEST(test_multical21_compact_frame);
+  RUN_TEST(test_compact_frame_held_until_long_frame);
+  RUN_TEST(test_held_frame_released_by_compact_frame);
+  RUN_TEST(test_flowiq_long_frame);
+  RUN_TEST(test_multical_heat_long_frame);
+  RUN_TEST(test_wrong_key_is_rejected);
+  RUN_TEST(test_short_cipher_is_rejected);
+  RUN_TEST(test_expanded_keys_are_kept);
+  RUN_TEST(test_decode_benchmark);
+  RUN_TEST(test_link_counts_access_number_gaps);
+  RUN_TEST(test_link_averages);
+  return UNITY_END();
+}
@@ -0,0 +1,351 @@
+/*
+ Copyright (C) 2020 chester4444@wolke7.net
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+// MqttTransport against a fake AsyncMqttClient, the test is the broker;
+// every heap allocation is counted, publishing and reconnecting must not
+// make any in the transport; the fake client allocates nothing per publish,
+// the real one does (see MqttTransport.h)
+
+#include <stdlib.h>
+#include <new>
+#include <vector>
+#include <unity.h>
+#include "MqttTransport.h"
+#include "Meter.h"
+#include "JsonWriter.h"
+
+// the soak tests compare this before and after, noinline keeps gcc from
+// pairing the inlined malloc and free with new and delete
+static size_t allocations = 0;
+
+__attribute__((noinline)) void *operator new(size_t size)
+{
+  allocations++;
+  void *p = malloc(size);
+  if (p == NULL) throw std::bad_alloc();
+  return p;
+}
+
+__attribute__((noinline)) void operator delete(void *p) noexcept
+{
+  free(p);
+}
+
+__attribute__((noinline)) void operator delete(void *p, size_t size) noexcept
+{
+  free(p);
+}
+
+static MqttTransport *mqtt;
+
+static AsyncMqttClient &broker(void)
+{
+  return *fakeMqtt();
+}
+
+void setUp(void)
+{
+  mqtt = new MqttTransport();
+  mqtt->begin("broker", 1883, "test", "user", "pass", "watermeter/0/online", "False");
+}
+
+void tearDown(void)
+{
+  delete mqtt;
+}
+
+static void connect(void)
+{
+  mqtt->service();
+  broker().acceptConnect();
+  mqtt->service();
+  TEST_ASSERT_TRUE(mqtt->connected());
+}
+
+// a reading as the firmware publishes it: topic and json on the stack
+static bool publishReading(const Meter &meter, int32_t value)
+{
+  char topic[MQTT_TOPIC_LENGTH];
+  meterTopic(topic, sizeof(topic), meter, "sensor/mydatajson");
+
+  char json[160];
+  char number[FIXED_TEXT_LENGTH];
+  JsonWriter writer(json, sizeof(json));
+  writer.beginObject();
+  JsonWriter::formatFixed(number, value, 3);
+  writer.addNumber("CurrentValue", number);
+  JsonWriter::formatFixed(number, 21, 0);
+  writer.addNumber("WaterTemp", number);
+  writer.endObject();
+
+  return writer.ok() && mqtt->publish(topic, writer.c_str(), writer.getLength(), 1, true);
+}
+
+static Meter testMeter(void)
+{
+  Meter meter;
+  memset(&meter, 0, sizeof(meter));
+  meter.id = 0x12345678;
+  strcpy(meter.name, "12345678");
+  return meter;
+}
+
+static void test_publish_soak_does_not_allocate(void)
+{
+  Meter meter = testMeter();
+  connect();
+
+  // the counter works, the client's callback lists were allocated
+  TEST_ASSERT_GREATER_THAN(0, allocations);
+
+  size_t before = allocations;
+  for (int32_t i = 0; i < 10000; i++)
+  {
+    TEST_ASSERT_TRUE(publishReading(meter, 12345 + i));
+    mqtt->service();
+    broker().ack(broker().last().packetId);
+    mqtt->service();
+  }
+
+  TEST_ASSERT_EQUAL(0, allocations - before);
+  TEST_ASSERT_EQUAL(10000, mqtt->getStatistics().acks);
+  TEST_ASSERT_EQUAL(0, mqtt->getQueueDepth());
+  TEST_ASSERT_EQUAL_STRING("watermeter/12345678/sensor/mydatajson", broker().last().topic);
+}
+
+static void test_full_queue_soak_does_not_allocate(void)
+{
+  // a slow broker: the queue fills up, publishes are refused, acks come late
+  Meter meter = testMeter();
+  connect();
+
+  size_t before = allocations;
+  uint32_t accepted = 0;
+  for (int32_t round = 0; round < 1000; round++)
+  {
+    for (int32_t i = 0; i < MQTT_QUEUE_SIZE + 2; i++)
+    {
+      if (publishReading(meter, i)) accepted++;
+      mqtt->service();
+    }
+    // the window is sent, ack it
+    for (uint32_t back = 0; back < MQTT_INFLIGHT_WINDOW; back++)
+    {
+      broker().ack(broker().last(back).packetId);
+    }
+    mqtt->service();
+  }
+
+  TEST_ASSERT_EQUAL(0, allocations - before);
+  TEST_ASSERT_GREATER_THAN(0, mqtt->getStatistics().drops);
+  TEST_ASSERT_EQUAL(accepted, mqtt->getStatistics().queued);
+  TEST_ASSERT_LESS_OR_EQUAL(MQTT_QUEUE_SIZE, mqtt->getStatistics().maxDepth);
+}
+
+// the broker is gone for longer than any backoff
+static void reconnectLater(void)
+{
+  delay(MQTT_BACKOFF_MAX_MS + 1000);
+  mqtt->service();
+  broker().acceptConnect();
+  mqtt->service();
+}
+
+static void test_reconnect_soak_registers_callbacks_once(void)
+{
+  Meter meter = testMeter();
+  connect();
+
+  size_t before = allocations;
+  for (int32_t i = 0; i < 1000; i++)
+  {
+    // WiFi came back, the firmware calls begin() again
+    mqtt->begin("broker", 1883, "test", "user", "pass", "watermeter/0/online", "False");
+    reconnectLater();
+
+    TEST_ASSERT_TRUE(publishReading(meter, i));
+    mqtt->service();
+    broker().ack(broker().last().packetId);
+    mqtt->service();
+
+    broker().dropConnection();
+    mqtt->service();
+  }
+
+  TEST_ASSERT_EQUAL(1, broker().connectCallbacks.size());
+  TEST_ASSERT_EQUAL(1, broker().disconnectCallbacks.size());
+  TEST_ASSERT_EQUAL(1, broker().publishCallbacks.size());
+  TEST_ASSERT_EQUAL(1, broker().messageCallbacks.size());
+
+  // one ack per PUBACK, nothing grew
+  TEST_ASSERT_EQUAL(1000, mqtt->getStatistics().acks);
+  TEST_ASSERT_EQUAL(1001, mqtt->getStatistics().connects);
+  TEST_ASSERT_EQUAL(1000, mqtt->getStatistics().failures);
+  TEST_ASSERT_EQUAL(0, allocations - before);
+}
+
+static void test_unacked_message_is_resent_with_dup(void)
+{
+  Meter meter = testMeter();
+  connect();
+
+  TEST_ASSERT_TRUE(publishReading(meter, 1));
+  mqtt->service();
+  TEST_ASSERT_FALSE(broker().last().dup);
+  uint32_t published = broker().publishes;
+
+  // lost before the PUBACK
+  broker().dropConnection();
+  mqtt->service();
+  TEST_ASSERT_EQUAL(1, mqtt->getQueueDepth());
+
+  reconnectLater();
+  TEST_ASSERT_EQUAL(published + 1, broker().publishes);
+  TEST_ASSERT_TRUE(broker().last().dup);
+  TEST_ASSERT_EQUAL(1, broker().last().qos);
+
+  broker().ack(broker().last().packetId);
+  mqtt->service();
+  TEST_ASSERT_EQUAL(0, mqtt->getQueueDepth());
+  TEST_ASSERT_EQUAL(1, mqtt->getStatistics().resends);
+  TEST_ASSERT_EQUAL(1, mqtt->getStatistics().acks);
+}
+
+static void test_connect_without_answer_backs_off(void)
+{
+  mqtt->service();
+  TEST_ASSERT_EQUAL(1, broker().connectCalls);
+
+  // no CONNACK, give up and wait
+  delay(MQTT_CONNECT_TIMEOUT_MS + 1);
+  mqtt->service();
+  TEST_ASSERT_EQUAL(1, mqtt->getStatistics().failures);
+  mqtt->service();
+  TEST_ASSERT_EQUAL(1, broker().connectCalls);
+
+  delay(MQTT_BACKOFF_MIN_MS);
+  mqtt->service();
+  TEST_ASSERT_EQUAL(2, broker().connectCalls);
+}
+
+// the radio runs on every tick of main.cpp, it has RADIO_DEADLINE_MS
+#define RADIO_DEADLINE_US  5000
+#define TICK_US            200     // the other tasks of a tick
+#define PUBLISH_COST_US    1500    // a slow publish of the real client
+
+// micros() as the board has it, 32 bit
+static uint32_t usNow(void)
+{
+  return (uint32_t)micros();
+}
+
+// a minute of scheduler ticks with a reading every 100 ms, the broker
+// stops acking for 30 s; returns the longest time the radio had to wait
+static uint32_t stalledBrokerGap(void)
+{
+  Meter meter = testMeter();
+  connect();
+  broker().publishCostUs = PUBLISH_COST_US;
+
+  std::vector<uint16_t> unacked;
+  uint32_t start = usNow();
+  uint32_t lastRadio = start;
+  uint32_t lastReading = start;
+  uint32_t maxGap = 0;
+  int32_t value = 0;
+
+  while (usNow() - start < 60000000UL)
+  {
+    // radio task
+    uint32_t gap = usNow() - lastRadio;
+    if (gap > maxGap) maxGap = gap;
+    lastRadio = usNow();
+
+    // decode task
+    if (usNow() - lastReading >= 100000)
+    {
+      lastReading = usNow();
+      publishReading(meter, value++);
+    }
+
+    // mqtt task, the broker acks what it got after the stall
+    uint32_t published = broker().publishes;
+    mqtt->service();
+    for (uint32_t back = broker().publishes - published; back > 0; back--)
+    {
+      unacked.push_back(broker().last(back - 1).packetId);
+    }
+    bool stalled = usNow() - start > 10000000UL && usNow() - start < 40000000UL;
+    if (!stalled)
+    {
+      for (uint16_t packetId : unacked) broker().ack(packetId);
+      unacked.clear();
+    }
+
+    delayMicroseconds(TICK_US);
+  }
+  broker().publishCostUs = 0;
+  return maxGap;
+}
+
+static void test_stalled_broker_keeps_radio_gap_short(void)
+{
+  uint32_t maxGap = stalledBrokerGap();
+
+  // the window was full, later readings were refused, not waited for;
+  // the queue drained once the acks came again
+  TEST_ASSERT_GREATER_THAN(0, mqtt->getStatistics().drops);
+  TEST_ASSERT_LESS_OR_EQUAL(1, mqtt->getQueueDepth());
+
+  // one slow publish per tick at most
+  TEST_ASSERT_LESS_OR_EQUAL(TICK_US + MQTT_SENDS_PER_SERVICE * PUBLISH_COST_US, maxGap);
+  TEST_ASSERT_LESS_THAN(RADIO_DEADLINE_US, maxGap);
+
+  char message[96];
+  snprintf(message, sizeof(message), "%u us longest radio gap, %u us per publish, %u refused",
+           (unsigned int)maxGap, PUBLISH_COST_US, (unsigned int)mqtt->getStatistics().drops);
+  TEST_MESSAGE(message);
+}
+
+static int messagesReceived = 0;
+
+static void countMessage(const char *topic, const char *payload, size_t len)
+{
+  messagesReceived++;
+}
+
+static void test_message_handler_called_once(void)
+{
+  mqtt->onMessage(countMessage);
+  connect();
+  mqtt->begin("broker", 1883, "test", "user", "pass", "watermeter/0/online", "False");
+
+  messagesReceived = 0;
+  broker().deliver("watermeter/0/radioProfile", "S1");
+  TEST_ASSERT_EQUAL(1, messagesReceived);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_publish_soak_does_not_allocate);
+  RUN_TEST(test_full_queue_soak_does_not_allocate);
+  RUN_TEST(test_reconnect_soak_registers_callbacks_once);
+  RUN_TEST(test_unacked_message_is_resent_with_dup);
+  RUN_TEST(test_connect_without_answer_backs_off);
+  RUN_TEST(test_stalled_broker_keeps_radio_gap_short);
+  RUN_TEST(test_message_handler_called_once);
+  return UNITY_END();
+}
@@ -0,0 +1,154 @@
+/*
+ Copyright (C) 2020 chester4444@wolke7.net
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+// known answers of the selected AES backend: FIPS-197 C.1 for the block
+// cipher, NIST SP 800-38A F.5.1 for CTR mode; and its speed
+
+#include <stdio.h>
+#include <unity.h>
+#include "AesBackend.h"
+#include "tests.h"
+
+static const uint8_t FIPS_KEY[16] =
+{
+  0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f
+};
+static const uint8_t FIPS_PLAIN[16] =
+{
+  0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff
+};
+static const uint8_t FIPS_CIPHER[16] =
+{
+  0x69, 0xc4, 0xe0, 0xd8, 0x6a, 0x7b, 0x04, 0x30, 0xd8, 0xcd, 0xb7, 0x80, 0x70, 0xb4, 0xc5, 0x5a
+};
+
+static const uint8_t CTR_KEY[16] =
+{
+  0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c
+};
+static const uint8_t CTR_IV[16] =
+{
+  0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff
+};
+static const uint8_t CTR_PLAIN[64] =
+{
+  0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96, 0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a,
+  0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c, 0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51,
+  0x30, 0xc8, 0x1c, 0x46, 0xa3, 0x5c, 0xe4, 0x11, 0xe5, 0xfb, 0xc1, 0x19, 0x1a, 0x0a, 0x52, 0xef,
+  0xf6, 0x9f, 0x24, 0x45, 0xdf, 0x4f, 0x9b, 0x17, 0xad, 0x2b, 0x41, 0x7b, 0xe6, 0x6c, 0x37, 0x10
+};
+static const uint8_t CTR_CIPHER[64] =
+{
+  0x87, 0x4d, 0x61, 0x91, 0xb6, 0x20, 0xe3, 0x26, 0x1b, 0xef, 0x68, 0x64, 0x99, 0x0d, 0xb6, 0xce,
+  0x98, 0x06, 0xf6, 0x6b, 0x79, 0x70, 0xfd, 0xff, 0x86, 0x17, 0x18, 0x7b, 0xb9, 0xff, 0xfd, 0xff,
+  0x5a, 0xe4, 0xdf, 0x3e, 0xdb, 0xd5, 0xd3, 0x5e, 0x5b, 0x4f, 0x09, 0x02, 0x0d, 0xb0, 0x3e, 0xab,
+  0x1e, 0x03, 0x1d, 0xda, 0x2f, 0xbe, 0x03, 0xd1, 0x79, 0x21, 0x70, 0xa0, 0xf3, 0x00, 0x9c, 0xee
+};
+
+static void test_aes_block(void)
+{
+  Aes128 aes;
+  uint8_t output[16];
+
+  aes.setKey(FIPS_KEY);
+  aes.encryptBlock(output, FIPS_PLAIN);
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(FIPS_CIPHER, output, 16);
+}
+
+static void test_aes_ctr(void)
+{
+  Aes128 aes;
+  uint8_t output[64];
+
+  aes.setKey(CTR_KEY);
+  aes.ctrCrypt(CTR_IV, CTR_PLAIN, output, sizeof(output));
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(CTR_CIPHER, output, 64);
+
+  // CTR decrypts with the same operation
+  aes.ctrCrypt(CTR_IV, CTR_CIPHER, output, sizeof(output));
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(CTR_PLAIN, output, 64);
+}
+
+static void test_aes_ctr_in_place_partial_block(void)
+{
+  // the decoder decrypts in place, wM-Bus payloads end in a partial block
+  Aes128 aes;
+  uint8_t data[64];
+
+  memcpy(data, CTR_CIPHER, sizeof(data));
+  aes.setKey(CTR_KEY);
+  aes.ctrCrypt(CTR_IV, data, data, 37);
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(CTR_PLAIN, data, 37);
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(CTR_CIPHER + 37, data + 37, 64 - 37);
+}
+
+static void test_aes_rekey(void)
+{
+  // a cipher slot is reused for another meter
+  Aes128 aes;
+  uint8_t output[16];
+
+  aes.setKey(FIPS_KEY);
+  aes.setKey(CTR_KEY);
+  aes.ctrCrypt(CTR_IV, CTR_PLAIN, output, sizeof(output));
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(CTR_CIPHER, output, 16);
+}
+
+#if defined(AES_BACKEND_HW)
+  #define AES_BACKEND_NAME "hw"
+#elif defined(AES_BACKEND_SMALL)
+  #define AES_BACKEND_NAME "small"
+#else
+  #define AES_BACKEND_NAME "table"
+#endif
+
+// bytes per cycle of CTR decryption, for a compact frame and the longest
+// one, and the cycles of a key setup; run it in each backend's env
+static void test_aes_benchmark(void)
+{
+  static uint8_t buffer[240];
+  static const size_t lengths[] = { 32, sizeof(buffer) };
+  const uint32_t rounds = 2000;
+  Aes128 aes;
+  char message[128];
+
+  uint32_t start = testCycles();
+  for (uint32_t i = 0; i < rounds; i++) aes.setKey(CTR_KEY);
+  uint32_t keyCycles = testCycles() - start;
+
+  for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++)
+  {
+    size_t len = lengths[l];
+    uint32_t startUs = testMicros();
+    start = testCycles();
+    for (uint32_t i = 0; i < rounds; i++) aes.ctrCrypt(CTR_IV, buffer, buffer, len);
+    uint32_t cycles = testCycles() - start;
+    uint32_t us = testMicros() - startUs;
+
+    snprintf(message, sizeof(message), "%s, %u bytes: %.3f bytes/cycle, %.1f bytes/us, key setup %u cycles",
+             AES_BACKEND_NAME, (unsigned int)len, cycles ? (double)len * rounds / cycles : 0.0,
+             us ? (double)len * rounds / us : 0.0, keyCycles / rounds);
+    TEST_MESSAGE(message);
+  }
+}
+
+void runAesTests(void)
+{
+  RUN_TEST(test_aes_block);
+  RUN_TEST(test_aes_ctr);
+  RUN_TEST(test_aes_ctr_in_place_partial_block);
+  RUN_TEST(test_aes_rekey);
+  RUN_TEST(test_aes_benchmark);
+}
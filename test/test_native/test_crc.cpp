@@ -0,0 +1,179 @@
+/*
+ Copyright (C) 2020 chester4444@wolke7.net
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+// CRC-16/EN-13757 (poly 0x3d65, init 0, xorout 0xffff) against the check
+// values of the crc catalogue and the original bitwise routine, chunked and
+// sliced against bytewise, and the speed of each
+
+#include <stdio.h>
+#include <string.h>
+#include <unity.h>
+#include "Crc16.h"
+#include "tests.h"
+
+static const uint8_t CHECK[] = { '1', '2', '3', '4', '5', '6', '7', '8', '9' };
+
+// the decoder's former crc16_EN13757_per_byte(), 8 shifts per byte
+static uint16_t bitwiseUpdate(uint16_t crc, const uint8_t *data, size_t len)
+{
+  for (size_t n = 0; n < len; n++)
+  {
+    uint8_t b = data[n];
+    for (uint8_t i = 0; i < 8; i++)
+    {
+      if (((crc & 0x8000) >> 8) ^ (b & 0x80))
+      {
+        crc = (crc << 1) ^ 0x3D65;
+      }
+      else
+      {
+        crc = (crc << 1);
+      }
+      b <<= 1;
+    }
+  }
+  return crc;
+}
+
+static uint32_t nextRandom(uint32_t &seed)
+{
+  seed = seed * 1103515245 + 12345;
+  return seed >> 16;
+}
+
+static void test_crc_check_value(void)
+{
+  TEST_ASSERT_EQUAL_HEX16(0xc2b7, Crc16::compute(CHECK, sizeof(CHECK)));
+}
+
+static void test_crc_equals_bitwise(void)
+{
+  // random lengths, contents and start values
+  uint8_t data[300];
+  uint32_t seed = 7;
+
+  TEST_ASSERT_EQUAL_HEX16(0xc2b7, (uint16_t)~bitwiseUpdate(Crc16::INIT, CHECK, sizeof(CHECK)));
+  for (int round = 0; round < 2000; round++)
+  {
+    size_t len = nextRandom(seed) % (sizeof(data) + 1);
+    uint16_t start = nextRandom(seed);
+    for (size_t i = 0; i < len; i++) data[i] = nextRandom(seed);
+
+    uint16_t expected = bitwiseUpdate(start, data, len);
+    TEST_ASSERT_EQUAL_HEX16(expected, Crc16::update(start, data, len));
+#if defined(CRC16_SLICE4)
+    TEST_ASSERT_EQUAL_HEX16(expected, Crc16::updateSlice4(start, data, len));
+#endif
+    if (start == Crc16::INIT)
+    {
+      TEST_ASSERT_EQUAL_HEX16(Crc16::finish(expected), Crc16::compute(data, len));
+    }
+  }
+}
+
+static void test_crc_residue(void)
+{
+  // a block followed by its crc, big endian as on air
+  uint8_t block[sizeof(CHECK) + 2];
+  memcpy(block, CHECK, sizeof(CHECK));
+  uint16_t crc = Crc16::compute(CHECK, sizeof(CHECK));
+  block[sizeof(CHECK)] = crc >> 8;
+  block[sizeof(CHECK) + 1] = crc & 0xff;
+
+  TEST_ASSERT_EQUAL_HEX16(0xa366, Crc16::update(Crc16::INIT, block, sizeof(block)));
+}
+
+static void test_crc_empty(void)
+{
+  TEST_ASSERT_EQUAL_HEX16(0xffff, Crc16::compute(CHECK, 0));
+}
+
+static void test_crc_chunks(void)
+{
+  // the receiver continues the crc with every fifo read
+  for (size_t split = 0; split <= sizeof(CHECK); split++)
+  {
+    uint16_t crc = Crc16::update(Crc16::INIT, CHECK, split);
+    crc = Crc16::update(crc, CHECK + split, sizeof(CHECK) - split);
+    TEST_ASSERT_EQUAL_HEX16(0xc2b7, Crc16::finish(crc));
+  }
+}
+
+#if defined(CRC16_SLICE4)
+static void test_crc_slice4_equals_bytewise(void)
+{
+  uint8_t data[261];
+  uint32_t seed = 1;
+  for (size_t i = 0; i < sizeof(data); i++) data[i] = nextRandom(seed);
+
+  // every length, so each tail of 0..3 bytes is covered, and some start values
+  static const uint16_t STARTS[] = { 0x0000, 0xffff, 0x3d65, 0x8001 };
+  for (size_t s = 0; s < sizeof(STARTS) / sizeof(STARTS[0]); s++)
+  {
+    for (size_t len = 0; len <= sizeof(data); len++)
+    {
+      TEST_ASSERT_EQUAL_HEX16(Crc16::update(STARTS[s], data, len),
+                              Crc16::updateSlice4(STARTS[s], data, len));
+    }
+  }
+}
+#endif
+
+// the longest frame's worth of data, per routine
+static void test_crc_benchmark(void)
+{
+  uint8_t data[256];
+  uint32_t seed = 3;
+  for (size_t i = 0; i < sizeof(data); i++) data[i] = nextRandom(seed);
+
+  const uint32_t rounds = 2000;
+  uint16_t crc = 0;
+  char message[128];
+
+  uint32_t start = testCycles();
+  for (uint32_t i = 0; i < rounds; i++) crc ^= bitwiseUpdate(crc, data, sizeof(data));
+  uint32_t bitwise = testCycles() - start;
+
+  start = testCycles();
+  for (uint32_t i = 0; i < rounds; i++) crc ^= Crc16::update(crc, data, sizeof(data));
+  uint32_t table = testCycles() - start;
+
+#if defined(CRC16_SLICE4)
+  start = testCycles();
+  for (uint32_t i = 0; i < rounds; i++) crc ^= Crc16::updateSlice4(crc, data, sizeof(data));
+  uint32_t slice4 = testCycles() - start;
+#else
+  uint32_t slice4 = 0;
+#endif
+
+  // crc keeps the loops from being optimised away
+  snprintf(message, sizeof(message), "256 bytes: bitwise %.2f, table %.2f, slice4 %.2f cycles/byte (%04x)",
+           (double)bitwise / rounds / sizeof(data), (double)table / rounds / sizeof(data),
+           (double)slice4 / rounds / sizeof(data), crc);
+  TEST_MESSAGE(message);
+}
+
+void runCrcTests(void)
+{
+  RUN_TEST(test_crc_check_value);
+  RUN_TEST(test_crc_equals_bitwise);
+  RUN_TEST(test_crc_residue);
+  RUN_TEST(test_crc_empty);
+  RUN_TEST(test_crc_chunks);
+#if defined(CRC16_SLICE4)
+  RUN_TEST(test_crc_slice4_equals_bytewise);
+#endif
+  RUN_TEST(test_crc_benchmark);
+}
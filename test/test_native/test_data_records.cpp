@@ -0,0 +1,232 @@
+/*
+ Copyright (C) 2020 chester4444@wolke7.net
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+// the DIF/VIF parser on its own: record types and values, truncated data,
+// more records than kept, unknown codes; and its speed for a long frame
+
+#include <stdio.h>
+#include <unity.h>
+#include "DataRecords.h"
+#include "tests.h"
+
+#define LENGTH(a) (uint8_t)(sizeof(a) / sizeof((a)[0]))
+
+// Multical21 long frame: volume, volume at month start, two temperatures
+static const uint8_t MULTICAL21[] =
+{
+  0x04, 0x13, 0x39, 0x30, 0x00, 0x00,  0x44, 0x13, 0xF8, 0x2A, 0x00, 0x00,  0x01, 0x5B, 0x0F,  0x01, 0x67, 0x14
+};
+
+// heat meter long frame: info codes, energy, volume, flow, power, temperatures,
+// energy and volume at the due date, the date, max flow
+static const uint8_t HEAT[] =
+{
+  0x02, 0xFF, 0x20, 0x00, 0x00,  0x04, 0x06, 0x4C, 0x1D, 0x00, 0x00,  0x04, 0x13, 0xB4, 0x3A, 0x01, 0x00,
+  0x04, 0x3B, 0x12, 0x00, 0x00, 0x00,  0x02, 0x2B, 0x64, 0x00,  0x02, 0x5B, 0x41, 0x00,  0x02, 0x5F, 0x23, 0x00,
+  0x44, 0x06, 0x10, 0x1B, 0x00, 0x00,  0x44, 0x13, 0x90, 0x30, 0x01, 0x00,  0x42, 0x6C, 0x9F, 0x2C,
+  0x14, 0x3B, 0x80, 0x01, 0x00, 0x00
+};
+
+static void test_records_types_and_values(void)
+{
+  DataRecords records;
+  TEST_ASSERT_TRUE(records.parse(MULTICAL21, sizeof(MULTICAL21)));
+  TEST_ASSERT_EQUAL(4, records.count);
+  TEST_ASSERT_EQUAL(10, records.packedLength);
+
+  const DataRecord &volume = records.records[0];
+  TEST_ASSERT_EQUAL(RecordVolume, volume.type);
+  TEST_ASSERT_EQUAL(-3, volume.exponent);
+  TEST_ASSERT_EQUAL(12345, volume.value);
+  TEST_ASSERT_EQUAL(12345, volume.scaled(-3));
+  TEST_ASSERT_EQUAL(123, volume.scaled(-1));
+  TEST_ASSERT_EQUAL(2, volume.dataOffset);
+  TEST_ASSERT_EQUAL(0, volume.packedOffset);
+
+  TEST_ASSERT_EQUAL_PTR(&records.records[1], records.find(RecordVolume, FunctionInstantaneous, 1));
+  TEST_ASSERT_EQUAL(11000, records.records[1].value);
+  TEST_ASSERT_EQUAL(RecordFlowTemperature, records.records[2].type);
+  TEST_ASSERT_EQUAL(15, records.records[2].value);
+  TEST_ASSERT_EQUAL(RecordExternalTemperature, records.records[3].type);
+  TEST_ASSERT_EQUAL(9, records.records[3].packedOffset);
+  TEST_ASSERT_NULL(records.find(RecordEnergy));
+
+  TEST_ASSERT_TRUE(records.parse(HEAT, sizeof(HEAT)));
+  TEST_ASSERT_EQUAL(11, records.count);
+  TEST_ASSERT_EQUAL(RecordInfoCodes, records.records[0].type);
+  TEST_ASSERT_EQUAL(7500, records.find(RecordEnergy)->value);
+  TEST_ASSERT_EQUAL(RecordVolumeFlow, records.first(RecordVolumeFlow)->type);
+  TEST_ASSERT_EQUAL(384, records.find(RecordVolumeFlow, FunctionMaximum)->value);
+  TEST_ASSERT_EQUAL(RecordPower, records.records[4].type);
+  TEST_ASSERT_EQUAL(RecordReturnTemperature, records.records[6].type);
+  TEST_ASSERT_EQUAL(RecordDate, records.records[9].type);
+}
+
+static void test_records_truncated(void)
+{
+  // cut anywhere: only the cuts between records parse
+  static const uint8_t ENDS[] = { 0, 6, 12, 15, 18 };
+  DataRecords records;
+
+  for (uint8_t len = 0; len <= sizeof(MULTICAL21); len++)
+  {
+    uint8_t complete = 0;
+    bool boundary = false;
+    for (uint8_t i = 0; i < LENGTH(ENDS); i++)
+    {
+      if (ENDS[i] == len) boundary = true;
+      if (ENDS[i] <= len && i > 0) complete = i;
+    }
+    TEST_ASSERT_EQUAL(boundary, records.parse(MULTICAL21, len));
+    if (boundary) TEST_ASSERT_EQUAL(complete, records.count);
+  }
+
+  // DIFEs and VIFEs past the end, more extensions than allowed
+  static const uint8_t DIFE_CUT[] = { 0x84, 0x80 };
+  static const uint8_t VIFE_CUT[] = { 0x04, 0x93, 0x80 };
+  static const uint8_t DIFE_LONG[] = { 0x84, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x00,
+                                       0x13, 0x00, 0x00, 0x00, 0x00 };
+  TEST_ASSERT_FALSE(records.parse(DIFE_CUT, sizeof(DIFE_CUT)));
+  TEST_ASSERT_FALSE(records.parse(VIFE_CUT, sizeof(VIFE_CUT)));
+  TEST_ASSERT_FALSE(records.parse(DIFE_LONG, sizeof(DIFE_LONG)));
+
+  // variable length: longer than the data, or not plain text
+  static const uint8_t LVAR_CUT[] = { 0x0D, 0xFD, 0x0C, 0x05, 'a', 'b' };
+  static const uint8_t LVAR_BINARY[] = { 0x0D, 0xFD, 0x0C, 0xE1, 0x00 };
+  static const uint8_t LVAR_OK[] = { 0x0D, 0xFD, 0x0C, 0x02, 'a', 'b' };
+  TEST_ASSERT_FALSE(records.parse(LVAR_CUT, sizeof(LVAR_CUT)));
+  TEST_ASSERT_FALSE(records.parse(LVAR_BINARY, sizeof(LVAR_BINARY)));
+  TEST_ASSERT_TRUE(records.parse(LVAR_OK, sizeof(LVAR_OK)));
+  TEST_ASSERT_EQUAL(3, records.records[0].dataLength);
+}
+
+static void test_records_more_than_kept(void)
+{
+  // 20 one byte volumes: all parsed, the first 16 kept
+  uint8_t data[20 * 3];
+  for (uint8_t i = 0; i < 20; i++)
+  {
+    data[3 * i] = 0x01;
+    data[3 * i + 1] = 0x13;
+    data[3 * i + 2] = i;
+  }
+
+  DataRecords records;
+  TEST_ASSERT_TRUE(records.parse(data, sizeof(data)));
+  TEST_ASSERT_EQUAL(MAX_DATA_RECORDS, records.count);
+  TEST_ASSERT_EQUAL(MAX_DATA_RECORDS - 1, records.records[MAX_DATA_RECORDS - 1].value);
+  TEST_ASSERT_EQUAL(20, records.packedLength);
+
+  // the signature covers the dropped headers too
+  uint16_t signature = records.signature;
+  data[sizeof(data) - 2] = 0x14;
+  TEST_ASSERT_TRUE(records.parse(data, sizeof(data)));
+  TEST_ASSERT_NOT_EQUAL(signature, records.signature);
+}
+
+static void test_records_unknown_codes(void)
+{
+  DataRecords records;
+
+  // a VIF without a type still has its value
+  static const uint8_t UNKNOWN_VIF[] = { 0x01, 0x7B, 0x05,  0x01, 0xFB, 0x01, 0x07,  0x01, 0xFD, 0x0E, 0x09 };
+  TEST_ASSERT_TRUE(records.parse(UNKNOWN_VIF, sizeof(UNKNOWN_VIF)));
+  TEST_ASSERT_EQUAL(3, records.count);
+  TEST_ASSERT_EQUAL(RecordUnknown, records.records[0].type);
+  TEST_ASSERT_EQUAL(5, records.records[0].value);
+  TEST_ASSERT_EQUAL(RecordUnknown, records.records[1].type);
+  TEST_ASSERT_EQUAL(7, records.records[1].value);
+  TEST_ASSERT_EQUAL(RecordUnknown, records.records[2].type);
+
+  // fillers are skipped and left out of the signature
+  static const uint8_t FILLED[] = { 0x2F, 0x01, 0x13, 0x05, 0x2F, 0x2F };
+  static const uint8_t PLAIN[] = { 0x01, 0x13, 0x07 };
+  TEST_ASSERT_TRUE(records.parse(FILLED, sizeof(FILLED)));
+  TEST_ASSERT_EQUAL(1, records.count);
+  uint16_t signature = records.signature;
+  TEST_ASSERT_TRUE(records.parse(PLAIN, sizeof(PLAIN)));
+  TEST_ASSERT_EQUAL(signature, records.signature);
+
+  // manufacturer data and plain text units end the records
+  static const uint8_t MANUFACTURER[] = { 0x01, 0x13, 0x05, 0x0F, 0xAA, 0xBB };
+  static const uint8_t TEXT_UNIT[] = { 0x01, 0x13, 0x05, 0x01, 0x7C, 0x02, 'k', 'g', 0x09 };
+  TEST_ASSERT_TRUE(records.parse(MANUFACTURER, sizeof(MANUFACTURER)));
+  TEST_ASSERT_EQUAL(1, records.count);
+  TEST_ASSERT_TRUE(records.parse(TEXT_UNIT, sizeof(TEXT_UNIT)));
+  TEST_ASSERT_EQUAL(1, records.count);
+
+  // no data (DIF 0x08 selection for readout)
+  static const uint8_t NO_DATA[] = { 0x08, 0x13, 0x01, 0x13, 0x05 };
+  TEST_ASSERT_TRUE(records.parse(NO_DATA, sizeof(NO_DATA)));
+  TEST_ASSERT_EQUAL(2, records.count);
+  TEST_ASSERT_EQUAL(0, records.records[0].dataLength);
+}
+
+static void test_records_bcd(void)
+{
+  DataRecords records;
+
+  static const uint8_t BCD[] = { 0x0C, 0x13, 0x78, 0x56, 0x34, 0x12,  0x0A, 0x5B, 0x23, 0xF1 };
+  TEST_ASSERT_TRUE(records.parse(BCD, sizeof(BCD)));
+  TEST_ASSERT_EQUAL(12345678, records.records[0].value);
+  TEST_ASSERT_EQUAL(-123, records.records[1].value);
+
+  static const uint8_t INVALID[] = { 0x09, 0x13, 0xAB };
+  TEST_ASSERT_FALSE(records.parse(INVALID, sizeof(INVALID)));
+
+  // signed integers
+  static const uint8_t NEGATIVE[] = { 0x02, 0x5B, 0xFE, 0xFF,  0x03, 0x13, 0x00, 0x00, 0x80 };
+  TEST_ASSERT_TRUE(records.parse(NEGATIVE, sizeof(NEGATIVE)));
+  TEST_ASSERT_EQUAL(-2, records.records[0].value);
+  TEST_ASSERT_EQUAL(-8388608, records.records[1].value);
+}
+
+// a heat meter's long frame against the 16 s the meter waits between frames
+static void test_records_benchmark(void)
+{
+  const uint32_t rounds = 5000;
+  DataRecords records;
+  uint8_t count = 0;
+
+  uint32_t startUs = testMicros();
+  uint32_t start = testCycles();
+  for (uint32_t i = 0; i < rounds; i++)
+  {
+    records.parse(HEAT, sizeof(HEAT));
+    count += records.count;
+  }
+  uint32_t cycles = testCycles() - start;
+  uint32_t us = testMicros() - startUs;
+  TEST_ASSERT_EQUAL(11, records.count);
+
+  // even 100 times slower it is far below the transmit interval
+  TEST_ASSERT_LESS_THAN(16000000 / 100, (uint64_t)us * 1000 / rounds);
+
+  char message[128];
+  snprintf(message, sizeof(message), "%u byte long frame, %u records: %u cycles, %u ns (%u)",
+           (unsigned int)sizeof(HEAT), records.count, cycles / rounds,
+           (unsigned int)((uint64_t)us * 1000 / rounds), count);
+  TEST_MESSAGE(message);
+}
+
+void runDataRecordsTests(void)
+{
+  RUN_TEST(test_records_types_and_values);
+  RUN_TEST(test_records_truncated);
+  RUN_TEST(test_records_more_than_kept);
+  RUN_TEST(test_records_unknown_codes);
+  RUN_TEST(test_records_bcd);
+  RUN_TEST(test_records_benchmark);
+}
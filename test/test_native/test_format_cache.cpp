@@ -0,0 +1,106 @@
+/*
+ Copyright (C) 2020 chester4444@wolke7.net
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+// layouts of the compact frames: learning, unpacking and lru eviction
+
+#include <unity.h>
+#include "FormatCache.h"
+#include "tests.h"
+
+// one byte record with VIF 0x10 + n, a layout of its own for each n
+static uint16_t learnLayout(FormatCache &cache, uint8_t n)
+{
+  const uint8_t data[] = { 0x01, (uint8_t)(0x10 + n), n };
+  DataRecords records;
+  TEST_ASSERT_TRUE(records.parse(data, sizeof(data)));
+  cache.learn(records);
+  return records.signature;
+}
+
+static bool unpacks(FormatCache &cache, uint16_t signature)
+{
+  const uint8_t values[] = { 0x2A };
+  DataRecords records;
+  if (!cache.unpack(signature, values, sizeof(values), records)) return false;
+  TEST_ASSERT_EQUAL(1, records.count);
+  TEST_ASSERT_EQUAL(42, records.records[0].value);
+  return true;
+}
+
+static void test_format_cache_unpacks_learned_layout(void)
+{
+  FormatCache cache;
+  uint16_t signature = learnLayout(cache, 3);
+  TEST_ASSERT_TRUE(unpacks(cache, signature));
+  TEST_ASSERT_FALSE(unpacks(cache, signature + 1));
+
+  // values shorter than the layout
+  DataRecords records;
+  TEST_ASSERT_FALSE(cache.unpack(signature, NULL, 0, records));
+
+  TEST_ASSERT_EQUAL(1, cache.getStatistics().hits);
+  TEST_ASSERT_EQUAL(2, cache.getStatistics().misses);
+}
+
+static void test_format_cache_evicts_least_recently_used(void)
+{
+  FormatCache cache;
+  uint16_t signatures[FORMAT_CACHE_SIZE + 1];
+  for (uint8_t i = 0; i < FORMAT_CACHE_SIZE; i++)
+  {
+    signatures[i] = learnLayout(cache, i);
+  }
+  for (uint8_t i = 1; i < FORMAT_CACHE_SIZE; i++)
+  {
+    TEST_ASSERT_NOT_EQUAL(signatures[0], signatures[i]);
+  }
+
+  // relearning a known layout takes no entry
+  learnLayout(cache, 2);
+  TEST_ASSERT_EQUAL(0, cache.getStatistics().evictions);
+
+  // the first layout is used again, the second is the oldest now
+  TEST_ASSERT_TRUE(unpacks(cache, signatures[0]));
+  signatures[FORMAT_CACHE_SIZE] = learnLayout(cache, FORMAT_CACHE_SIZE);
+  TEST_ASSERT_EQUAL(1, cache.getStatistics().evictions);
+
+  TEST_ASSERT_FALSE(unpacks(cache, signatures[1]));
+  TEST_ASSERT_TRUE(unpacks(cache, signatures[0]));
+  for (uint8_t i = 2; i <= FORMAT_CACHE_SIZE; i++)
+  {
+    TEST_ASSERT_TRUE(unpacks(cache, signatures[i]));
+  }
+}
+
+static void test_format_cache_merges(void)
+{
+  FormatCache learner;
+  FormatCache cache;
+  uint16_t known = learnLayout(cache, 0);
+  uint16_t learned = learnLayout(learner, 1);
+  learnLayout(learner, 0);
+
+  cache.learn(learner);
+  TEST_ASSERT_TRUE(unpacks(cache, known));
+  TEST_ASSERT_TRUE(unpacks(cache, learned));
+  TEST_ASSERT_EQUAL(0, cache.getStatistics().evictions);
+}
+
+void runFormatCacheTests(void)
+{
+  RUN_TEST(test_format_cache_unpacks_learned_layout);
+  RUN_TEST(test_format_cache_evicts_least_recently_used);
+  RUN_TEST(test_format_cache_merges);
+}
@@ -0,0 +1,164 @@
+/*
+ Copyright (C) 2020 chester4444@wolke7.net
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+// the single producer single consumer queue between radio and decoder:
+// empty, full, index wrap, the slot the decoder decrypts in, and two
+// threads on the PC
+
+#include <unity.h>
+#include "FrameQueue.h"
+#include "tests.h"
+#if !defined(ARDUINO)
+  #include <thread>
+#endif
+
+typedef FrameQueue<4> Queue;
+
+static void put(Queue &queue, uint8_t sequence)
+{
+  RawFrame *frame = queue.claim();
+  TEST_ASSERT_NOT_NULL(frame);
+  frame->length = 1;
+  frame->payload[0] = sequence;
+  queue.push();
+}
+
+static uint8_t take(Queue &queue)
+{
+  RawFrame *frame = queue.front();
+  TEST_ASSERT_NOT_NULL(frame);
+  uint8_t sequence = frame->payload[0];
+  queue.pop();
+  return sequence;
+}
+
+static void test_queue_empty(void)
+{
+  static Queue queue;
+  TEST_ASSERT_EQUAL(0, queue.depth());
+  TEST_ASSERT_NULL(queue.front());
+
+  put(queue, 1);
+  TEST_ASSERT_EQUAL(1, take(queue));
+  TEST_ASSERT_NULL(queue.front());
+  TEST_ASSERT_EQUAL(0, queue.depth());
+}
+
+static void test_queue_full(void)
+{
+  static Queue queue;
+  for (uint8_t i = 0; i < 4; i++) put(queue, i);
+
+  TEST_ASSERT_EQUAL(4, queue.depth());
+  TEST_ASSERT_NULL(queue.claim());
+
+  // a claim without push takes nothing
+  TEST_ASSERT_EQUAL(0, take(queue));
+  TEST_ASSERT_NOT_NULL(queue.claim());
+  TEST_ASSERT_NOT_NULL(queue.claim());
+  TEST_ASSERT_EQUAL(3, queue.depth());
+}
+
+static void test_queue_wraps(void)
+{
+  // the 8 bit indexes wrap several times, the order stays
+  static Queue queue;
+  uint8_t next = 0;
+  uint8_t expected = 0;
+
+  for (int round = 0; round < 1000; round++)
+  {
+    uint8_t n = 1 + round % 4;
+    for (uint8_t i = 0; i < n; i++) put(queue, next++);
+    TEST_ASSERT_EQUAL(n, queue.depth());
+    for (uint8_t i = 0; i < n; i++) TEST_ASSERT_EQUAL(expected++, take(queue));
+  }
+  TEST_ASSERT_EQUAL(0, queue.depth());
+}
+
+static void test_queue_slot_reused_after_pop(void)
+{
+  // the decoder decrypts in place, the radio mustn't get that slot
+  // before pop() and must get it back after
+  static Queue queue;
+  for (uint8_t i = 0; i < 4; i++) put(queue, i);
+
+  RawFrame *decoding = queue.front();
+  memset(decoding->payload, 0xAA, sizeof(decoding->payload));
+  TEST_ASSERT_NULL(queue.claim());
+
+  queue.pop();
+  RawFrame *reused = queue.claim();
+  TEST_ASSERT_EQUAL_PTR(decoding, reused);
+
+  // the others weren't touched
+  for (uint8_t i = 1; i < 4; i++) TEST_ASSERT_EQUAL(i, take(queue));
+}
+
+#if !defined(ARDUINO)
+static void test_queue_two_threads(void)
+{
+  static Queue queue;
+  const uint32_t frames = 200000;
+  uint32_t errors = 0;
+
+  std::thread consumer([&]() {
+    uint32_t expected = 0;
+    while (expected < frames)
+    {
+      RawFrame *frame = queue.front();
+      if (frame == NULL)
+      {
+        std::this_thread::yield();
+        continue;
+      }
+      uint32_t sequence;
+      memcpy(&sequence, frame->payload, sizeof(sequence));
+      if (sequence != expected || frame->length != (uint8_t)sequence) errors++;
+      expected++;
+      queue.pop();
+    }
+  });
+
+  for (uint32_t i = 0; i < frames; )
+  {
+    RawFrame *frame = queue.claim();
+    if (frame == NULL)
+    {
+      std::this_thread::yield();
+      continue;
+    }
+    memcpy(frame->payload, &i, sizeof(i));
+    frame->length = (uint8_t)i;
+    queue.push();
+    i++;
+  }
+  consumer.join();
+
+  TEST_ASSERT_EQUAL(0, errors);
+  TEST_ASSERT_EQUAL(0, queue.depth());
+}
+#endif
+
+void runFrameQueueTests(void)
+{
+  RUN_TEST(test_queue_empty);
+  RUN_TEST(test_queue_full);
+  RUN_TEST(test_queue_wraps);
+  RUN_TEST(test_queue_slot_reused_after_pop);
+#if !defined(ARDUINO)
+  RUN_TEST(test_queue_two_threads);
+#endif
+}
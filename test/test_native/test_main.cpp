@@ -0,0 +1,57 @@
+/*
+ Copyright (C) 2020 chester4444@wolke7.net
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <unity.h>
+#include "tests.h"
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+static int runTests(void)
+{
+  UNITY_BEGIN();
+  runAesTests();
+  runCrcTests();
+  runDataRecordsTests();
+  runFormatCacheTests();
+  runFrameQueueTests();
+  runThreeOfSixTests();
+  return UNITY_END();
+}
+
+#if defined(ARDUINO)
+#include <Arduino.h>
+
+void setup()
+{
+  // the board needs some time to open the serial port
+  delay(2000);
+  runTests();
+}
+
+void loop()
+{
+}
+#else
+int main(int argc, char **argv)
+{
+  return runTests();
+}
+#endif
@@ -0,0 +1,155 @@
+/*
+ Copyright (C) 2020 chester4444@wolke7.net
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+// the table driven 3 of 6 decoder against a symbol by symbol reference,
+// and its speed for the longest T1 frame
+
+#include <stdio.h>
+#include <unity.h>
+#include "ThreeOfSix.h"
+#include "frames.h"
+#include "tests.h"
+
+static const uint8_t CODES[16] =
+{
+  0x16, 0x0D, 0x0E, 0x0B, 0x1C, 0x19, 0x1A, 0x13,
+  0x2C, 0x25, 0x26, 0x23, 0x34, 0x31, 0x32, 0x29,
+};
+
+// EN 13757-4 as written: take 6 bits, search the code table
+static int16_t referenceDecode(const uint8_t *in, size_t len, uint8_t *out)
+{
+  size_t symbols = len * 8 / 6;
+  int16_t count = 0;
+  for (size_t s = 0; s + 1 < symbols; s += 2)
+  {
+    uint8_t nibbles[2];
+    for (size_t n = 0; n < 2; n++)
+    {
+      uint8_t symbol = 0;
+      for (size_t b = 0; b < 6; b++)
+      {
+        size_t bit = (s + n) * 6 + b;
+        symbol = (symbol << 1) | ((in[bit / 8] >> (7 - bit % 8)) & 1);
+      }
+      uint8_t nibble = 0;
+      while (nibble < 16 && CODES[nibble] != symbol) nibble++;
+      if (nibble == 16) return -1;
+      nibbles[n] = nibble;
+    }
+    out[count++] = (nibbles[0] << 4) | nibbles[1];
+  }
+  return count;
+}
+
+static Bytes allBytes(void)
+{
+  Bytes data(256);
+  for (size_t i = 0; i < data.size(); i++) data[i] = i;
+  return data;
+}
+
+static void test_three_of_six_all_bytes(void)
+{
+  Bytes data = allBytes();
+  Bytes coded = encodeThreeOfSix(data);
+  TEST_ASSERT_EQUAL(ThreeOfSix::encodedLength(data.size()), coded.size());
+
+  ThreeOfSix decoder;
+  uint8_t out[256];
+  TEST_ASSERT_EQUAL(256, decoder.decode(&coded[0], coded.size(), out));
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(&data[0], out, 256);
+
+  uint8_t reference[256];
+  TEST_ASSERT_EQUAL(256, referenceDecode(&coded[0], coded.size(), reference));
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(reference, out, 256);
+}
+
+static void test_three_of_six_chunks(void)
+{
+  // the fifo hands out any number of bytes, even in place
+  Bytes data = allBytes();
+  data.resize(61);
+  Bytes coded = encodeThreeOfSix(data);
+
+  for (size_t chunk = 1; chunk <= coded.size(); chunk++)
+  {
+    ThreeOfSix decoder;
+    Bytes buffer = coded;
+    Bytes out;
+    for (size_t pos = 0; pos < buffer.size(); pos += chunk)
+    {
+      size_t n = (buffer.size() - pos < chunk) ? buffer.size() - pos : chunk;
+      int16_t count = decoder.decode(&buffer[pos], n, &buffer[pos]);
+      TEST_ASSERT_GREATER_OR_EQUAL(0, count);
+      out.insert(out.end(), buffer.begin() + pos, buffer.begin() + pos + count);
+    }
+    TEST_ASSERT_EQUAL(data.size(), out.size());
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(&data[0], &out[0], data.size());
+  }
+}
+
+static void test_three_of_six_invalid_symbol(void)
+{
+  Bytes coded = encodeThreeOfSix(allBytes());
+  ThreeOfSix decoder;
+  uint8_t out[256];
+
+  // 000000 is no symbol
+  coded[30] = 0x00;
+  coded[31] = 0x00;
+  TEST_ASSERT_EQUAL(-1, decoder.decode(&coded[0], coded.size(), out));
+}
+
+static void test_three_of_six_benchmark(void)
+{
+  // lfield 255: 290 bytes format A, 435 on air
+  Bytes coded = packetT1(linkData(0x12345678, 255));
+  TEST_ASSERT_EQUAL(435, coded.size());
+
+  const uint32_t rounds = 2000;
+  uint8_t out[300];
+  int16_t count = 0;
+
+  uint32_t start = testMicros();
+  for (uint32_t i = 0; i < rounds; i++)
+  {
+    ThreeOfSix decoder;
+    count = decoder.decode(&coded[0], coded.size(), out);
+  }
+  uint32_t table = testMicros() - start;
+  TEST_ASSERT_EQUAL(290, count);
+
+  start = testMicros();
+  for (uint32_t i = 0; i < rounds; i++)
+  {
+    count = referenceDecode(&coded[0], coded.size(), out);
+  }
+  uint32_t reference = testMicros() - start;
+  TEST_ASSERT_EQUAL(290, count);
+
+  char message[96];
+  snprintf(message, sizeof(message), "435 byte T1 frame: %u ns table, %u ns reference",
+           (unsigned int)((uint64_t)table * 1000 / rounds), (unsigned int)((uint64_t)reference * 1000 / rounds));
+  TEST_MESSAGE(message);
+}
+
+void runThreeOfSixTests(void)
+{
+  RUN_TEST(test_three_of_six_all_bytes);
+  RUN_TEST(test_three_of_six_chunks);
+  RUN_TEST(test_three_of_six_invalid_symbol);
+  RUN_TEST(test_three_of_six_benchmark);
+}
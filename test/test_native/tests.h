@@ -0,0 +1,33 @@
+/*
+ Copyright (C) 2020 chester4444@wolke7.net
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+// tests of the pure code, no fakes needed: they run on the host
+// (pio test -e native) and on the boards (pio test -e esp32-test-aes-hw)
+
+#ifndef _TESTS_H_
+#define _TESTS_H_
+
+#include <stdint.h>
+#include "bench.h"
+
+// each file registers its tests with RUN_TEST
+void runAesTests(void);
+void runCrcTests(void);
+void runDataRecordsTests(void);
+void runFormatCacheTests(void);
+void runFrameQueueTests(void);
+void runThreeOfSixTests(void);
+
+#endif // _TESTS_H_
@@ -0,0 +1,312 @@
+/*
+ Copyright (C) 2020 chester4444@wolke7.net
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+// the publish path of ProfilePublish.cpp: the publish policy and the
+// readings stored while offline; the test stands in for the mqtt functions
+// of main.cpp
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <unity.h>
+#include "MeterProfiles.h"
+#include "ReadingStore.h"
+#include "MqttTransport.h"
+#include "Meter.h"
+
+bool forwardStoredReadings(void);
+
+// what main.cpp would have sent
+static bool online;
+static std::vector<std::string> published;
+
+bool mqttOnline(void)
+{
+  return online;
+}
+
+bool mqttMyDataJson(const Meter *meter, const char *json, size_t len)
+{
+  published.push_back(std::string(json, len));
+  return true;
+}
+
+bool mqttMyData(const Meter *meter, const char *value)
+{
+  return true;
+}
+
+static bool backlogAccepted;
+static std::vector<std::string> backlog;
+
+bool mqttBacklog(const char *json, size_t len)
+{
+  if (!backlogAccepted) return false;
+  backlog.push_back(std::string(json, len));
+  return true;
+}
+
+static Meter meter;
+
+void setUp(void)
+{
+  memset(&meter, 0, sizeof(meter));
+  meter.id = 0x12345678;
+  meter.profile = profileById(0);
+  online = true;
+  published.clear();
+  backlogAccepted = true;
+  backlog.clear();
+  readingStore.forwarded(readingStore.size());
+}
+
+void tearDown(void)
+{
+}
+
+static void advance(uint32_t seconds)
+{
+  fakeMicros() += seconds * 1000000ULL;
+}
+
+// a Multical21 long frame with the volume in liters
+static bool receive(uint32_t volume)
+{
+  const uint8_t data[] =
+  {
+    0x04, 0x13, (uint8_t)volume, (uint8_t)(volume >> 8), (uint8_t)(volume >> 16), (uint8_t)(volume >> 24),
+    0x44, 0x13, 0xF8, 0x2A, 0x00, 0x00,  0x01, 0x5B, 0x0F,  0x01, 0x67, 0x14
+  };
+  DataRecords records;
+  TEST_ASSERT_TRUE(records.parse(data, sizeof(data)));
+  size_t before = published.size() + readingStore.size();
+  TEST_ASSERT_TRUE(publishProfile<Multical21Profile>(&meter, records));
+  return published.size() + readingStore.size() > before;
+}
+
+static void test_first_reading_is_published(void)
+{
+  advance(1);
+  TEST_ASSERT_TRUE(receive(12345));
+  TEST_ASSERT_EQUAL(1, meter.sent);
+  TEST_ASSERT_EQUAL(0, meter.suppressed);
+  TEST_ASSERT_EQUAL_STRING("{\"CurrentValue\": 12.345,\"MonthStartValue\": 11.000,\"WaterTemp\": 15,\"RoomTemp\": 20}",
+                           published[0].c_str());
+}
+
+static void test_unchanged_reading_is_suppressed(void)
+{
+  TEST_ASSERT_TRUE(receive(12345));
+  advance(16);
+  TEST_ASSERT_FALSE(receive(12345));
+  advance(PUBLISH_MIN_INTERVAL_S);
+  TEST_ASSERT_FALSE(receive(12345));
+  TEST_ASSERT_EQUAL(1, meter.sent);
+  TEST_ASSERT_EQUAL(2, meter.suppressed);
+}
+
+static void test_change_is_published(void)
+{
+  TEST_ASSERT_TRUE(receive(12345));
+  advance(PUBLISH_MIN_INTERVAL_S);
+  TEST_ASSERT_TRUE(receive(12346));
+  TEST_ASSERT_EQUAL(12346, meter.values[0]);
+  TEST_ASSERT_EQUAL(2, meter.sent);
+}
+
+static void test_change_within_min_interval_waits(void)
+{
+  TEST_ASSERT_TRUE(receive(12345));
+
+  // rate limited, sent with the next frame after the interval
+  advance(16);
+  TEST_ASSERT_FALSE(receive(12346));
+  TEST_ASSERT_EQUAL(12345, meter.values[0]);
+  advance(PUBLISH_MIN_INTERVAL_S - 16);
+  TEST_ASSERT_TRUE(receive(12346));
+  TEST_ASSERT_EQUAL(12346, meter.values[0]);
+}
+
+static void test_change_within_min_interval_is_hidden(void)
+{
+  TEST_ASSERT_TRUE(receive(12345));
+
+  // a change undone within the interval is never published
+  advance(16);
+  TEST_ASSERT_FALSE(receive(12346));
+  advance(16);
+  TEST_ASSERT_FALSE(receive(12345));
+  advance(PUBLISH_MIN_INTERVAL_S);
+  TEST_ASSERT_FALSE(receive(12345));
+  TEST_ASSERT_EQUAL(1, published.size());
+  TEST_ASSERT_EQUAL(3, meter.suppressed);
+}
+
+static void test_heartbeat_repeats_unchanged_reading(void)
+{
+  TEST_ASSERT_TRUE(receive(12345));
+  advance(PUBLISH_HEARTBEAT_MIN * 60 - 1);
+  TEST_ASSERT_FALSE(receive(12345));
+  advance(1);
+  TEST_ASSERT_TRUE(receive(12345));
+  TEST_ASSERT_EQUAL(2, published.size());
+  TEST_ASSERT_EQUAL_STRING(published[0].c_str(), published[1].c_str());
+}
+
+static void test_offline_reading_is_stored(void)
+{
+  online = false;
+  TEST_ASSERT_TRUE(receive(12345));
+  TEST_ASSERT_EQUAL(0, published.size());
+  TEST_ASSERT_EQUAL(1, readingStore.size());
+  TEST_ASSERT_EQUAL(meter.id, readingStore.at(0).meterId);
+  TEST_ASSERT_EQUAL(12345, readingStore.at(0).values[0]);
+
+  // stored counts as sent for the policy
+  advance(16);
+  TEST_ASSERT_FALSE(receive(12345));
+  TEST_ASSERT_EQUAL(1, meter.sent);
+}
+
+// heat meters, the longest readings
+static void storeReadings(uint32_t n)
+{
+  Meter heat = meter;
+  heat.profile = profileById(2);
+  int32_t values[MulticalHeatProfile::FIELDS] = { 123456, 4567890, 120000, 6543, 4321, 123 };
+  for (uint32_t i = 0; i < n; i++)
+  {
+    heat.id = 0x30000000 + i;
+    values[0] = i;
+    readingStore.append(&heat, values, MulticalHeatProfile::FIELDS);
+  }
+}
+
+static uint32_t readingsIn(const std::string &batch)
+{
+  return std::count(batch.begin(), batch.end(), '{');
+}
+
+static void test_store_keeps_the_newest(void)
+{
+  uint32_t overwritten = readingStore.getStatistics().overwritten;
+  storeReadings(READING_STORE_SIZE + 3);
+
+  TEST_ASSERT_EQUAL(READING_STORE_SIZE, readingStore.size());
+  TEST_ASSERT_EQUAL(overwritten + 3, readingStore.getStatistics().overwritten);
+  TEST_ASSERT_EQUAL(3, readingStore.at(0).values[0]);
+  TEST_ASSERT_EQUAL(0x30000003, readingStore.at(0).meterId);
+  TEST_ASSERT_EQUAL(READING_STORE_SIZE + 2, readingStore.at(READING_STORE_SIZE - 1).values[0]);
+  TEST_ASSERT_EQUAL(2, readingStore.at(0).profile);
+  TEST_ASSERT_EQUAL(MulticalHeatProfile::FIELDS, readingStore.at(0).fields);
+}
+
+static void test_forward_sends_batches_in_order(void)
+{
+  storeReadings(5);
+  advance(30);
+
+  TEST_ASSERT_TRUE(forwardStoredReadings());
+  TEST_ASSERT_EQUAL(1, backlog.size());
+  const std::string &batch = backlog[0];
+  TEST_ASSERT_LESS_OR_EQUAL(MQTT_PAYLOAD_MAX, batch.size());
+  TEST_ASSERT_EQUAL('[', batch[0]);
+  TEST_ASSERT_EQUAL(']', batch[batch.size() - 1]);
+  TEST_ASSERT_EQUAL(0, batch.find("[{\"meter\": \"30000000\",\"age\": 30,\"Energy\": 0,"));
+
+  // the rest follows, oldest first
+  uint32_t first = readingsIn(batch);
+  TEST_ASSERT_EQUAL(5 - first, readingStore.size());
+  while (forwardStoredReadings()) {}
+  TEST_ASSERT_EQUAL(0, readingStore.size());
+  char next[24];
+  snprintf(next, sizeof(next), "[{\"meter\": \"%08x\"", 0x30000000 + first);
+  TEST_ASSERT_EQUAL(0, backlog[1].find(next));
+}
+
+static void test_refused_batch_stays_stored(void)
+{
+  storeReadings(3);
+  backlogAccepted = false;
+  TEST_ASSERT_FALSE(forwardStoredReadings());
+  TEST_ASSERT_EQUAL(3, readingStore.size());
+
+  backlogAccepted = true;
+  TEST_ASSERT_TRUE(forwardStoredReadings());
+  TEST_ASSERT_EQUAL(3 - readingsIn(backlog[0]), readingStore.size());
+}
+
+static void test_store_clock_survives_restart(void)
+{
+  // the clock is saved before the restart, millis() starts over
+  uint64_t now = fakeMicros();
+  uint32_t before = readingStore.clock();
+  readingStore.saveClock();
+  fakeMicros() = 0;
+  readingStore.begin();
+  TEST_ASSERT_EQUAL(before, readingStore.clock());
+  fakeMicros() = now;
+}
+
+// a broker outage fills the store, the reconnect empties it: RTC bytes
+// written per reading and backlog messages it takes
+static void test_store_benchmark(void)
+{
+  uint32_t saved = readingStore.getStatistics().savedBytes;
+  storeReadings(3 * READING_STORE_SIZE);
+  uint32_t perReading = (readingStore.getStatistics().savedBytes - saved) / (3 * READING_STORE_SIZE);
+
+  // the reading and the header, not the whole store
+  TEST_ASSERT_EQUAL(sizeof(StoredReading) + 12, perReading);
+
+  saved = readingStore.getStatistics().savedBytes;
+  while (forwardStoredReadings()) {}
+  uint32_t batches = backlog.size();
+  uint32_t forwarded = 0;
+  for (const std::string &batch : backlog)
+  {
+    TEST_ASSERT_LESS_OR_EQUAL(MQTT_PAYLOAD_MAX, batch.size());
+    forwarded += readingsIn(batch);
+  }
+  TEST_ASSERT_EQUAL(READING_STORE_SIZE, forwarded);
+
+  char message[160];
+  snprintf(message, sizeof(message),
+           "%u readings: %u batches of up to %u bytes; %u bytes saved per reading of %u (store %u), %u per batch",
+           READING_STORE_SIZE, batches, MQTT_PAYLOAD_MAX, perReading, (unsigned int)sizeof(StoredReading),
+           (unsigned int)(12 + READING_STORE_SIZE * sizeof(StoredReading)),
+           (readingStore.getStatistics().savedBytes - saved) / batches);
+  TEST_MESSAGE(message);
+}
+
+int main(int argc, char **argv)
+{
+  readingStore.begin();
+
+  UNITY_BEGIN();
+  RUN_TEST(test_first_reading_is_published);
+  RUN_TEST(test_unchanged_reading_is_suppressed);
+  RUN_TEST(test_change_is_published);
+  RUN_TEST(test_change_within_min_interval_waits);
+  RUN_TEST(test_change_within_min_interval_is_hidden);
+  RUN_TEST(test_heartbeat_repeats_unchanged_reading);
+  RUN_TEST(test_offline_reading_is_stored);
+  RUN_TEST(test_store_keeps_the_newest);
+  RUN_TEST(test_forward_sends_batches_in_order);
+  RUN_TEST(test_refused_batch_stays_stored);
+  RUN_TEST(test_store_clock_survives_restart);
+  RUN_TEST(test_store_benchmark);
+  return UNITY_END();
+}
@@ -0,0 +1,414 @@
+/*
+ Copyright (C) 2020 chester4444@wolke7.net
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+// WaterMeter against the fake CC1101: frames are delivered into the fifo
+// a few bytes at a time, between two calls of service()
+
+#include <unity.h>
+#include "WaterMeter.h"
+#include "frames.h"
+#include "bench.h"
+
+#define OUR_METER      0x12345678
+#define FOREIGN_METER  0x11223344
+
+static WaterMeter *waterMeter;
+
+void setUp(void)
+{
+  fakeRadio().powerOn();
+  waterMeter = new WaterMeter();
+  waterMeter->begin();
+}
+
+void tearDown(void)
+{
+  delete waterMeter;
+}
+
+// the packet arrives, chunk bytes between two service() calls, then some
+// silence for the receiver to notice the end
+static void receive(const Bytes &packet, size_t chunk)
+{
+  FakeCC1101 &radio = fakeRadio();
+
+  radio.send(packet);
+  while (radio.deliver(chunk) > 0)
+  {
+    waterMeter->service();
+  }
+  for (int i = 0; i < 50; i++)
+  {
+    fakeMicros() += 100;
+    waterMeter->service();
+  }
+}
+
+// the decoder takes the frames off the queue, like the main loop does
+static void receiveAndDecode(const Bytes &packet)
+{
+  receive(packet, 16);
+  while (waterMeter->getQueueDepth() > 0)
+  {
+    waterMeter->isFrameAvailable();
+  }
+}
+
+// nothing on air, the receiver's state check is due every
+// RADIO_CHECK_INTERVAL_MS
+static void idle(uint32_t ms)
+{
+  for (uint32_t i = 0; i < ms; i++)
+  {
+    fakeMicros() += 1000;
+    waterMeter->service();
+  }
+}
+
+static const WaterMeter::Statistics &stats(void)
+{
+  return waterMeter->getStatistics();
+}
+
+static void test_receiver_starts_in_rx(void)
+{
+  TEST_ASSERT_EQUAL_HEX8(FakeCC1101::STATE_RX, fakeRadio().state);
+  TEST_ASSERT_EQUAL_HEX8(CC1101_DEFVAL_PKTCTRL0, fakeRadio().regs[CC1101_PKTCTRL0]);
+}
+
+static void test_frame_is_drained_with_burst_reads(void)
+{
+  receive(packetC1B(linkData(FOREIGN_METER, 60)), 10);
+
+  TEST_ASSERT_EQUAL(1, waterMeter->getQueueDepth());
+  TEST_ASSERT_EQUAL(1, stats().framesC1B);
+  TEST_ASSERT_EQUAL(0, stats().crcErrors);
+  TEST_ASSERT_EQUAL(0, stats().fifoUnderruns);
+  TEST_ASSERT_EQUAL(0, stats().fifoOverflows);
+
+  // a burst per poll, not a read per byte
+  size_t bursts = fakeRadio().countTransactions(CC1101_RXFIFO | READ_BURST);
+  size_t singles = fakeRadio().countTransactions(CC1101_RXFIFO | READ_SINGLE);
+  TEST_ASSERT_EQUAL(0, singles);
+  TEST_ASSERT_LESS_OR_EQUAL(10, bursts);
+}
+
+static void test_frame_longer_than_fifo(void)
+{
+  receive(packetC1A(linkData(FOREIGN_METER, 200)), 20);
+
+  TEST_ASSERT_EQUAL(1, waterMeter->getQueueDepth());
+  TEST_ASSERT_EQUAL(1, stats().framesC1A);
+  TEST_ASSERT_EQUAL(0, stats().crcErrors);
+  TEST_ASSERT_EQUAL(0, stats().fifoOverflows);
+}
+
+static void test_long_t1_frame(void)
+{
+  // 435 bytes on air, more than the 8 bit packet counter of the radio counts
+  Bytes packet = packetT1(linkData(FOREIGN_METER, 255));
+  TEST_ASSERT_GREATER_THAN(255, packet.size());
+  receive(packet, 20);
+
+  TEST_ASSERT_EQUAL(1, waterMeter->getQueueDepth());
+  TEST_ASSERT_EQUAL(1, stats().framesT1);
+  TEST_ASSERT_EQUAL(0, stats().crcErrors);
+  TEST_ASSERT_EQUAL(0, stats().fifoUnderruns);
+  TEST_ASSERT_EQUAL(0, fakeRadio().lost());
+
+  // the radio ended it, PKTLEN was set for the last 255 bytes
+  TEST_ASSERT_EQUAL(1, stats().rearms);
+  TEST_ASSERT_EQUAL_HEX8(packet.size() & 0xFF, fakeRadio().regs[0x06]);
+}
+
+static void test_bad_block_rejects_early(void)
+{
+  // a bit error in the first block, the other 180 data bytes aren't read
+  Bytes packet = packetC1A(linkData(FOREIGN_METER, 200));
+  packet[5] ^= 0x01;
+  receive(packet, 8);
+
+  TEST_ASSERT_EQUAL(0, waterMeter->getQueueDepth());
+  TEST_ASSERT_EQUAL(1, stats().crcErrors);
+  TEST_ASSERT_EQUAL(1, stats().earlyRejects);
+  TEST_ASSERT_GREATER_THAN(150, stats().skippedBytes);
+}
+
+static void test_frames_back_to_back(void)
+{
+  for (int i = 0; i < 5; i++)
+  {
+    receive(packetC1A(linkData(FOREIGN_METER + i, 40)), 16);
+  }
+
+  TEST_ASSERT_EQUAL(5, waterMeter->getQueueDepth());
+  TEST_ASSERT_EQUAL(5, stats().framesC1A);
+  TEST_ASSERT_EQUAL_HEX8(FakeCC1101::STATE_RX, fakeRadio().state);
+}
+
+static void test_fifo_overflow_drops_frame(void)
+{
+  // nobody reads the fifo while 100 bytes arrive
+  fakeRadio().send(packetC1B(linkData(FOREIGN_METER, 100)));
+  fakeRadio().deliver(3);
+  waterMeter->service();
+  fakeRadio().deliver(100);
+  for (int i = 0; i < 10; i++)
+  {
+    waterMeter->service();
+  }
+
+  TEST_ASSERT_EQUAL(0, waterMeter->getQueueDepth());
+  TEST_ASSERT_EQUAL(1, stats().fifoOverflows);
+  TEST_ASSERT_EQUAL_HEX8(FakeCC1101::STATE_RX, fakeRadio().state);
+
+  // and the next frame is fine
+  receive(packetC1B(linkData(FOREIGN_METER, 60)), 10);
+  TEST_ASSERT_EQUAL(1, waterMeter->getQueueDepth());
+}
+
+static void test_stalled_frame_is_dropped(void)
+{
+  // the sender stops half way, e.g. a collision
+  Bytes packet = packetC1B(linkData(FOREIGN_METER, 60));
+  packet.resize(30);
+  receive(packet, 10);
+
+  TEST_ASSERT_EQUAL(0, waterMeter->getQueueDepth());
+  TEST_ASSERT_EQUAL(1, stats().fifoUnderruns);
+}
+
+// the configuration goes out in one burst and is read back in one
+static void test_profile_is_written_in_one_burst(void)
+{
+  FakeCC1101 &radio = fakeRadio();
+  const RadioProfile &next = RADIO_PROFILES[1];
+
+  radio.transcript.clear();
+  waterMeter->selectProfile(&next);
+  waterMeter->service();
+
+  TEST_ASSERT_EQUAL_PTR(&next, &waterMeter->getProfile());
+  TEST_ASSERT_EQUAL(1, stats().profileSwitches);
+  TEST_ASSERT_EQUAL(0, stats().configErrors);
+  TEST_ASSERT_EQUAL(1, radio.countTransactions(CC1101_IOCFG2 | WRITE_BURST));
+  TEST_ASSERT_EQUAL(1, radio.countTransactions(CC1101_IOCFG2 | READ_BURST));
+
+  for (const Bytes &t : radio.transcript)
+  {
+    if (t[0] == (CC1101_IOCFG2 | WRITE_BURST))
+    {
+      TEST_ASSERT_EQUAL(1 + RADIO_CONFIG_LENGTH, t.size());
+      TEST_ASSERT_EQUAL_HEX8_ARRAY(next.regs, &t[1], RADIO_CONFIG_LENGTH);
+    }
+    if (t[0] == (CC1101_IOCFG2 | READ_BURST))
+    {
+      TEST_ASSERT_EQUAL(1 + RADIO_CONFIG_LENGTH, t.size());
+    }
+  }
+  TEST_ASSERT_EQUAL_HEX8(FakeCC1101::STATE_RX, radio.state);
+}
+
+// a register that doesn't read back keeps the old profile
+static void test_bad_readback_keeps_profile(void)
+{
+  const RadioProfile &old = waterMeter->getProfile();
+
+  fakeRadio().corruptRegister = 0x0D;     // FREQ2
+  waterMeter->selectProfile(&RADIO_PROFILES[1]);
+  waterMeter->service();
+
+  TEST_ASSERT_EQUAL_PTR(&old, &waterMeter->getProfile());
+  TEST_ASSERT_EQUAL(0, stats().profileSwitches);
+  TEST_ASSERT_GREATER_OR_EQUAL(1, stats().configErrors);
+  TEST_ASSERT_EQUAL_HEX8(FakeCC1101::STATE_RX, fakeRadio().state);
+}
+
+// our meters' frequency offset is averaged into FSCTRL0, the neighbours'
+// isn't; the correction is written on the way back to RX
+static void test_afc_corrects_our_meters_offset(void)
+{
+  FakeCC1101 &radio = fakeRadio();
+
+  radio.freqEst = -20;
+  for (int i = 0; i < 2 * AFC_FRAMES; i++)
+  {
+    receiveAndDecode(packetC1A(linkData(FOREIGN_METER, 40)));
+  }
+  TEST_ASSERT_EQUAL(2 * AFC_FRAMES, stats().foreignFrames);
+  TEST_ASSERT_EQUAL(0, stats().afcUpdates);
+
+  radio.freqEst = 5;
+  for (int i = 0; i < AFC_FRAMES - 1; i++)
+  {
+    receiveAndDecode(packetC1A(linkData(OUR_METER, 40)));
+  }
+  TEST_ASSERT_EQUAL(0, stats().afcUpdates);
+  TEST_ASSERT_EQUAL_HEX8(0, radio.regs[CC1101_FSCTRL0]);
+
+  receiveAndDecode(packetC1A(linkData(OUR_METER, 40)));
+  TEST_ASSERT_EQUAL(1, stats().afcUpdates);
+  TEST_ASSERT_EQUAL(5, stats().afcOffset);
+  TEST_ASSERT_EQUAL_HEX8(5, radio.regs[CC1101_FSCTRL0]);
+  TEST_ASSERT_EQUAL_HEX8(FakeCC1101::STATE_RX, radio.state);
+
+  // FREQEST is relative, the corrections add up to the limit
+  radio.freqEst = -100;
+  for (int i = 0; i < 2 * AFC_FRAMES; i++)
+  {
+    receiveAndDecode(packetC1A(linkData(OUR_METER, 40)));
+  }
+  TEST_ASSERT_EQUAL(-AFC_LIMIT, stats().afcOffset);
+  TEST_ASSERT_EQUAL_HEX8((uint8_t)-AFC_LIMIT, radio.regs[CC1101_FSCTRL0]);
+}
+
+// an overflow between frames is only found by the state check, a flush
+// gets the receiver back to RX
+static void test_overflow_between_frames_is_flushed(void)
+{
+  FakeCC1101 &radio = fakeRadio();
+
+  // one MARCSTATE read per interval while nothing happens
+  radio.transcript.clear();
+  idle(10 * RADIO_CHECK_INTERVAL_MS);
+  TEST_ASSERT_EQUAL(10, radio.countTransactions(CC1101_MARCSTATE | CC1101_STATUS_REGISTER));
+
+  radio.state = FakeCC1101::STATE_RXFIFO_OVERFLOW;
+  radio.overflowed = true;
+  radio.fifo.assign(FakeCC1101::FIFO_SIZE, 0x55);
+  radio.transcript.clear();
+
+  uint32_t ms = 0;
+  while (radio.state != FakeCC1101::STATE_RX && ms <= RADIO_CHECK_INTERVAL_MS)
+  {
+    idle(1);
+    ms++;
+  }
+  TEST_ASSERT_LESS_OR_EQUAL(RADIO_CHECK_INTERVAL_MS, ms);
+  TEST_ASSERT_EQUAL_HEX8(FakeCC1101::STATE_RX, radio.state);
+  TEST_ASSERT_EQUAL(1, stats().fifoOverflows);
+  TEST_ASSERT_EQUAL(1, stats().recoveries);
+  TEST_ASSERT_EQUAL(0, stats().reinits);
+  TEST_ASSERT_EQUAL(1, radio.countTransactions(CC1101_SFRX));
+  TEST_ASSERT_EQUAL(0, radio.countTransactions(CC1101_SRES));
+  TEST_ASSERT_TRUE(radio.fifo.empty());
+
+  receive(packetC1B(linkData(FOREIGN_METER, 60)), 10);
+  TEST_ASSERT_EQUAL(1, waterMeter->getQueueDepth());
+}
+
+// a chip that ignores every strobe is reset and configured again
+static void test_hung_radio_is_reset(void)
+{
+  FakeCC1101 &radio = fakeRadio();
+  const RadioProfile &profile = waterMeter->getProfile();
+
+  idle(RADIO_CHECK_INTERVAL_MS);
+  radio.state = FakeCC1101::STATE_RXFIFO_OVERFLOW;
+  radio.hung = true;
+  radio.transcript.clear();
+  idle(RADIO_CHECK_INTERVAL_MS);
+
+  TEST_ASSERT_FALSE(radio.hung);
+  TEST_ASSERT_EQUAL_HEX8(FakeCC1101::STATE_RX, radio.state);
+  TEST_ASSERT_EQUAL(1, stats().reinits);
+  TEST_ASSERT_GREATER_OR_EQUAL(1, stats().stateTimeouts);
+  TEST_ASSERT_EQUAL(1, radio.countTransactions(CC1101_SRES));
+  TEST_ASSERT_EQUAL_HEX8(profile.regs[CC1101_FREQ2], radio.regs[CC1101_FREQ2]);
+  TEST_ASSERT_EQUAL(0, stats().configErrors);
+
+  receive(packetC1B(linkData(FOREIGN_METER, 60)), 10);
+  TEST_ASSERT_EQUAL(1, waterMeter->getQueueDepth());
+}
+
+// out of RX and SRX doesn't help: flush and retry, then reset
+static void test_radio_refusing_rx_is_recovered(void)
+{
+  FakeCC1101 &radio = fakeRadio();
+
+  idle(RADIO_CHECK_INTERVAL_MS);
+  radio.state = FakeCC1101::STATE_IDLE;
+  radio.ignoreRx = true;
+  uint32_t deaf = (uint32_t)stats().deafTimeUs;
+  idle(RADIO_CHECK_INTERVAL_MS);
+
+  TEST_ASSERT_EQUAL_HEX8(FakeCC1101::STATE_RX, radio.state);
+  TEST_ASSERT_EQUAL(2, stats().recoveries);
+  TEST_ASSERT_EQUAL(2, stats().stateTimeouts);
+  TEST_ASSERT_EQUAL(1, stats().reinits);
+  TEST_ASSERT_GREATER_OR_EQUAL(2 * RX_TIMEOUT_US, stats().deafTimeUs - deaf);
+
+  receive(packetC1B(linkData(FOREIGN_METER, 60)), 10);
+  TEST_ASSERT_EQUAL(1, waterMeter->getQueueDepth());
+}
+
+// how fast the fifo is drained: SPI bytes per received byte, with the fake's
+// 1 us per SPI byte, against 80 us per byte on air; and host time per frame
+static void test_drain_rate_benchmark(void)
+{
+  FakeCC1101 &radio = fakeRadio();
+  const int rounds = 200;
+  Bytes packet = packetC1A(linkData(FOREIGN_METER, 255));
+
+  radio.transcript.clear();
+  uint32_t start = testMicros();
+  for (int i = 0; i < rounds; i++)
+  {
+    receive(packet, 16);
+    while (waterMeter->getQueueDepth() > 0)
+    {
+      waterMeter->isFrameAvailable();
+    }
+  }
+  uint32_t host = testMicros() - start;
+  TEST_ASSERT_EQUAL(rounds, stats().framesC1A);
+  TEST_ASSERT_EQUAL(0, stats().fifoOverflows);
+
+  size_t spiBytes = 0;
+  for (const Bytes &t : radio.transcript) spiBytes += t.size();
+  size_t bursts = radio.countTransactions(CC1101_RXFIFO | READ_BURST);
+  size_t received = rounds * packet.size();
+
+  // the drain must stay well ahead of the air
+  TEST_ASSERT_LESS_THAN(received * 2, spiBytes);
+
+  char message[160];
+  snprintf(message, sizeof(message), "%u byte C1 frame: %.2f SPI bytes per byte received, %.1f per burst, "
+           "%.0f bytes/ms drained vs 12.5 on air, %u us host",
+           (unsigned int)packet.size(), (double)spiBytes / received, (double)received / bursts,
+           1000.0 * received / spiBytes, (unsigned int)(host / rounds));
+  TEST_MESSAGE(message);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_receiver_starts_in_rx);
+  RUN_TEST(test_frame_is_drained_with_burst_reads);
+  RUN_TEST(test_frame_longer_than_fifo);
+  RUN_TEST(test_long_t1_frame);
+  RUN_TEST(test_bad_block_rejects_early);
+  RUN_TEST(test_frames_back_to_back);
+  RUN_TEST(test_fifo_overflow_drops_frame);
+  RUN_TEST(test_stalled_frame_is_dropped);
+  RUN_TEST(test_profile_is_written_in_one_burst);
+  RUN_TEST(test_bad_readback_keeps_profile);
+  RUN_TEST(test_afc_corrects_our_meters_offset);
+  RUN_TEST(test_overflow_between_frames_is_flushed);
+  RUN_TEST(test_hung_radio_is_reset);
+  RUN_TEST(test_radio_refusing_rx_is_recovered);
+  RUN_TEST(test_drain_rate_benchmark);
+  return UNITY_END();
+}
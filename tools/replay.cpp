@@ -0,0 +1,541 @@
+/*
+ Copyright (C) 2020 chester4444@wolke7.net
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// replay: decodes captured wmbus frames on the host with the firmware's
+// decoder (crc, AES-CTR, data records, meter profiles)
+//
+//   replay [-b] [-j threads] [-f csv|jsonl] [-o output] -k keys capture
+//
+// capture: one frame per line as hex, the payload after the lfield without
+// the link layer crcs, as logged by the firmware ("Payload: " is skipped),
+// or with -b binary frames, each an lfield followed by that many bytes
+// keys: one meter per line, serial and key as hex ("12345678 0011...ff")
+//
+// frames are grouped by meter, a meter's frames are decoded in order by one
+// worker; a first pass learns the layouts of all long frames, so compact
+// frames decode the same with any number of threads, only those whose layout
+// isn't in the capture are held; the output is in frame order per meter, the
+// meters are interleaved
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <time.h>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "WMbusFrame.h"
+#include "JsonWriter.h"
+
+#define OUTPUT_FLUSH_SIZE (1 << 20)   // bytes a worker collects before writing
+#define MAX_THREADS       256
+
+enum OutputFormat
+{
+  OutputCsv,
+  OutputJsonl,
+};
+
+static const char *const STATUS_NAMES[] =
+{
+  "ok", "short", "notdata", "crc", "records", "held",
+};
+
+struct Frame
+{
+  uint32_t offset;      // in Capture::data
+  uint8_t length;
+};
+
+struct Capture
+{
+  std::vector<uint8_t> data;
+  std::vector<Frame> frames;
+};
+
+// all frames of a meter, in capture order
+struct MeterGroup
+{
+  Meter *meter;
+  std::vector<uint32_t> frames;
+};
+
+// what a worker did
+struct WorkerStats
+{
+  uint64_t frames = 0;
+  uint64_t status[sizeof(STATUS_NAMES) / sizeof(STATUS_NAMES[0])] = {};
+  double seconds = 0;   // cpu time, so the rate is per core even with more threads than cores
+};
+
+static double threadSeconds(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+  return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+static OutputFormat format = OutputCsv;
+static FILE *output = stdout;
+static std::mutex outputLock;
+
+// the handler context of a worker
+struct Worker
+{
+  WMBusFrame learner;           // first pass, layouts only
+  WMBusFrame decoder;
+  CipherSlot ciphers[2];        // a worker decodes one meter at a time
+  std::string out;
+  WorkerStats stats;
+  uint32_t frame = 0;           // frame being decoded
+  uint32_t heldFrame = 0;       // compact frame held by the meter
+  bool held = false;
+
+  void flush(bool force)
+  {
+    if (out.empty() || (!force && out.size() < OUTPUT_FLUSH_SIZE)) return;
+
+    std::lock_guard<std::mutex> lock(outputLock);
+    fwrite(out.data(), 1, out.size(), output);
+    out.clear();
+  }
+};
+
+static int hexValue(char c)
+{
+  if (c >= '0' && c <= '9') return c - '0';
+  c = tolower(c);
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  return -1;
+}
+
+// hex digits to bytes, false for anything else or too many
+static bool parseHex(const char *text, uint8_t *out, size_t max, size_t &len)
+{
+  len = 0;
+  while (*text && !isspace((unsigned char)*text))
+  {
+    int hi = hexValue(text[0]);
+    int lo = hexValue(text[1]);
+    if (hi < 0 || lo < 0 || len == max) return false;
+    out[len++] = (hi << 4) | lo;
+    text += 2;
+  }
+  return len > 0;
+}
+
+// the meters point into keys, both are filled here
+static bool readKeys(const char *path, std::vector<Meter> &meters, std::vector<std::array<uint8_t, 16> > &keys)
+{
+  FILE *file = fopen(path, "r");
+  if (file == NULL)
+  {
+    perror(path);
+    return false;
+  }
+
+  char line[256];
+  std::unordered_set<uint32_t> ids;
+  while (fgets(line, sizeof(line), file))
+  {
+    char serial[16], keyText[64];
+    uint8_t id[4], key[16];
+    size_t idLength, keyLength;
+
+    if (line[0] == '#' || sscanf(line, "%15s %63s", serial, keyText) != 2) continue;
+    if (!parseHex(serial, id, sizeof(id), idLength) || idLength != 4
+        || !parseHex(keyText, key, sizeof(key), keyLength) || keyLength != 16)
+    {
+      fprintf(stderr, "%s: invalid line: %s", path, line);
+      continue;
+    }
+
+    Meter meter;
+    memset(&meter, 0, sizeof(meter));
+    meter.id = ((uint32_t)id[0] << 24) | ((uint32_t)id[1] << 16) | ((uint32_t)id[2] << 8) | id[3];
+    if (!ids.insert(meter.id).second)
+    {
+      // which key would be the right one?
+      fprintf(stderr, "%s: meter %08x listed twice\n", path, (unsigned int)meter.id);
+      fclose(file);
+      return false;
+    }
+    snprintf(meter.name, sizeof(meter.name), "%08x", (unsigned int)meter.id);
+    meters.push_back(meter);
+    keys.push_back(std::array<uint8_t, 16>());
+    memcpy(keys.back().data(), key, sizeof(key));
+  }
+  fclose(file);
+
+  for (size_t i = 0; i < meters.size(); i++) meters[i].key = keys[i].data();
+  return true;
+}
+
+static bool readCapture(const char *path, bool binary, Capture &capture)
+{
+  FILE *file = fopen(path, binary ? "rb" : "r");
+  if (file == NULL)
+  {
+    perror(path);
+    return false;
+  }
+
+  if (binary)
+  {
+    int lfield;
+    while ((lfield = fgetc(file)) != EOF)
+    {
+      Frame frame = { (uint32_t)capture.data.size(), (uint8_t)lfield };
+      capture.data.resize(frame.offset + frame.length);
+      if (fread(&capture.data[frame.offset], 1, frame.length, file) != frame.length)
+      {
+        fprintf(stderr, "%s: truncated frame %zu\n", path, capture.frames.size());
+        capture.data.resize(frame.offset);
+        break;
+      }
+      capture.frames.push_back(frame);
+    }
+  }
+  else
+  {
+    char line[1024];
+    uint8_t bytes[WMBusFrame::MAX_LENGTH];
+    size_t len;
+
+    while (fgets(line, sizeof(line), file))
+    {
+      const char *text = strstr(line, "Payload: ");
+      text = text ? text + 9 : line;
+      while (isspace((unsigned char)*text)) text++;
+      if (!parseHex(text, bytes, sizeof(bytes), len)) continue;
+
+      Frame frame = { (uint32_t)capture.data.size(), (uint8_t)len };
+      capture.data.insert(capture.data.end(), bytes, bytes + len);
+      capture.frames.push_back(frame);
+    }
+  }
+  fclose(file);
+  return true;
+}
+
+// frame,meter,profile,status,key,value,unit - a line per value
+static void writeCsv(std::string &out, uint32_t frame, const Meter *meter, FrameStatus status,
+                     const DataRecords *records)
+{
+  char line[160];
+  const char *profile = meter->profile ? meter->profile->name : "";
+
+  if (records == NULL)
+  {
+    snprintf(line, sizeof(line), "%u,%s,%s,%s,,,\n", frame, meter->name, profile, STATUS_NAMES[status]);
+    out += line;
+    return;
+  }
+
+  for (uint8_t i = 0; i < meter->profile->fields; i++)
+  {
+    const ProfileField &field = meter->profile->field[i];
+    const DataRecord *record = findField(*records, field);
+    char value[FIXED_TEXT_LENGTH] = "";
+
+    if (record != NULL)
+    {
+      JsonWriter::formatFixed(value, record->scaled(field.exponent), field.decimals);
+    }
+    snprintf(line, sizeof(line), "%u,%s,%s,%s,%s,%s,%s\n", frame, meter->name, profile,
+             STATUS_NAMES[status], field.key, value, field.unit);
+    out += line;
+  }
+}
+
+// {"frame": 1,"meter": "12345678","profile": "multical21","status": "ok","CurrentValue": 1.234,...}
+static void writeJson(std::string &out, uint32_t frame, const Meter *meter, FrameStatus status,
+                      const DataRecords *records)
+{
+  char json[400];
+  char value[FIXED_TEXT_LENGTH];
+  JsonWriter writer(json, sizeof(json));
+
+  writer.beginObject();
+  JsonWriter::formatFixed(value, frame, 0);
+  writer.addNumber("frame", value);
+  writer.addString("meter", meter->name);
+  if (meter->profile) writer.addString("profile", meter->profile->name);
+  writer.addString("status", STATUS_NAMES[status]);
+  for (uint8_t i = 0; records != NULL && i < meter->profile->fields; i++)
+  {
+    const ProfileField &field = meter->profile->field[i];
+    const DataRecord *record = findField(*records, field);
+    if (record == NULL) continue;
+
+    JsonWriter::formatFixed(value, record->scaled(field.exponent), field.decimals);
+    writer.addNumber(field.key, value);
+  }
+  writer.endObject();
+
+  if (writer.ok())
+  {
+    out.append(writer.c_str(), writer.getLength());
+    out += '\n';
+  }
+}
+
+static void writeFrame(Worker &worker, uint32_t frame, const Meter *meter, FrameStatus status,
+                       const DataRecords *records)
+{
+  if (format == OutputCsv) writeCsv(worker.out, frame, meter, status, records);
+  else writeJson(worker.out, frame, meter, status, records);
+  worker.flush(false);
+}
+
+// the decoder's handler, a held compact frame comes first
+static void recordsDecoded(Meter *meter, const DataRecords &records, void *context)
+{
+  Worker &worker = *(Worker *)context;
+  uint32_t frame = worker.frame;
+
+  if (worker.decoder.status == FrameHeld && worker.held)
+  {
+    frame = worker.heldFrame;
+    worker.held = false;
+  }
+  writeFrame(worker, frame, meter, FrameOk, &records);
+}
+
+// first pass, decrypts a copy of the capture; the layouts end up in the learner
+static void learnGroup(Worker &worker, const Capture &capture, std::vector<uint8_t> &data, MeterGroup &group)
+{
+  for (uint32_t index : group.frames)
+  {
+    const Frame &frame = capture.frames[index];
+    worker.learner.decode(group.meter, &data[frame.offset], frame.length);
+  }
+}
+
+static void decodeGroup(Worker &worker, Capture &capture, MeterGroup &group)
+{
+  worker.held = false;
+
+  for (uint32_t index : group.frames)
+  {
+    const Frame &frame = capture.frames[index];
+
+    worker.frame = index;
+    worker.decoder.decode(group.meter, &capture.data[frame.offset], frame.length);
+
+    FrameStatus status = worker.decoder.isValid ? worker.decoder.status : FrameTooShort;
+    worker.stats.frames++;
+    worker.stats.status[status]++;
+
+    if (status == FrameHeld)
+    {
+      // the firmware keeps only the latest compact frame
+      if (worker.held) writeFrame(worker, worker.heldFrame, group.meter, FrameHeld, NULL);
+      worker.heldFrame = index;
+      worker.held = true;
+    }
+    else if (status != FrameOk)
+    {
+      writeFrame(worker, index, group.meter, status, NULL);
+    }
+  }
+
+  // never completed by a long frame
+  if (worker.held) writeFrame(worker, worker.heldFrame, group.meter, FrameHeld, NULL);
+}
+
+static void usage(void)
+{
+  fprintf(stderr, "usage: replay [-b] [-j threads] [-f csv|jsonl] [-o output] -k keys capture\n");
+  exit(2);
+}
+
+// 1 to MAX_THREADS, nothing else
+static unsigned int parseThreads(const char *text)
+{
+  char *end;
+  unsigned long threads = strtoul(text, &end, 10);
+
+  if (!isdigit((unsigned char)text[0]) || *end != '\0' || threads < 1 || threads > MAX_THREADS)
+  {
+    fprintf(stderr, "replay: -j %s: 1 to %d threads\n", text, MAX_THREADS);
+    usage();
+  }
+  return (unsigned int)threads;
+}
+
+// each worker takes the next meter until there are none left
+template <typename Job>
+static void runWorkers(std::vector<Worker> &workers, size_t groups, Job job)
+{
+  std::vector<std::thread> pool;
+  std::atomic<size_t> nextGroup(0);
+
+  for (Worker &worker : workers)
+  {
+    pool.push_back(std::thread([&worker, &nextGroup, groups, &job]() {
+      double begin = threadSeconds();
+      size_t group;
+
+      while ((group = nextGroup++) < groups)
+      {
+        job(worker, group);
+      }
+      worker.stats.seconds += threadSeconds() - begin;
+    }));
+  }
+  for (std::thread &thread : pool) thread.join();
+}
+
+int main(int argc, char **argv)
+{
+  const char *keyPath = NULL;
+  const char *outputPath = NULL;
+  bool binary = false;
+  unsigned int threads = std::thread::hardware_concurrency();
+  int arg = 1;
+
+  for (; arg < argc && argv[arg][0] == '-'; arg++)
+  {
+    const char *option = argv[arg];
+    if (strcmp(option, "-b") == 0) binary = true;
+    else if (arg + 1 == argc) usage();
+    else if (strcmp(option, "-k") == 0) keyPath = argv[++arg];
+    else if (strcmp(option, "-o") == 0) outputPath = argv[++arg];
+    else if (strcmp(option, "-j") == 0) threads = parseThreads(argv[++arg]);
+    else if (strcmp(option, "-f") == 0)
+    {
+      const char *name = argv[++arg];
+      if (strcmp(name, "csv") == 0) format = OutputCsv;
+      else if (strcmp(name, "jsonl") == 0) format = OutputJsonl;
+      else usage();
+    }
+    else usage();
+  }
+  if (keyPath == NULL || arg + 1 != argc) usage();
+  if (threads == 0) threads = 1;     // hardware_concurrency() unknown
+  if (threads > MAX_THREADS) threads = MAX_THREADS;
+
+  std::vector<Meter> meters;
+  std::vector<std::array<uint8_t, 16> > keys;
+  Capture capture;
+  if (!readKeys(keyPath, meters, keys) || !readCapture(argv[arg], binary, capture)) return 1;
+
+  if (outputPath != NULL && (output = fopen(outputPath, "w")) == NULL)
+  {
+    perror(outputPath);
+    return 1;
+  }
+
+  // a group per meter, frames of meters without a key are skipped
+  std::unordered_map<uint32_t, size_t> groupOf;
+  std::vector<MeterGroup> groups;
+  uint64_t foreign = 0;
+
+  for (Meter &meter : meters)
+  {
+    groupOf[meter.id] = groups.size();
+    groups.push_back(MeterGroup{ &meter, std::vector<uint32_t>() });
+  }
+  for (uint32_t i = 0; i < capture.frames.size(); i++)
+  {
+    const Frame &frame = capture.frames[i];
+    auto group = frame.length > 6
+      ? groupOf.find(WMBusFrame::meterIdOf(&capture.data[frame.offset])) : groupOf.end();
+
+    if (group == groupOf.end()) foreign++;
+    else groups[group->second].frames.push_back(i);
+  }
+
+  if (format == OutputCsv) fputs("frame,meter,profile,status,key,value,unit\n", output);
+
+  std::vector<Worker> workers(threads);
+  auto start = std::chrono::steady_clock::now();
+
+  // pass 1: the layouts of all long frames, on a copy as decoding decrypts
+  // in place; merged in worker order, so without evictions the result
+  // doesn't depend on which worker had which meter
+  std::vector<uint8_t> scratch(capture.data);
+  for (Worker &worker : workers)
+  {
+    worker.learner.useCiphers(worker.ciphers, 2);
+  }
+  runWorkers(workers, groups.size(), [&capture, &scratch, &groups](Worker &worker, size_t group) {
+    learnGroup(worker, capture, scratch, groups[group]);
+  });
+  std::vector<uint8_t>().swap(scratch);
+
+  FormatCache layouts;
+  uint32_t evictions = 0;
+  for (Worker &worker : workers)
+  {
+    layouts.learn(worker.learner.getFormats());
+    evictions += worker.learner.getFormatStatistics().evictions;
+  }
+  evictions += layouts.getStatistics().evictions;
+
+  // pass 2: every worker starts with all layouts
+  for (Worker &worker : workers)
+  {
+    worker.decoder.getFormats().learn(layouts);
+    worker.decoder.useCiphers(worker.ciphers, 2);
+    worker.decoder.onRecords(recordsDecoded, &worker);
+  }
+  runWorkers(workers, groups.size(), [&capture, &groups](Worker &worker, size_t group) {
+    decodeGroup(worker, capture, groups[group]);
+  });
+  for (Worker &worker : workers)
+  {
+    worker.flush(true);
+    evictions += worker.decoder.getFormatStatistics().evictions;
+  }
+
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  if (output != stdout) fclose(output);
+
+  // throughput to stderr, the output may be stdout
+  WorkerStats total;
+  for (size_t i = 0; i < workers.size(); i++)
+  {
+    const WorkerStats &stats = workers[i].stats;
+    fprintf(stderr, "worker %zu: %llu frames, %.3f s, %.0f frames/s\n", i,
+            (unsigned long long)stats.frames, stats.seconds, stats.seconds > 0 ? stats.frames / stats.seconds : 0);
+    total.frames += stats.frames;
+    total.seconds += stats.seconds;
+    for (size_t s = 0; s < sizeof(total.status) / sizeof(total.status[0]); s++) total.status[s] += stats.status[s];
+  }
+
+  fprintf(stderr, "%llu frames of %zu meters, %llu without key\n",
+          (unsigned long long)total.frames, meters.size(), (unsigned long long)foreign);
+  for (size_t s = 0; s < sizeof(total.status) / sizeof(total.status[0]); s++)
+  {
+    fprintf(stderr, "  %-8s %llu\n", STATUS_NAMES[s], (unsigned long long)total.status[s]);
+  }
+  if (evictions > 0)
+  {
+    fprintf(stderr, "warning: %u layouts evicted, more than FORMAT_CACHE_SIZE (%d) formats; "
+            "compact frames may decode differently with another -j\n", (unsigned int)evictions, FORMAT_CACHE_SIZE);
+  }
+  fprintf(stderr, "%.3f s on %u threads, %.0f frames/s, %.0f frames/s per core\n", seconds, threads,
+          seconds > 0 ? total.frames / seconds : 0, total.seconds > 0 ? total.frames / total.seconds : 0);
+  return 0;
+}